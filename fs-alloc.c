@@ -0,0 +1,364 @@
+#include "fs-alloc.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const char *policy_names[ALLOC_POLICIES] = { "first", "next", "best", "segregated" };
+
+/**
+ * @brief Reads a field of a tree node. Only internal nodes are stored in the field arrays: a leaf
+ * has the same value in every field (1 if its block is free, 0 if used), read from the leaf bitmap.
+ *
+ * @param alloc - Allocator that owns the tree
+ * @param field - Field array of the internal nodes (pre, suf, max or runs)
+ * @param node - Index of the node
+ * @return Integer value of the field of the node
+ */
+static inline int node_get(const Allocator *alloc, const int *field, int node) {
+    if (node < alloc->leaves) return field[node];
+    int block = node - alloc->leaves;
+    return (alloc->leaf_free[block / 8] >> (block % 8)) & 1;
+}
+
+/**
+ * @brief Recomputes the free run lengths of a tree node from its two children.
+ *
+ * @param alloc - Allocator that owns the tree
+ * @param node - Index of the node to recompute
+ * @param len - # of blocks covered by each child of the node
+ */
+static void pull_node(Allocator *alloc, int node, int len) {
+    int l = 2 * node;
+    int r = 2 * node + 1;
+    int pre_l = node_get(alloc, alloc->pre, l), pre_r = node_get(alloc, alloc->pre, r);
+    int suf_l = node_get(alloc, alloc->suf, l), suf_r = node_get(alloc, alloc->suf, r);
+    int max_l = node_get(alloc, alloc->max, l), max_r = node_get(alloc, alloc->max, r);
+    alloc->pre[node] = (pre_l == len) ? len + pre_r : pre_l;
+    alloc->suf[node] = (suf_r == len) ? len + suf_l : suf_r;
+    int best = max_l > max_r ? max_l : max_r;
+    int mid = suf_l + pre_r;
+    alloc->max[node] = best > mid ? best : mid;
+    // A free run that crosses the middle was counted once in each child
+    alloc->runs[node] = node_get(alloc, alloc->runs, l) + node_get(alloc, alloc->runs, r) - (suf_l > 0 && pre_r > 0);
+}
+
+/**
+ * @brief Sets a single leaf of the tree without updating its ancestors.
+ *
+ * @param alloc - Allocator that owns the tree
+ * @param block - Block index of the leaf
+ * @param used - If 1 the block is used, if 0 the block is free
+ * @return Integer value change in the # of free blocks (-1, 0 or 1)
+ */
+static int set_leaf(Allocator *alloc, int block, int used) {
+    uint8_t bit = 1 << (block % 8);
+    int was_free = (alloc->leaf_free[block / 8] & bit) != 0;
+    if (used) alloc->leaf_free[block / 8] &= ~bit;
+    else alloc->leaf_free[block / 8] |= bit;
+    return !used - was_free;
+}
+
+/**
+ * @brief Finds the leftmost run of size free blocks that starts at or after block from, inside the
+ * subtree of node (which covers len blocks starting at lo).
+ *
+ * @param run - # of free blocks at or after from right before the subtree (updated for the next subtree)
+ * @return Integer value index of the first block of the run, -1 if it does not start in the subtree
+ */
+static int find_from(Allocator *alloc, int node, int lo, int len, int from, int size, int *run) {
+    if (lo + len <= from) return -1; // Every block of the subtree is before from
+    if (lo >= from) {
+        int pre = node_get(alloc, alloc->pre, node);
+        if (*run + pre >= size) return lo - *run; // Run continues into the subtree
+        if (node_get(alloc, alloc->max, node) < size) {
+            *run = pre == len ? *run + len : node_get(alloc, alloc->suf, node);
+            return -1; // No run inside the subtree is large enough
+        }
+    }
+    int half = len / 2;
+    int found = find_from(alloc, 2 * node, lo, half, from, size, run);
+    if (found != -1) return found;
+    return find_from(alloc, 2 * node + 1, lo + half, half, from, size, run);
+}
+
+/**
+ * @brief Finds the first used block at or after block from, inside the subtree of node
+ * (which covers len blocks starting at lo).
+ *
+ * @return Integer value index of the block, -1 if every block of the subtree from there on is free
+ */
+static int find_used(Allocator *alloc, int node, int lo, int len, int from) {
+    if (lo + len <= from || (lo >= from && node_get(alloc, alloc->pre, node) == len)) return -1;
+    if (len == 1) return lo;
+    int half = len / 2;
+    int found = find_used(alloc, 2 * node, lo, half, from);
+    if (found != -1) return found;
+    return find_used(alloc, 2 * node + 1, lo + half, half, from);
+}
+
+/**
+ * @brief Finds the lowest run of size free blocks (first fit), walking down the tree
+ * and preferring the leftmost child that can still hold the run.
+ */
+static int first_fit(Allocator *alloc, int size) {
+    int node = 1;
+    int lo = 0;
+    int len = alloc->leaves;
+    while (node < alloc->leaves) {
+        int half = len / 2;
+        int l = 2 * node;
+        int r = 2 * node + 1;
+        int suf_l = node_get(alloc, alloc->suf, l);
+        if (node_get(alloc, alloc->max, l) >= size) {
+            node = l;
+        } else if (suf_l + node_get(alloc, alloc->pre, r) >= size) {
+            return lo + half - suf_l; // Run straddles both children
+        } else {
+            node = r;
+            lo += half;
+        }
+        len = half;
+    }
+    return lo;
+}
+
+/**
+ * @brief Finds the highest free run that can hold size blocks and returns the last size blocks
+ * of it, walking down the tree and preferring the rightmost child that can still hold the run.
+ */
+static int last_fit(Allocator *alloc, int size) {
+    int node = 1;
+    int lo = 0;
+    int len = alloc->leaves;
+    while (node < alloc->leaves) {
+        int half = len / 2;
+        int l = 2 * node;
+        int r = 2 * node + 1;
+        int pre_r = node_get(alloc, alloc->pre, r);
+        if (node_get(alloc, alloc->max, r) >= size) {
+            node = r;
+            lo += half;
+        } else if (node_get(alloc, alloc->suf, l) + pre_r >= size) {
+            return lo + half + pre_r - size; // Run straddles both children
+        } else {
+            node = l;
+        }
+        len = half;
+    }
+    return lo;
+}
+
+/**
+ * @brief Finds the smallest free run that can hold size blocks (the lowest one if several are
+ * as small). Only the runs large enough are visited, and an exact fit ends the search.
+ */
+static int best_fit(Allocator *alloc, int size) {
+    int best = -1;
+    int best_len = 0;
+    int from = alloc->data_start;
+    for (;;) {
+        int run = 0;
+        int start = find_from(alloc, 1, 0, alloc->leaves, from, size, &run);
+        if (start == -1) break;
+        int end = find_used(alloc, 1, 0, alloc->leaves, start);
+        if (end == -1) end = alloc->leaves;
+        if (best == -1 || end - start < best_len) {
+            best = start;
+            best_len = end - start;
+            if (best_len == size) break;
+        }
+        from = end;
+    }
+    return best;
+}
+
+/**
+ * @brief Moves an entry of the free inode heap up until the heap order is restored.
+ *
+ * @param alloc - Allocator that owns the heap
+ * @param pos - Position of the entry to move
+ */
+static void heap_up(Allocator *alloc, int pos) {
+    int *heap = alloc->free_inodes;
+    while (pos > 0) {
+        int parent = (pos - 1) / 2;
+        if (heap[parent] <= heap[pos]) break;
+        int tmp = heap[parent];
+        heap[parent] = heap[pos];
+        heap[pos] = tmp;
+        pos = parent;
+    }
+}
+
+/**
+ * @brief Moves an entry of the free inode heap down until the heap order is restored.
+ *
+ * @param alloc - Allocator that owns the heap
+ * @param pos - Position of the entry to move
+ */
+static void heap_down(Allocator *alloc, int pos) {
+    int *heap = alloc->free_inodes;
+    for (;;) {
+        int smallest = pos;
+        int l = 2 * pos + 1;
+        int r = 2 * pos + 2;
+        if (l < alloc->free_count && heap[l] < heap[smallest]) smallest = l;
+        if (r < alloc->free_count && heap[r] < heap[smallest]) smallest = r;
+        if (smallest == pos) break;
+        int tmp = heap[smallest];
+        heap[smallest] = heap[pos];
+        heap[pos] = tmp;
+        pos = smallest;
+    }
+}
+
+int alloc_init(Allocator *alloc, FsMeta *m) {
+    alloc->nblocks = m->nblocks;
+    alloc->data_start = m->data_start;
+    alloc->leaves = 1;
+    while (alloc->leaves < alloc->nblocks) alloc->leaves *= 2;
+    // Internal nodes are 1 to leaves - 1, the leaves themselves are one bit each
+    alloc->pre = malloc(alloc->leaves * sizeof(int));
+    alloc->suf = malloc(alloc->leaves * sizeof(int));
+    alloc->max = malloc(alloc->leaves * sizeof(int));
+    alloc->runs = malloc(alloc->leaves * sizeof(int));
+    alloc->leaf_free = calloc((alloc->leaves + 7) / 8, 1);
+    alloc->ninodes = m->ninodes;
+    alloc->free_inodes = malloc((alloc->ninodes > 0 ? alloc->ninodes : 1) * sizeof(int));
+    alloc->free_count = 0;
+    alloc->inode_gen = calloc(alloc->ninodes > 0 ? alloc->ninodes : 1, sizeof(unsigned));
+    if (alloc->pre == NULL || alloc->suf == NULL || alloc->max == NULL || alloc->runs == NULL ||
+        alloc->leaf_free == NULL || alloc->free_inodes == NULL || alloc->inode_gen == NULL) {
+        alloc_destroy(alloc);
+        return -1;
+    }
+    alloc->free_blocks = 0;
+    alloc->cursor = alloc->data_start;
+    alloc->failures = 0;
+
+    // Load the free block list into the leaves (metadata and padding leaves are always used)
+    for (int i=0; i < alloc->leaves; i++) {
+        int used = 1;
+        if (i >= alloc->data_start && i < alloc->nblocks) used = meta_block_used(m, i);
+        alloc->free_blocks += set_leaf(alloc, i, used);
+    }
+    // Build every internal node from the bottom up
+    for (int level = alloc->leaves / 2, len = 1; level >= 1; level /= 2, len *= 2) {
+        for (int node=level; node < 2 * level; node++) pull_node(alloc, node, len);
+    }
+
+    // Push every free inode onto the heap (ascending order is already a valid min-heap)
+    for (int i=0; i < alloc->ninodes; i++) {
+        if (!(m->inode[i].flags & INODE_USED)) alloc->free_inodes[alloc->free_count++] = i;
+    }
+    return 0;
+}
+
+void alloc_destroy(Allocator *alloc) {
+    free(alloc->pre);
+    free(alloc->suf);
+    free(alloc->max);
+    free(alloc->runs);
+    free(alloc->leaf_free);
+    free(alloc->free_inodes);
+    free(alloc->inode_gen);
+    alloc->pre = alloc->suf = alloc->max = alloc->runs = NULL;
+    alloc->leaf_free = NULL;
+    alloc->free_inodes = NULL;
+    alloc->inode_gen = NULL;
+    alloc->free_count = 0;
+}
+
+void alloc_mark_blocks(Allocator *alloc, int start_idx, int size, int used) {
+    if (size <= 0) return;
+    int first = start_idx;
+    int last = start_idx + size - 1;
+    if (first < alloc->data_start) first = alloc->data_start;   // metadata blocks are never free
+    if (last >= alloc->nblocks) last = alloc->nblocks - 1;
+    if (first > last) return;
+
+    for (int i=first; i <= last; i++) alloc->free_blocks += set_leaf(alloc, i, used);
+
+    // Recompute only the ancestors of the updated leaves, one level at a time
+    int lo = (alloc->leaves + first) / 2;
+    int hi = (alloc->leaves + last) / 2;
+    for (int len = 1; lo >= 1; len *= 2, lo /= 2, hi /= 2) {
+        for (int node=lo; node <= hi; node++) pull_node(alloc, node, len);
+    }
+}
+
+int alloc_find_blocks(Allocator *alloc, int size, int policy) {
+    if (size <= 0) return -1;
+    if (node_get(alloc, alloc->max, 1) < size) {
+        alloc->failures++;
+        return -1;
+    }
+
+    int start;
+    if (policy == ALLOC_NEXT_FIT) {
+        int run = 0;
+        start = find_from(alloc, 1, 0, alloc->leaves, alloc->cursor, size, &run);
+        if (start == -1) start = first_fit(alloc, size); // Wrap around to the start of the disk
+        alloc->cursor = start + size;
+    } else if (policy == ALLOC_BEST_FIT) {
+        start = best_fit(alloc, size);
+    } else if (policy == ALLOC_SEGREGATED && size >= ALLOC_SMALL_FILE) {
+        start = last_fit(alloc, size);
+    } else {
+        start = first_fit(alloc, size);
+    }
+    return start;
+}
+
+int alloc_largest_extent(Allocator *alloc) {
+    return node_get(alloc, alloc->max, 1);
+}
+
+int alloc_first_free(Allocator *alloc) {
+    if (node_get(alloc, alloc->max, 1) == 0) return -1;
+    return first_fit(alloc, 1);
+}
+
+int alloc_next_used(Allocator *alloc, int from) {
+    int block = find_used(alloc, 1, 0, alloc->leaves, from);
+    if (block >= alloc->nblocks) return -1; // Padding leaves past the end of the disk
+    return block;
+}
+
+int alloc_free_extents(Allocator *alloc) {
+    return node_get(alloc, alloc->runs, 1);
+}
+
+const char *alloc_policy_name(int policy) {
+    return policy_names[policy];
+}
+
+int alloc_policy_parse(const char *name) {
+    for (int p=0; p < ALLOC_POLICIES; p++) {
+        if (strcmp(name, policy_names[p]) == 0) return p;
+    }
+    return -1;
+}
+
+int alloc_peek_inode(Allocator *alloc) {
+    if (alloc->free_count == 0) return -1;
+    return alloc->free_inodes[0];
+}
+
+int alloc_take_inode(Allocator *alloc) {
+    if (alloc->free_count == 0) return -1;
+    int idx = alloc->free_inodes[0];
+    alloc->free_inodes[0] = alloc->free_inodes[--alloc->free_count];
+    heap_down(alloc, 0);
+    return idx;
+}
+
+void alloc_release_inode(Allocator *alloc, int inode_idx) {
+    alloc->inode_gen[inode_idx]++;
+    if (alloc->free_count == alloc->ninodes) return;
+    alloc->free_inodes[alloc->free_count] = inode_idx;
+    heap_up(alloc, alloc->free_count++);
+}
+
+unsigned alloc_inode_generation(Allocator *alloc, int inode_idx) {
+    return alloc->inode_gen[inode_idx];
+}
@@ -0,0 +1,159 @@
+#ifndef FS_ALLOC_H
+#define FS_ALLOC_H
+
+#include "fs-meta.h"
+
+#define ALLOC_SMALL_FILE 16 // Size-segregated policy: files smaller than this many blocks are kept low on the disk
+
+typedef enum {
+    ALLOC_FIRST_FIT,    // Lowest run that can hold the file
+    ALLOC_NEXT_FIT,     // First run that can hold the file at or after the end of the last allocation (wraps around)
+    ALLOC_BEST_FIT,     // Smallest free run that can hold the file (lowest of equal runs)
+    ALLOC_SEGREGATED,   // Small files first fit from the bottom, larger files at the end of the highest run that fits
+    ALLOC_POLICIES      // # of policies
+} AllocPolicy;
+
+extern int alloc_policy; // Policy new files get their blocks by in every context (changed per script with the A command)
+
+typedef struct {
+    int nblocks;        // # of blocks on the disk (including the superblock)
+    int data_start;     // first block that can be allocated (every block before it is metadata)
+    int leaves;         // # of leaves in the extent tree (power of 2 >= nblocks)
+    int *pre;           // length of the free run at the start of each internal tree node
+    int *suf;           // length of the free run at the end of each internal tree node
+    int *max;           // length of the longest free run inside each internal tree node
+    int *runs;          // # of maximal free runs inside each internal tree node
+    uint8_t *leaf_free; // bit per leaf, 1 if its block is free (every field of a leaf is this bit)
+    int free_blocks;    // # of free blocks on the disk
+    int cursor;         // next-fit: block right after the last allocation
+    long failures;      // # of allocations that found no run large enough
+    int ninodes;        // # of inodes on the disk
+    int *free_inodes;   // min-heap of free inode indexes
+    int free_count;     // # of entries in the free inode heap
+    unsigned *inode_gen; // # of times each inode was freed, a reference to an inode that was reused has an older count
+} Allocator;
+
+/**
+ * @brief Builds the in-memory allocation engine for a disk. The free block list is
+ * loaded into an extent tree and every unused inode is pushed onto the free inode heap.
+ * The tree takes about 16 bytes per block of the disk (rounded up to a power of 2).
+ *
+ * @param alloc - Allocator to initialize
+ * @param m - Metadata of the disk to build the allocator from
+ * @return Integer value 0 if built, -1 if its memory cannot be allocated (nothing is left allocated)
+ */
+int alloc_init(Allocator *alloc, FsMeta *m);
+
+/**
+ * @brief Releases all memory held by an allocator.
+ *
+ * @param alloc - Allocator to free
+ */
+void alloc_destroy(Allocator *alloc);
+
+/**
+ * @brief Marks a range of blocks as used or free in the extent tree.
+ *
+ * @param alloc - Allocator to update
+ * @param start_idx - Index of first block to update
+ * @param size - # of blocks to update
+ * @param used - If 1 mark blocks as used, if 0 mark blocks as free
+ */
+void alloc_mark_blocks(Allocator *alloc, int start_idx, int size, int used);
+
+/**
+ * @brief Finds free contiguous blocks that can hold size blocks, picking the run by an allocation
+ * policy. Every policy walks the extent tree and skips the subtrees that cannot hold the file,
+ * so none of them scans the free block list. Next fit moves its cursor past the blocks found.
+ *
+ * @param alloc - Allocator to search
+ * @param size - # of contiguous blocks required
+ * @param policy - Allocation policy (AllocPolicy)
+ * @return Integer value index of the first block found, -1 if no run is large enough
+ */
+int alloc_find_blocks(Allocator *alloc, int size, int policy);
+
+/**
+ * @brief Gets the length of the largest run of free contiguous blocks.
+ *
+ * @param alloc - Allocator to query
+ * @return Integer value # of blocks in the largest free extent
+ */
+int alloc_largest_extent(Allocator *alloc);
+
+/**
+ * @brief Gets the lowest free block. Every block from the first data block up to it is used.
+ *
+ * @param alloc - Allocator to query
+ * @return Integer value index of the lowest free block, -1 if every block is used
+ */
+int alloc_first_free(Allocator *alloc);
+
+/**
+ * @brief Gets the lowest used block at or after a block, skipping the subtrees of the extent tree that are free.
+ *
+ * @param alloc - Allocator to query
+ * @param from - Index of the first block to look at
+ * @return Integer value index of the used block, -1 if every block from there to the end of the disk is free
+ */
+int alloc_next_used(Allocator *alloc, int from);
+
+/**
+ * @brief Gets the # of maximal runs of free contiguous blocks (kept up to date by every update of the tree).
+ *
+ * @param alloc - Allocator to query
+ * @return Integer value # of free extents
+ */
+int alloc_free_extents(Allocator *alloc);
+
+/**
+ * @brief Gets the name of an allocation policy.
+ *
+ * @param policy - Allocation policy (AllocPolicy)
+ * @return Name of the policy ("first", "next", "best" or "segregated")
+ */
+const char *alloc_policy_name(int policy);
+
+/**
+ * @brief Looks up an allocation policy by its name.
+ *
+ * @param name - Name of the policy ("first", "next", "best" or "segregated")
+ * @return Integer value the policy (AllocPolicy), -1 if there is no policy of that name
+ */
+int alloc_policy_parse(const char *name);
+
+/**
+ * @brief Gets the lowest free inode index without removing it from the heap.
+ *
+ * @param alloc - Allocator to query
+ * @return Integer value index of the lowest free inode, -1 if there are no free inodes
+ */
+int alloc_peek_inode(Allocator *alloc);
+
+/**
+ * @brief Removes the lowest free inode index from the heap.
+ *
+ * @param alloc - Allocator to update
+ * @return Integer value index of the inode taken, -1 if there are no free inodes
+ */
+int alloc_take_inode(Allocator *alloc);
+
+/**
+ * @brief Returns an inode index to the free inode heap.
+ *
+ * @param alloc - Allocator to update
+ * @param inode_idx - Index of the inode that was freed
+ */
+void alloc_release_inode(Allocator *alloc, int inode_idx);
+
+/**
+ * @brief Gets the generation of an inode, which changes every time the inode is freed. A reference to an
+ * inode that kept its generation still points to the same file or directory, even if the inode was reused.
+ *
+ * @param alloc - Allocator to query
+ * @param inode_idx - Index of the inode
+ * @return Unsigned value generation of the inode
+ */
+unsigned alloc_inode_generation(Allocator *alloc, int inode_idx);
+
+#endif
@@ -0,0 +1,500 @@
+#include "fs-sim.h"
+#include "fs-context.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <limits.h>
+#include <sys/wait.h>
+
+#define BENCH_BLOCKS 16384  // # of blocks of the v2 disks the benchmarks run on
+#define BENCH_INODES 4096   // # of inodes of the v2 disks the benchmarks run on
+
+typedef struct {
+    long *ns;           // Latency of each sample
+    int count;          // # of samples
+    int cap;            // # of samples ns can hold
+    long ops;           // # of operations the samples cover
+    long total_ns;      // Sum of the samples
+} Samples;
+
+typedef struct {
+    FILE *out;          // Machine-readable results (one JSON object per line)
+    char *label;        // Label of the run (e.g. the commit), copied into every result
+    int reps;           // Scale of the repetition counts
+} Bench;
+
+/**
+ * @brief Gets the current time of the monotonic clock.
+ *
+ * @return Time in nanoseconds
+ */
+long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/**
+ * @brief Seeded xorshift64 generator, so a workload is the same on every platform.
+ *
+ * @param state - Generator state (must not be 0)
+ * @return Next pseudo-random number
+ */
+uint64_t bench_rand(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+/**
+ * @brief Records the latency of one sample.
+ *
+ * @param s - Samples to add to
+ * @param ns - Latency of the sample
+ * @param ops - # of operations the sample covers
+ */
+void samples_add(Samples *s, long ns, long ops) {
+    if (s->count == s->cap) {
+        s->cap = s->cap ? 2 * s->cap : 1024;
+        s->ns = realloc(s->ns, s->cap * sizeof(long));
+    }
+    s->ns[s->count++] = ns;
+    s->ops += ops;
+    s->total_ns += ns;
+}
+
+/**
+ * @brief Compares two latencies for qsort.
+ */
+int compare_ns(const void *a, const void *b) {
+    long x = *(const long *)a;
+    long y = *(const long *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Writes the throughput and latency percentiles of a benchmark as one JSON line
+ * (and a readable line to stdout), then clears the samples.
+ *
+ * @param bench - Where the results go
+ * @param name - Name of the benchmark
+ * @param params - JSON members describing the parameters of the benchmark
+ * @param s - Samples of the benchmark
+ */
+void report(Bench *bench, const char *name, const char *params, Samples *s) {
+    if (s->count == 0) return;
+    qsort(s->ns, s->count, sizeof(long), compare_ns);
+    long p50 = s->ns[(s->count - 1) * 50 / 100];
+    long p90 = s->ns[(s->count - 1) * 90 / 100];
+    long p99 = s->ns[(s->count - 1) * 99 / 100];
+    long max = s->ns[s->count - 1];
+    double ops_per_sec = s->total_ns > 0 ? s->ops * 1e9 / s->total_ns : 0;
+    fprintf(bench->out, "{\"label\":\"%s\",\"bench\":\"%s\",%s,\"samples\":%d,\"ops\":%ld,"
+            "\"ops_per_sec\":%.1f,\"p50_ns\":%ld,\"p90_ns\":%ld,\"p99_ns\":%ld,\"max_ns\":%ld}\n",
+            bench->label, name, params, s->count, s->ops, ops_per_sec, p50, p90, p99, max);
+    if (bench->out != stdout) {
+        printf("%-18s %-48s %14.1f ops/s  p50 %10ld ns  p99 %10ld ns\n", name, params, ops_per_sec, p50, p99);
+    }
+    s->count = 0;
+    s->ops = 0;
+    s->total_ns = 0;
+}
+
+/**
+ * @brief Gets the name of the i-th file the benchmarks create (the prefix followed by i in base 36).
+ *
+ * @param prefix - First character of the name
+ * @param i - Index of the file (< 36^4)
+ * @param name - Name padded with 0s
+ */
+void bench_name(char prefix, int i, char name[5]) {
+    const char *digits = "0123456789abcdefghijklmnopqrstuvwxyz";
+    name[0] = prefix;
+    for (int d=4; d >= 1; d--) {
+        name[d] = digits[i % 36];
+        i /= 36;
+    }
+}
+
+/**
+ * @brief Formats an empty v2 disk of the benchmark geometry.
+ *
+ * @param path - Name of the disk
+ * @return Integer value 0 if the disk was created, -1 otherwise
+ */
+int format_disk(const char *path) {
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd == -1) return -1;
+    int ret = meta_format(fd, BENCH_BLOCKS, BENCH_INODES);
+    close(fd);
+    return ret == 0 ? 0 : -1;
+}
+
+/**
+ * @brief Copies a file.
+ */
+void copy_file(const char *src, const char *dst) {
+    int in = open(src, O_RDONLY);
+    int out = open(dst, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    uint8_t buff[65536];
+    ssize_t n;
+    while ((n = read(in, buff, sizeof(buff))) > 0) write(out, buff, n);
+    close(in);
+    close(out);
+}
+
+/**
+ * @brief Fills a disk to the given fullness and punches holes into it. fullness % of the inodes
+ * are used by files that together take fullness % of the data blocks, then fragmentation % of
+ * those files (spread evenly over the disk) are deleted again.
+ *
+ * @param ctx - Context to mount the disk in (it stays mounted)
+ * @param path - Name of the disk
+ * @param fullness - % of the inodes and data blocks to fill
+ * @param fragmentation - % of the files to delete again
+ * @return Integer value # of files left on the disk
+ */
+int fill_disk(FsContext *ctx, char *path, int fullness, int fragmentation) {
+    format_disk(path);
+    fs_mount(ctx, path);
+    int nfiles = BENCH_INODES * fullness / 100;
+    int data_blocks = BENCH_BLOCKS - ctx->mnt->meta.data_start;
+    int size = nfiles > 0 ? data_blocks * fullness / 100 / nfiles : 0;
+    if (size < 1) size = 1;
+    char name[5];
+    for (int i=0; i < nfiles; i++) {
+        bench_name('f', i, name);
+        fs_create(ctx, name, size);
+    }
+    int left = nfiles;
+    for (int i=0; fragmentation > 0 && i < nfiles; i++) {
+        if ((i * fragmentation) % 100 >= fragmentation) continue;
+        bench_name('f', i, name);
+        fs_delete(ctx, name);
+        left--;
+    }
+    return left;
+}
+
+/**
+ * @brief Runs every microbenchmark on one disk layout.
+ *
+ * @param bench - Where the results go
+ * @param dir - Directory for the disk images
+ * @param fullness - % of the inodes and data blocks to fill
+ * @param fragmentation - % of the files to delete again
+ */
+void micro_layout(Bench *bench, const char *dir, int fullness, int fragmentation) {
+    char disk[PATH_MAX];
+    char layout[PATH_MAX];
+    char params[128];
+    snprintf(disk, sizeof(disk), "%s/disk", dir);
+    snprintf(layout, sizeof(layout), "%s/layout", dir);
+    snprintf(params, sizeof(params), "\"fullness\":%d,\"fragmentation\":%d", fullness, fragmentation);
+
+    FILE *null = fopen("/dev/null", "w");
+    FsContext *ctx = malloc(sizeof(FsContext));
+    fs_init(ctx, null, null);
+    int nfiles = BENCH_INODES * fullness / 100;
+    fill_disk(ctx, disk, fullness, fragmentation);
+    fs_unmount(ctx);
+    copy_file(disk, layout); // Every benchmark starts from this layout
+
+    Samples s = {0};
+    uint64_t rng = 0x9E3779B97F4A7C15ULL;
+    char name[5];
+    fs_mount(ctx, disk);
+
+    // file_exists(): half of the lookups hit a file, half miss
+    for (int i=0; i < 20000 * bench->reps; i++) {
+        bench_name((i & 1) ? 'f' : 'x', nfiles > 0 ? (int)(bench_rand(&rng) % nfiles) : 0, name);
+        long start = now_ns();
+        file_exists(ctx, name);
+        samples_add(&s, now_ns() - start, 1);
+    }
+    report(bench, "file_exists", params, &s);
+
+    // fs_create() and fs_delete() of a 1 block file
+    Samples del = {0};
+    for (int i=0; i < 500 * bench->reps; i++) {
+        bench_name('n', i, name);
+        long start = now_ns();
+        fs_create(ctx, name, 1);
+        samples_add(&s, now_ns() - start, 1);
+        start = now_ns();
+        fs_delete(ctx, name);
+        samples_add(&del, now_ns() - start, 1);
+    }
+    report(bench, "fs_create", params, &s);
+    report(bench, "fs_delete", params, &del);
+    free(del.ns);
+
+    // fs_ls() of the root directory, which holds every file
+    for (int i=0; i < 20 * bench->reps; i++) {
+        long start = now_ns();
+        fs_ls(ctx);
+        samples_add(&s, now_ns() - start, 1);
+    }
+    report(bench, "fs_ls", params, &s);
+
+    // consistency_check() of the whole disk
+    for (int i=0; i < 20 * bench->reps; i++) {
+        long start = now_ns();
+        consistency_check(ctx, &ctx->mnt->meta);
+        samples_add(&s, now_ns() - start, 1);
+    }
+    report(bench, "consistency_check", params, &s);
+    fs_unmount(ctx);
+
+    // fs_defrag() changes the layout, so every run starts from a fresh copy
+    for (int i=0; i < 10 * bench->reps; i++) {
+        copy_file(layout, disk);
+        fs_mount(ctx, disk);
+        long start = now_ns();
+        fs_defrag(ctx, 0, 0);
+        samples_add(&s, now_ns() - start, 1);
+        fs_unmount(ctx);
+    }
+    report(bench, "fs_defrag", params, &s);
+
+    free(s.ns);
+    fs_destroy(ctx);
+    free(ctx);
+    fclose(null);
+    unlink(disk);
+    unlink(layout);
+}
+
+/**
+ * @brief Writes a seeded command script to a stream. Every profile mounts "disk" first.
+ * - rw: a few large files, then mostly buffer updates, reads and writes
+ * - churn: files are created and deleted over and over, with an occasional ls and defrag
+ * - deep: a deep directory tree that is walked up and down while files are created in it
+ *
+ * @param out - Stream to write the script to
+ * @param profile - Name of the profile
+ * @param seed - Seed of the generator
+ * @param lines - # of commands after the mount
+ * @return Integer value 0 if the profile exists, -1 otherwise
+ */
+int gen_workload(FILE *out, const char *profile, uint64_t seed, int lines) {
+    uint64_t rng = seed * 2654435761ULL + 1;
+    char name[5];
+    fprintf(out, "M disk\n");
+
+    if (strcmp(profile, "rw") == 0) {
+        int nfiles = 32;
+        for (int f=0; f < nfiles; f++) {
+            bench_name('f', f, name);
+            fprintf(out, "C %.5s %d\n", name, 64);
+        }
+        for (int i=0; i < lines; i++) {
+            int r = bench_rand(&rng) % 100;
+            bench_name('f', bench_rand(&rng) % nfiles, name);
+            int block = bench_rand(&rng) % 64;
+            if (r < 10) {
+                fprintf(out, "B ");
+                int len = 1 + bench_rand(&rng) % 64;
+                for (int c=0; c < len; c++) fputc('a' + bench_rand(&rng) % 26, out);
+                fputc('\n', out);
+            } else if (r < 50) {
+                fprintf(out, "W %.5s %d\n", name, block);
+            } else if (r < 97) {
+                fprintf(out, "R %.5s %d\n", name, block);
+            } else if (r < 99) {
+                fprintf(out, "L\n");
+            } else {
+                fprintf(out, "S\n");
+            }
+        }
+        return 0;
+    }
+
+    if (strcmp(profile, "churn") == 0) {
+        int pool = 1024; // Files are picked from a pool of names
+        uint8_t *exists = calloc(pool, 1);
+        for (int i=0; i < lines; i++) {
+            int r = bench_rand(&rng) % 100;
+            int f = bench_rand(&rng) % pool;
+            bench_name('f', f, name);
+            if (r < 47 && !exists[f]) {
+                fprintf(out, "C %.5s %d\n", name, 1 + (int)(bench_rand(&rng) % 16));
+                exists[f] = 1;
+            } else if (r < 94 && exists[f]) {
+                fprintf(out, "D %.5s\n", name);
+                exists[f] = 0;
+            } else if (r < 97) {
+                fprintf(out, "L\n");
+            } else if (r < 99) {
+                fprintf(out, "O\n");
+            } else {
+                fprintf(out, "S\n");
+            }
+        }
+        free(exists);
+        return 0;
+    }
+
+    if (strcmp(profile, "deep") == 0) {
+        int max_depth = 64;
+        int depth = 0; // Depth of the cwd below the root directory
+        int made = 0;  // # of directories of the chain that exist
+        int *files = calloc(max_depth + 1, sizeof(int)); // # of files created at each depth
+        for (int i=0; i < lines; i++) {
+            int r = bench_rand(&rng) % 100;
+            if (r < 30 && depth < max_depth) {
+                // Go one level down (every level holds the same directory name, d + depth)
+                bench_name('d', depth, name);
+                if (made == depth) {
+                    fprintf(out, "C %.5s 0\n", name);
+                    made++;
+                }
+                fprintf(out, "Y %.5s\n", name);
+                depth++;
+            } else if (r < 50 && depth > 0) {
+                fprintf(out, "Y ..\n");
+                depth--;
+            } else if (r < 70 && files[depth] < 200) {
+                bench_name('f', files[depth]++, name);
+                fprintf(out, "C %.5s %d\n", name, 1 + (int)(bench_rand(&rng) % 4));
+            } else if (r < 85 && files[depth] > 0) {
+                bench_name('f', bench_rand(&rng) % files[depth], name);
+                fprintf(out, "%c %.5s 0\n", (r & 1) ? 'W' : 'R', name);
+            } else {
+                fprintf(out, "L\n");
+            }
+        }
+        free(files);
+        return 0;
+    }
+    return -1;
+}
+
+/**
+ * @brief Times whole scripts of every workload profile run by the fs binary. Every run starts
+ * on a freshly formatted disk, throughput is reported in commands per second and the
+ * percentiles are of the run times.
+ *
+ * @param bench - Where the results go
+ * @param dir - Directory for the disk and scripts
+ * @param fs_path - Path of the fs binary
+ * @param seed - Seed of the workload generator
+ * @param lines - # of commands of each script
+ */
+void e2e(Bench *bench, const char *dir, char *fs_path, uint64_t seed, int lines) {
+    const char *profiles[] = { "rw", "churn", "deep" };
+    char script[PATH_MAX];
+    char disk[PATH_MAX];
+    char params[128];
+    snprintf(script, sizeof(script), "%s/input", dir);
+    snprintf(disk, sizeof(disk), "%s/disk", dir);
+    Samples s = {0};
+
+    for (size_t p=0; p < sizeof(profiles) / sizeof(profiles[0]); p++) {
+        FILE *out = fopen(script, "w");
+        gen_workload(out, profiles[p], seed, lines);
+        fclose(out);
+        snprintf(params, sizeof(params), "\"profile\":\"%s\",\"seed\":%lu,\"lines\":%d",
+                 profiles[p], (unsigned long)seed, lines);
+
+        for (int i=0; i < 3 * bench->reps; i++) {
+            format_disk(disk);
+            long start = now_ns();
+            pid_t pid = fork();
+            if (pid == 0) {
+                int null = open("/dev/null", O_WRONLY);
+                dup2(null, 1);
+                dup2(null, 2);
+                if (chdir(dir) == 0) execl(fs_path, fs_path, "input", (char *)NULL);
+                _exit(127);
+            }
+            int status;
+            waitpid(pid, &status, 0);
+            samples_add(&s, now_ns() - start, lines + 1);
+        }
+        report(bench, "e2e", params, &s);
+    }
+    free(s.ns);
+    unlink(script);
+    unlink(disk);
+}
+
+/**
+ * @brief Benchmarks of the file system simulator.
+ * Usage:
+ *   ./fs_bench micro [-r N] [-o file] [-l label]          microbenchmarks of the fs_* operations
+ *   ./fs_bench e2e [-r N] [-o file] [-l label] [-s seed] [-n lines] fs_binary
+ *                                                         timed runs of generated scripts
+ *   ./fs_bench gen [-s seed] [-n lines] rw|churn|deep     print a generated script
+ */
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s micro|e2e|gen [options]\n", argv[0]);
+        return 1;
+    }
+    char *mode = argv[1];
+    Bench bench = { .out = NULL, .label = "", .reps = 1 };
+    char *out_path = NULL;
+    uint64_t seed = 1;
+    int lines = 20000;
+    int opt;
+    optind = 2;
+    while ((opt = getopt(argc, argv, "r:o:l:s:n:")) != -1) {
+        switch (opt) {
+            case 'r': bench.reps = atoi(optarg); break;
+            case 'o': out_path = optarg; break;
+            case 'l': bench.label = optarg; break;
+            case 's': seed = strtoull(optarg, NULL, 10); break;
+            case 'n': lines = atoi(optarg); break;
+            default: return 1;
+        }
+    }
+    if (bench.reps < 1) bench.reps = 1;
+
+    if (strcmp(mode, "gen") == 0) {
+        if (optind >= argc || gen_workload(stdout, argv[optind], seed, lines) != 0) {
+            fprintf(stderr, "Error: Unknown workload profile\n");
+            return 1;
+        }
+        return 0;
+    }
+
+    // Disks and scripts live in a temporary directory
+    char dir[] = "/tmp/fs-bench-XXXXXX";
+    if (mkdtemp(dir) == NULL) return 1;
+    bench.out = out_path != NULL ? fopen(out_path, "w") : stdout;
+    if (bench.out == NULL) {
+        fprintf(stderr, "Error: Cannot open %s\n", out_path);
+        rmdir(dir);
+        return 1;
+    }
+
+    int ret = 0;
+    if (strcmp(mode, "micro") == 0) {
+        int fullness[] = { 10, 50, 90 };
+        int fragmentation[] = { 0, 50 };
+        for (int f=0; f < 3; f++) {
+            for (int g=0; g < 2; g++) micro_layout(&bench, dir, fullness[f], fragmentation[g]);
+        }
+    } else if (strcmp(mode, "e2e") == 0 && optind < argc) {
+        char fs_path[PATH_MAX];
+        if (realpath(argv[optind], fs_path) == NULL) {
+            fprintf(stderr, "Error: Cannot find %s\n", argv[optind]);
+            ret = 1;
+        } else {
+            e2e(&bench, dir, fs_path, seed, lines);
+        }
+    } else {
+        fprintf(stderr, "Usage: %s micro|e2e|gen [options]\n", argv[0]);
+        ret = 1;
+    }
+
+    if (bench.out != stdout) fclose(bench.out);
+    rmdir(dir);
+    return ret;
+}
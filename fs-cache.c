@@ -0,0 +1,238 @@
+#include "fs-cache.h"
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Compares two block indexes for qsort.
+ */
+static int compare_block(const void *a, const void *b) {
+    return *(const int *)a - *(const int *)b;
+}
+
+/**
+ * @brief Removes a slot from the LRU list.
+ */
+static void lru_unlink(BlockCache *cache, int slot) {
+    int p = cache->prev[slot];
+    int n = cache->next[slot];
+    if (p != -1) cache->next[p] = n;
+    else cache->head = n;
+    if (n != -1) cache->prev[n] = p;
+    else cache->tail = p;
+}
+
+/**
+ * @brief Inserts a slot at the head (most recently used end) of the LRU list.
+ */
+static void lru_push_head(BlockCache *cache, int slot) {
+    cache->prev[slot] = -1;
+    cache->next[slot] = cache->head;
+    if (cache->head != -1) cache->prev[cache->head] = slot;
+    cache->head = slot;
+    if (cache->tail == -1) cache->tail = slot;
+}
+
+/**
+ * @brief Gets the slot holding a block, loading it into a free or evicted slot if needed.
+ *
+ * @param cache - Cache to search
+ * @param block - Index of the block
+ * @param load - If 1 the block is read from the disk on a miss, if 0 the caller overwrites it
+ * @return Slot that holds the block
+ */
+static int get_slot(BlockCache *cache, int block, int load) {
+    int slot = cache->slot_of[block];
+    if (slot != -1) {
+        cache->hits++;
+        lru_unlink(cache, slot);
+        lru_push_head(cache, slot);
+        return slot;
+    }
+
+    cache->misses++;
+    if (cache->count < cache->capacity) {
+        slot = cache->count++;
+    } else {
+        // Evict the least recently used block, writing it back if it is dirty
+        slot = cache->tail;
+        lru_unlink(cache, slot);
+        if (cache->dirty[slot]) {
+            disk_write_async(cache->dev, cache->block[slot], cache->data + (1024)*slot); // Data is copied
+            cache->dirty[slot] = 0;
+            cache->writebacks++;
+        }
+        cache->slot_of[cache->block[slot]] = -1;
+    }
+
+    cache->block[slot] = block;
+    cache->slot_of[block] = slot;
+    cache->dirty[slot] = 0;
+    if (load) {
+        disk_read(cache->dev, block, 1, cache->data + (1024)*slot);
+    }
+    lru_push_head(cache, slot);
+    return slot;
+}
+
+int cache_init(BlockCache *cache, Disk *dev, int capacity) {
+    int nblocks = dev->nblocks;
+    memset(cache, 0, sizeof(BlockCache));
+    cache->dev = dev;
+    cache->nblocks = nblocks;
+    cache->capacity = capacity < nblocks ? capacity : nblocks;
+    cache->head = cache->tail = -1;
+    if (cache->capacity <= 0) {
+        cache->capacity = 0;
+        return 0;
+    }
+    cache->slot_of = malloc(nblocks * sizeof(int));
+    cache->block = malloc(cache->capacity * sizeof(int));
+    cache->data = malloc((size_t)cache->capacity * 1024);
+    cache->dirty = calloc(cache->capacity, 1);
+    cache->prev = malloc(cache->capacity * sizeof(int));
+    cache->next = malloc(cache->capacity * sizeof(int));
+    if (cache->slot_of == NULL || cache->block == NULL || cache->data == NULL || cache->dirty == NULL ||
+        cache->prev == NULL || cache->next == NULL) {
+        cache_destroy(cache);
+        return -1;
+    }
+    for (int i=0; i < nblocks; i++) cache->slot_of[i] = -1;
+    return 0;
+}
+
+void cache_destroy(BlockCache *cache) {
+    free(cache->slot_of);
+    free(cache->block);
+    free(cache->data);
+    free(cache->dirty);
+    free(cache->prev);
+    free(cache->next);
+    memset(cache, 0, sizeof(BlockCache));
+    cache->head = cache->tail = -1;
+}
+
+void cache_read(BlockCache *cache, int block, uint8_t *buff) {
+    if (cache->capacity == 0) {
+        disk_read_async(cache->dev, block, buff);
+        return;
+    }
+    int slot = get_slot(cache, block, 1);
+    memcpy(buff, cache->data + (1024)*slot, 1024);
+}
+
+void cache_write(BlockCache *cache, int block, const uint8_t *buff) {
+    if (cache->capacity == 0) {
+        disk_write_async(cache->dev, block, buff);
+        return;
+    }
+    int slot = get_slot(cache, block, 0); // Whole block is overwritten, no need to load it
+    memcpy(cache->data + (1024)*slot, buff, 1024);
+    cache->dirty[slot] = 1;
+}
+
+int cache_is_hole(BlockCache *cache, int block) {
+    if (cache->capacity > 0 && cache->slot_of[block] != -1) return 0; // The cached copy may not be on the disk yet
+    return disk_is_hole(cache->dev, block);
+}
+
+void cache_read_range(BlockCache *cache, int block, int count, uint8_t *buff) {
+    struct iovec iov = { buff, (size_t)(1024)*count };
+    disk_readv(cache->dev, block, &iov, 1);
+    if (cache->capacity == 0) return;
+    for (int b=block; b < block + count; b++) {
+        int slot = cache->slot_of[b];
+        if (slot != -1) memcpy(buff + (size_t)(1024)*(b - block), cache->data + (1024)*slot, 1024);
+    }
+}
+
+void cache_write_range(BlockCache *cache, int block, const struct iovec *iov, int iovcnt) {
+    size_t bytes = 0;
+    for (int v=0; v < iovcnt; v++) bytes += iov[v].iov_len;
+    cache_invalidate(cache, block, (int)(bytes / 1024));
+    disk_writev(cache->dev, block, iov, iovcnt);
+}
+
+void cache_copy(BlockCache *cache, int src, int dst, int count) {
+    cache_flush(cache);
+    cache_invalidate(cache, dst, count);
+    disk_copy(cache->dev, src, dst, count);
+}
+
+void cache_flush(BlockCache *cache) {
+    if (cache->capacity == 0) return;
+
+    int ndirty = 0;
+    for (int slot=0; slot < cache->count; slot++) ndirty += cache->dirty[slot];
+    if (ndirty == 0) return;
+
+    // Collect the dirty blocks in disk order
+    int *dirty_blocks = malloc(ndirty * sizeof(int));
+    uint8_t *run = malloc((size_t)ndirty * 1024);
+    if (dirty_blocks == NULL || run == NULL) {
+        // No memory to sort and merge the blocks, write each dirty block from its slot
+        for (int slot=0; slot < cache->count; slot++) {
+            if (!cache->dirty[slot]) continue;
+            disk_write(cache->dev, cache->block[slot], 1, cache->data + (1024)*slot);
+            cache->dirty[slot] = 0;
+            cache->writebacks++;
+        }
+        free(run);
+        free(dirty_blocks);
+        return;
+    }
+    ndirty = 0;
+    for (int slot=0; slot < cache->count; slot++) {
+        if (cache->dirty[slot]) dirty_blocks[ndirty++] = cache->block[slot];
+    }
+    qsort(dirty_blocks, ndirty, sizeof(int), compare_block);
+
+    // Contiguous dirty blocks are copied into one buffer and go out in a single write
+    for (int i=0; i < ndirty; ) {
+        int run_len = 0;
+        do {
+            int slot = cache->slot_of[dirty_blocks[i]];
+            memcpy(run + (1024)*run_len, cache->data + (1024)*slot, 1024);
+            cache->dirty[slot] = 0;
+            cache->writebacks++;
+            run_len++;
+            i++;
+        } while (i < ndirty && dirty_blocks[i] == dirty_blocks[i - 1] + 1);
+        disk_write(cache->dev, dirty_blocks[i - run_len], run_len, run);
+    }
+    free(run);
+    free(dirty_blocks);
+}
+
+void cache_drop(BlockCache *cache) {
+    if (cache->capacity == 0) return;
+    cache_flush(cache);
+    for (int slot=0; slot < cache->count; slot++) cache->slot_of[cache->block[slot]] = -1;
+    cache->count = 0;
+    cache->head = cache->tail = -1;
+}
+
+void cache_invalidate(BlockCache *cache, int block, int count) {
+    if (cache->capacity == 0) return;
+    for (int b=block; b < block + count; b++) {
+        int slot = cache->slot_of[b];
+        if (slot == -1) continue;
+        cache->slot_of[b] = -1;
+        cache->dirty[slot] = 0;
+        lru_unlink(cache, slot);
+
+        // Keep the used slots packed at the front by moving the last used slot into the hole
+        int last = --cache->count;
+        if (slot != last) {
+            cache->block[slot] = cache->block[last];
+            cache->dirty[slot] = cache->dirty[last];
+            memcpy(cache->data + (1024)*slot, cache->data + (1024)*last, 1024);
+            cache->slot_of[cache->block[slot]] = slot;
+            cache->prev[slot] = cache->prev[last];
+            cache->next[slot] = cache->next[last];
+            if (cache->prev[slot] != -1) cache->next[cache->prev[slot]] = slot;
+            else cache->head = slot;
+            if (cache->next[slot] != -1) cache->prev[cache->next[slot]] = slot;
+            else cache->tail = slot;
+        }
+    }
+}
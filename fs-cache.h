@@ -0,0 +1,133 @@
+#ifndef FS_CACHE_H
+#define FS_CACHE_H
+
+#include "fs-disk.h"
+
+typedef struct {
+    Disk *dev;              // Virtual disk the cache reads from and writes to
+    int nblocks;            // # of blocks on the virtual disk
+    int capacity;           // # of blocks the cache can hold (0 = cache disabled)
+    int count;              // # of slots in use
+    int *slot_of;           // slot holding each disk block, -1 if the block is not cached
+    int *block;             // disk block held by each slot
+    uint8_t *data;          // 1024 bytes of data for each slot
+    uint8_t *dirty;         // 1 if the slot has data that is not on the virtual disk
+    int *prev;              // previous (more recently used) slot in the LRU list, -1 if head
+    int *next;              // next (less recently used) slot in the LRU list, -1 if tail
+    int head;               // most recently used slot
+    int tail;               // least recently used slot
+    unsigned long hits;     // # of block reads/writes that found their block in the cache
+    unsigned long misses;   // # of block reads/writes that had to load or insert a block
+    unsigned long writebacks; // # of dirty blocks written to the virtual disk
+} BlockCache;
+
+extern int cache_blocks; // # of blocks the block cache holds for each mounted disk (0 = disabled)
+
+/**
+ * @brief Sets up a block cache for a virtual disk.
+ *
+ * @param cache - Cache to initialize
+ * @param dev - Virtual disk to cache
+ * @param capacity - # of blocks the cache can hold (0 = every access goes to the disk)
+ * @return Integer value 0 if set up, -1 if its memory cannot be allocated (nothing is left allocated)
+ */
+int cache_init(BlockCache *cache, Disk *dev, int capacity);
+
+/**
+ * @brief Releases all memory held by the cache. Dirty blocks are NOT written,
+ * call cache_flush() first.
+ *
+ * @param cache - Cache to free
+ */
+void cache_destroy(BlockCache *cache);
+
+/**
+ * @brief Reads a block of the virtual disk through the cache.
+ *
+ * @param cache - Cache to read through
+ * @param block - Index of the block to read
+ * @param buff - Buffer to copy the 1024 bytes of the block into
+ */
+void cache_read(BlockCache *cache, int block, uint8_t *buff);
+
+/**
+ * @brief Writes a block of the virtual disk through the cache. The block is only
+ * marked dirty and reaches the disk when it is evicted or the cache is flushed.
+ *
+ * @param cache - Cache to write through
+ * @param block - Index of the block to write
+ * @param buff - Buffer holding the 1024 bytes to write
+ */
+void cache_write(BlockCache *cache, int block, const uint8_t *buff);
+
+/**
+ * @brief Checks if a block reads back as zeros without holding any data: it is not in the cache
+ * and it is a hole of the virtual disk (see disk_is_hole()).
+ *
+ * @param cache - Cache to query
+ * @param block - Index of the block
+ * @return Integer value 1 if the block is a hole, 0 otherwise
+ */
+int cache_is_hole(BlockCache *cache, int block);
+
+/**
+ * @brief Reads contiguous blocks with a single vectored read of the virtual disk,
+ * then copies the cached (possibly dirty) blocks of the range over what was read.
+ *
+ * @param cache - Cache to read through
+ * @param block - Index of the first block to read
+ * @param count - # of blocks to read
+ * @param buff - Buffer to read count * 1024 bytes into
+ */
+void cache_read_range(BlockCache *cache, int block, int count, uint8_t *buff);
+
+/**
+ * @brief Writes a list of buffers to contiguous blocks of the virtual disk with vectored writes,
+ * dropping the cached copies of the range first (they are overwritten).
+ *
+ * @param cache - Cache to write through
+ * @param block - Index of the first block to write
+ * @param iov - Buffers to write in order, each holding a whole # of blocks
+ * @param iovcnt - # of buffers
+ */
+void cache_write_range(BlockCache *cache, int block, const struct iovec *iov, int iovcnt);
+
+/**
+ * @brief Copies contiguous blocks to another (non-overlapping) location on the virtual disk with
+ * disk_copy(). Dirty blocks are written back first so the copy sees them, and the cached
+ * copies of the destination are dropped.
+ *
+ * @param cache - Cache to copy through
+ * @param src - Index of the first block to copy
+ * @param dst - Index of the first block to copy to
+ * @param count - # of blocks to copy
+ */
+void cache_copy(BlockCache *cache, int src, int dst, int count);
+
+/**
+ * @brief Writes every dirty block to the virtual disk, merging runs of
+ * contiguous dirty blocks into a single write.
+ *
+ * @param cache - Cache to flush
+ */
+void cache_flush(BlockCache *cache);
+
+/**
+ * @brief Writes every dirty block to the virtual disk and empties the cache, so
+ * the disk can be changed directly without leaving stale blocks behind.
+ *
+ * @param cache - Cache to empty
+ */
+void cache_drop(BlockCache *cache);
+
+/**
+ * @brief Drops cached copies of contiguous blocks without writing them back,
+ * used when the blocks are about to be overwritten on the disk directly.
+ *
+ * @param cache - Cache to update
+ * @param block - Index of the first block to drop
+ * @param count - # of blocks to drop
+ */
+void cache_invalidate(BlockCache *cache, int block, int count);
+
+#endif
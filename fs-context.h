@@ -0,0 +1,96 @@
+#ifndef FS_CONTEXT_H
+#define FS_CONTEXT_H
+
+#include "fs-sim.h"
+#include "fs-meta.h"
+#include "fs-alloc.h"
+#include "fs-index.h"
+#include "fs-tree.h"
+#include "fs-cache.h"
+#include "fs-scrub.h"
+#include "fs-journal.h"
+#include "fs-disk.h"
+#include <stdio.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <time.h>
+
+#define MOUNT_INODE_LOCKS 64 // # of locks the files of a shared mount are striped over
+#define DEFRAG_INTERVAL_US 1000 // Background defrag: time between two steps while there are files to move
+#define DEFRAG_STEP_US 200 // Background defrag: most time a step spends moving files (past the first file)
+
+typedef struct FsMount {
+    char *disk_name;        // Name the disk was mounted with
+    FsMeta meta;            // Metadata (superblock) of the disk
+    Allocator allocator;    // Allocator of the disk
+    NameIndex name_index;   // (parent, name) lookup index of the disk
+    StartIndex start_index; // Start block lookup index of the files of the disk
+    DirTree dir_tree;       // Directory tree of the disk
+    Disk disk;              // Block device of the disk
+    BlockCache block_cache; // Block cache of the disk
+    ScrubList scrub;        // Freed blocks of the disk waiting to be zeroed
+    Journal journal;        // Metadata journal of the disk (journal.fd = -1 if the disk is not journaled)
+    int sb_dirty;           // 1 if the superblock in memory has changes that are not on the disk
+    int sb_mutations;       // # of superblock changes since the last sync
+    long defrags;           // # of defrag steps that moved files since the disk was mounted (a whole defrag is one step)
+    Latency sb_write;       // Superblock writes to the disk (moved into the stats of the context that releases the mount)
+    int shared;             // 1 if every context that mounts the disk uses this mount (disk_shared mode)
+    int locked;             // 1 if lock_mount() locks the mount (shared mounts and mounts with a background thread)
+    int users;              // # of contexts using the mount
+    dev_t dev;              // Device of the disk image (identifies a shared mount)
+    ino_t ino;              // Inode of the disk image (identifies a shared mount)
+    struct timespec mtime;  // Kept mounts: modification time of the image when its last user left
+    off_t size;             // Kept mounts: size of the image when its last user left
+    pthread_rwlock_t lock;  // Locked mounts: read locked for lookups and data blocks, write locked for metadata changes
+    pthread_mutex_t file_lock[MOUNT_INODE_LOCKS]; // Shared mounts: serializes block reads and writes of a file
+    int defrag_running;     // 1 if a background thread defrags the disk between commands (defrag_blocks > 0)
+    int defrag_stop;        // Background defrag: set to make the thread exit
+    int defrag_idle;        // Background defrag: 1 if the last step found nothing to move, until blocks are freed
+    pthread_mutex_t defrag_lock; // Background defrag: protects defrag_stop and defrag_idle
+    pthread_cond_t defrag_wake; // Background defrag: signalled when blocks are freed or the thread has to stop
+    pthread_t defrag_thread; // Background defrag: thread that moves files while no command holds the mount
+    int commit_running;     // 1 if a thread group commits the journal every journal_interval_ms
+    int commit_stop;        // Group commit: set to make the thread exit
+    pthread_mutex_t commit_lock; // Group commit: protects commit_stop
+    pthread_cond_t commit_wake; // Group commit: signalled when the thread has to stop
+    pthread_t commit_thread; // Group commit: thread that commits the pending changes while no command holds the mount
+    struct FsMount *next;   // Next mount in the list of shared mounts
+} FsMount;
+
+struct FsContext {
+    FsMount *mnt;           // Mounted disk, NULL if no disk is mounted
+    int cwd;                // Current working directory (root directory is 127 on v1 disks)
+    unsigned cwd_gen;       // Generation of the inode of the cwd when it was changed to (see alloc_inode_generation())
+    uint8_t fs_buffer[1024]; // File system buffer
+    int buffer_zero;        // 1 if fs_buffer holds only zero bytes, 0 if not, -1 if not checked since it changed
+    int alloc_policy;       // Policy new files get their blocks by (AllocPolicy)
+    uint8_t *range_buffer;  // Multi-block buffer of range reads and writes (grown on demand)
+    int range_capacity;     // # of blocks range_buffer can hold
+    int range_blocks;       // # of blocks the last range read loaded, 0 if fs_buffer is newer
+    CheckTiming check_timing; // Time spent in each phase of the last consistency check
+    FILE *out;              // Where ls output goes
+    FILE *err;              // Where error messages go
+    FsStats stats;          // Command latencies, lookups and the block I/O of the disks unmounted so far
+};
+
+/**
+ * @brief Checks if file or directory of a given name exists in the current working directory.
+ * 
+ * @param ctx - Context with a mounted disk
+ * @param name - Name to perform check on
+ * @return Integer value index of the inode if it exists, -1 otherwise
+ */
+int file_exists(FsContext *ctx, char name[5]);
+
+/**
+ * @brief Checks the metadata of a disk against the 6 consistency rules and records the time
+ * spent in each phase in the context.
+ * 
+ * @param ctx - Context to record the timing in
+ * @param m - Metadata to check
+ * @return Integer value 0 if consistent, otherwise the smallest error code found (-1 if the memory
+ * of the check cannot be allocated)
+ */
+int consistency_check(FsContext *ctx, FsMeta *m);
+
+#endif
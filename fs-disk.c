@@ -0,0 +1,440 @@
+#define _GNU_SOURCE // fallocate(), copy_file_range(), SEEK_DATA/SEEK_HOLE
+#include "fs-disk.h"
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <errno.h>
+
+/**
+ * @brief Adds to an I/O counter. Relaxed atomics keep the counters of a shared mount exact
+ * without ordering anything else.
+ */
+static void io_add(unsigned long *counter, unsigned long n) {
+    __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Records one block read or write call of count_blocks blocks.
+ */
+static void count_transfer(Disk *dev, int write, int count_blocks) {
+    if (write) {
+        io_add(&dev->io.writes, 1);
+        io_add(&dev->io.bytes_written, (unsigned long)(1024)*count_blocks);
+    } else {
+        io_add(&dev->io.reads, 1);
+        io_add(&dev->io.bytes_read, (unsigned long)(1024)*count_blocks);
+    }
+}
+
+/**
+ * @brief Records a system call that started at start (stats_now()).
+ */
+static void count_syscall(Disk *dev, long start) {
+    io_add(&dev->io.syscalls, 1);
+    __atomic_fetch_add(&dev->io.ns, stats_now() - start, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Punches a hole over contiguous blocks, so they read back as zeros and take no space on the host.
+ *
+ * @return Integer value 1 if the hole was punched, 0 if the host file system does not support it
+ */
+static int punch(Disk *dev, int block, int count) {
+    long start = stats_now();
+    int punched = fallocate(dev->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                            (off_t)(1024)*block, (off_t)(1024)*count) == 0;
+    count_syscall(dev, start);
+    return punched;
+}
+
+/**
+ * @brief Finds where the run of blocks starting at block ends: a run either may hold data or is
+ * entirely a hole of the image (lseek() with SEEK_HOLE/SEEK_DATA). A block that shares a host block
+ * with data counts as data, and everything is data if the host cannot tell.
+ *
+ * @param is_data - Set to 1 if the run may hold data, 0 if it is a hole
+ * @return Index of the first block past the run (at most end)
+ */
+static int next_run(Disk *dev, int block, int end, int *is_data) {
+    off_t pos = (off_t)(1024)*block;
+    *is_data = 1;
+    long start = stats_now();
+    off_t hole = lseek(dev->fd, pos, SEEK_HOLE);
+    count_syscall(dev, start);
+    int run_end;
+    if (hole == -1) {
+        run_end = end;
+    } else if (hole > pos) {
+        run_end = (int)((hole + 1023) / 1024); // Data up to the hole
+    } else {
+        start = stats_now();
+        off_t data = lseek(dev->fd, pos, SEEK_DATA);
+        count_syscall(dev, start);
+        if (data == -1) {
+            if (errno == ENXIO) *is_data = 0; // Hole up to the end of the image
+            run_end = end;
+        } else if (data / 1024 > block) {
+            *is_data = 0;
+            run_end = (int)(data / 1024);
+        } else {
+            // Data starts inside the block
+            start = stats_now();
+            hole = lseek(dev->fd, data, SEEK_HOLE);
+            count_syscall(dev, start);
+            run_end = hole == -1 ? end : (int)((hole + 1023) / 1024);
+        }
+    }
+    return run_end < end ? run_end : end;
+}
+
+/**
+ * @brief Sets up the io_uring engine of a disk that is accessed through read/write.
+ */
+static void attach_ring(Disk *dev, int ring_depth) {
+    if (ring_depth <= 0 || dev->map != NULL) return;
+    dev->ring = malloc(sizeof(IoRing));
+    if (dev->ring == NULL) return;
+    if (ring_init(dev->ring, dev->fd, dev->nblocks, ring_depth) == -1) {
+        free(dev->ring); // No io_uring, single block requests stay synchronous
+        dev->ring = NULL;
+    }
+}
+
+void disk_attach(Disk *dev, int fd, int nblocks, int use_mmap, int ring_depth) {
+    dev->fd = fd;
+    dev->nblocks = nblocks;
+    dev->map = NULL;
+    dev->map_size = 0;
+    dev->ring = NULL;
+    memset(&dev->io, 0, sizeof(IoStats));
+    if (use_mmap) {
+        // Only map images that are large enough, touching a page past the end of the file raises SIGBUS
+        struct stat st;
+        size_t size = (size_t)nblocks * 1024;
+        if (fstat(fd, &st) != -1 && (size_t)st.st_size >= size) {
+            void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (map != MAP_FAILED) {
+                dev->map = map;
+                dev->map_size = size;
+            }
+        }
+    }
+    attach_ring(dev, ring_depth); // A mapped disk needs no ring
+}
+
+void disk_detach(Disk *dev) {
+    if (dev->ring != NULL) {
+        ring_destroy(dev->ring);
+        free(dev->ring);
+        dev->ring = NULL;
+    }
+    if (dev->map != NULL) munmap(dev->map, dev->map_size);
+    if (dev->fd != -1) close(dev->fd);
+    dev->fd = -1;
+    dev->map = NULL;
+    dev->map_size = 0;
+}
+
+uint8_t *disk_block_ptr(Disk *dev, int block) {
+    if (dev->map == NULL) return NULL;
+    return dev->map + (size_t)(1024)*block;
+}
+
+void disk_read_async(Disk *dev, int block, uint8_t *buff) {
+    if (dev->ring == NULL) {
+        disk_read(dev, block, 1, buff);
+        return;
+    }
+    count_transfer(dev, 0, 1);
+    ring_read(dev->ring, block, buff);
+}
+
+void disk_write_async(Disk *dev, int block, const uint8_t *buff) {
+    if (dev->ring == NULL) {
+        disk_write(dev, block, 1, buff);
+        return;
+    }
+    count_transfer(dev, 1, 1);
+    ring_write(dev->ring, block, buff);
+}
+
+void disk_wait(Disk *dev) {
+    if (dev->ring != NULL) ring_wait(dev->ring);
+}
+
+void disk_read(Disk *dev, int block, int count, uint8_t *buff) {
+    disk_wait(dev);
+    count_transfer(dev, 0, count);
+    if (dev->map != NULL) {
+        memcpy(buff, dev->map + (size_t)(1024)*block, (size_t)(1024)*count);
+        return;
+    }
+    long start = stats_now();
+    pread(dev->fd, buff, (size_t)(1024)*count, (off_t)(1024)*block); // No shared file offset, safe from any thread
+    count_syscall(dev, start);
+}
+
+void disk_write(Disk *dev, int block, int count, const uint8_t *buff) {
+    disk_wait(dev);
+    count_transfer(dev, 1, count);
+    if (dev->map != NULL) {
+        memcpy(dev->map + (size_t)(1024)*block, buff, (size_t)(1024)*count);
+        return;
+    }
+    long start = stats_now();
+    pwrite(dev->fd, buff, (size_t)(1024)*count, (off_t)(1024)*block);
+    count_syscall(dev, start);
+}
+
+/**
+ * @brief Reads or writes a list of buffers at consecutive offsets, IOV_MAX buffers per system call.
+ */
+static void transfer_vector(Disk *dev, int write, int block, const struct iovec *iov, int iovcnt) {
+    disk_wait(dev);
+    off_t offset = (off_t)(1024)*block;
+    for (int i=0; i < iovcnt; ) {
+        int n = iovcnt - i < IOV_MAX ? iovcnt - i : IOV_MAX;
+        size_t bytes = 0;
+        for (int v=i; v < i + n; v++) bytes += iov[v].iov_len;
+        count_transfer(dev, write, (int)(bytes / 1024));
+        if (dev->map != NULL) {
+            uint8_t *addr = dev->map + offset;
+            for (int v=i; v < i + n; v++) {
+                if (write) memcpy(addr, iov[v].iov_base, iov[v].iov_len);
+                else memcpy(iov[v].iov_base, addr, iov[v].iov_len);
+                addr += iov[v].iov_len;
+            }
+        } else {
+            long start = stats_now();
+            if (write) pwritev(dev->fd, &iov[i], n, offset);
+            else preadv(dev->fd, &iov[i], n, offset);
+            count_syscall(dev, start);
+        }
+        offset += bytes;
+        i += n;
+    }
+}
+
+void disk_readv(Disk *dev, int block, const struct iovec *iov, int iovcnt) {
+    transfer_vector(dev, 0, block, iov, iovcnt);
+}
+
+void disk_writev(Disk *dev, int block, const struct iovec *iov, int iovcnt) {
+    transfer_vector(dev, 1, block, iov, iovcnt);
+}
+
+/**
+ * @brief Copies one run of blocks that holds data with one read and one write (the two ranges may overlap).
+ * If a buffer for the whole run cannot be allocated it is copied 256 blocks at a time, or one block at a
+ * time through the stack if even that cannot be allocated, so a move never fails for lack of memory.
+ */
+static void move_blocks(Disk *dev, int src, int dst, int count) {
+    if (dev->map != NULL) {
+        count_transfer(dev, 0, count);
+        count_transfer(dev, 1, count);
+        memmove(dev->map + (size_t)(1024)*dst, dev->map + (size_t)(1024)*src, (size_t)(1024)*count);
+        return;
+    }
+    int chunk = count;
+    uint8_t *temp_buff = malloc((size_t)(1024)*chunk);
+    if (temp_buff == NULL) {
+        chunk = count < 256 ? count : 256;
+        temp_buff = malloc((size_t)(1024)*chunk);
+    }
+    uint8_t block_buff[1024];
+    uint8_t *buff = temp_buff;
+    if (buff == NULL) {
+        chunk = 1;
+        buff = block_buff;
+    }
+    // Moving down goes front to back and moving up back to front, so no chunk overwrites one still to be read
+    for (int done=0; done < count; ) {
+        int n = count - done < chunk ? count - done : chunk;
+        int offset = dst < src ? done : count - done - n;
+        disk_read(dev, src + offset, n, buff);
+        disk_write(dev, dst + offset, n, buff);
+        done += n;
+    }
+    free(temp_buff);
+}
+
+void disk_move(Disk *dev, int src, int dst, int count) {
+    if (count <= 0 || src == dst) return;
+    disk_wait(dev);
+
+    // Moving down (or to a range that does not overlap) goes front to back: a run only overwrites
+    // blocks before its own end, so the runs past it can be found after it was moved
+    if (dst < src || dst >= src + count) {
+        for (int b=src; b < src + count; ) {
+            int is_data;
+            int end = next_run(dev, b, src + count, &is_data);
+            if (is_data) move_blocks(dev, b, dst + (b - src), end - b);
+            else disk_zero(dev, dst + (b - src), end - b); // Holes are punched instead of copied
+            b = end;
+        }
+        return;
+    }
+
+    // Moving up over itself goes back to front, 256 blocks at a time. The runs of a window are all
+    // found before it is written, and nothing it writes is below it.
+    int runs[256][2]; // runs[r] = { first block past the run, 1 if data }
+    for (int hi=src + count; hi > src; ) {
+        int lo = hi - src > 256 ? hi - 256 : src;
+        int num_of_runs = 0;
+        for (int b=lo; b < hi; num_of_runs++) {
+            b = next_run(dev, b, hi, &runs[num_of_runs][1]);
+            runs[num_of_runs][0] = b;
+        }
+        for (int r=num_of_runs - 1; r >= 0; r--) {
+            int start = r == 0 ? lo : runs[r-1][0];
+            int n = runs[r][0] - start;
+            if (runs[r][1]) move_blocks(dev, start, dst + (start - src), n);
+            else disk_zero(dev, dst + (start - src), n);
+        }
+        hi = lo;
+    }
+}
+
+/**
+ * @brief Copies one run of blocks that holds data to a location that does not overlap it.
+ */
+static void copy_blocks(Disk *dev, int src, int dst, int count) {
+    if (dev->map != NULL) {
+        count_transfer(dev, 0, count);
+        count_transfer(dev, 1, count);
+        memcpy(dev->map + (size_t)(1024)*dst, dev->map + (size_t)(1024)*src, (size_t)(1024)*count);
+        return;
+    }
+
+    // Let the kernel copy the blocks without passing them through user space, it may copy less than asked
+    loff_t off_in = (loff_t)(1024)*src;
+    loff_t off_out = (loff_t)(1024)*dst;
+    size_t left = (size_t)(1024)*count;
+    while (left > 0) {
+        long start = stats_now();
+        ssize_t n = copy_file_range(dev->fd, &off_in, dev->fd, &off_out, left, 0);
+        count_syscall(dev, start);
+        if (n <= 0) break; // Not supported for this file (or nothing copied), copy the rest through a buffer
+        left -= n;
+    }
+    int block = count - (int)((left + 1023) / 1024); // First block that was not copied in full
+    if (block > 0) {
+        count_transfer(dev, 0, block);
+        count_transfer(dev, 1, block);
+    }
+    if (left == 0) return;
+
+    // Copy up to 256 KB per read/write, with smaller chunks if that much cannot be allocated and one block
+    // at a time through the stack if nothing can, so a copy never fails for lack of memory
+    int chunk = count - block < 256 ? count - block : 256;
+    uint8_t *temp_buff = malloc((size_t)(1024)*chunk);
+    while (temp_buff == NULL && chunk > 1) {
+        chunk /= 2;
+        temp_buff = malloc((size_t)(1024)*chunk);
+    }
+    uint8_t block_buff[1024];
+    uint8_t *buff = temp_buff != NULL ? temp_buff : block_buff;
+    for (; block < count; block += chunk) {
+        int n = count - block < chunk ? count - block : chunk;
+        disk_read(dev, src + block, n, buff);
+        disk_write(dev, dst + block, n, buff);
+    }
+    free(temp_buff);
+}
+
+void disk_copy(Disk *dev, int src, int dst, int count) {
+    if (count <= 0 || src == dst) return;
+    disk_wait(dev);
+    for (int b=src; b < src + count; ) {
+        int is_data;
+        int end = next_run(dev, b, src + count, &is_data);
+        if (is_data) copy_blocks(dev, b, dst + (b - src), end - b);
+        else disk_zero(dev, dst + (b - src), end - b); // Nothing to copy, the copy of a hole is a hole
+        b = end;
+    }
+}
+
+/**
+ * @brief Zeroes out contiguous blocks without waiting for queued requests.
+ */
+static void zero_blocks(Disk *dev, int block, int count) {
+    if (punch(dev, block, count)) return; // No data is transferred, so no bytes are counted
+    count_transfer(dev, 1, count);
+    if (dev->map != NULL) {
+        memset(dev->map + (size_t)(1024)*block, 0, (size_t)(1024)*count);
+        return;
+    }
+    // Let the host file system zero the range without transferring any data if it can
+    long start = stats_now();
+    int zeroed = fallocate(dev->fd, FALLOC_FL_ZERO_RANGE | FALLOC_FL_KEEP_SIZE,
+                           (off_t)(1024)*block, (off_t)(1024)*count) == 0;
+    count_syscall(dev, start);
+    if (zeroed) return;
+
+    // Write zeroes up to 256 KB at a time, a block at a time if not even that can be allocated
+    static const uint8_t zero_block[1024];
+    int chunk = count < 256 ? count : 256;
+    uint8_t *zero_buff = calloc(chunk, 1024);
+    const uint8_t *buff = zero_buff;
+    if (buff == NULL) {
+        chunk = 1;
+        buff = zero_block;
+    }
+    for (int done=0; done < count; ) {
+        int n = count - done < chunk ? count - done : chunk;
+        start = stats_now();
+        pwrite(dev->fd, buff, (size_t)(1024)*n, (off_t)(1024)*(block + done));
+        count_syscall(dev, start);
+        done += n;
+    }
+    free(zero_buff);
+}
+
+void disk_zero(Disk *dev, int block, int count) {
+    if (count <= 0) return;
+    disk_wait(dev);
+    zero_blocks(dev, block, count);
+}
+
+void disk_scrub(Disk *dev, int block, int count) {
+    if (count <= 0) return;
+    zero_blocks(dev, block, count);
+}
+
+int disk_is_hole(Disk *dev, int block) {
+    disk_wait(dev); // A queued write may fill the hole
+    int is_data;
+    next_run(dev, block, block + 1, &is_data);
+    return !is_data;
+}
+
+void disk_sync(Disk *dev) {
+    disk_wait(dev);
+    if (dev->map == NULL) return;
+    long start = stats_now();
+    msync(dev->map, dev->map_size, MS_SYNC);
+    count_syscall(dev, start);
+}
+
+void disk_flush(Disk *dev) {
+    disk_wait(dev);
+    long start = stats_now();
+    fdatasync(dev->fd); // Also writes back the pages of a memory mapped disk
+    count_syscall(dev, start);
+}
+
+void disk_stats(Disk *dev, IoStats *io) {
+    IoStats now;
+    now.syscalls = __atomic_load_n(&dev->io.syscalls, __ATOMIC_RELAXED);
+    now.reads = __atomic_load_n(&dev->io.reads, __ATOMIC_RELAXED);
+    now.writes = __atomic_load_n(&dev->io.writes, __ATOMIC_RELAXED);
+    now.bytes_read = __atomic_load_n(&dev->io.bytes_read, __ATOMIC_RELAXED);
+    now.bytes_written = __atomic_load_n(&dev->io.bytes_written, __ATOMIC_RELAXED);
+    now.ns = __atomic_load_n(&dev->io.ns, __ATOMIC_RELAXED);
+    if (dev->ring != NULL) now.syscalls += dev->ring->enters; // The ring is only used by private mounts
+    stats_merge_io(io, &now);
+}
@@ -0,0 +1,205 @@
+#ifndef FS_DISK_H
+#define FS_DISK_H
+
+#include "fs-uring.h"
+#include "fs-stats.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+typedef struct {
+    int fd;             // Virtual disk file descriptor
+    int nblocks;        // # of 1024 byte blocks on the virtual disk
+    uint8_t *map;       // Shared memory mapping of the whole disk, NULL when using read/write
+    size_t map_size;    // # of bytes mapped
+    IoRing *ring;       // io_uring engine for single block reads and writes, NULL when not used
+    IoStats io;         // Block I/O done on the disk (updated atomically, a shared mount is used from several threads)
+} Disk;
+
+extern int disk_use_mmap; // If 1, mounted disks are accessed through mmap() instead of pread/pwrite
+extern int disk_ring_depth; // If > 0, single block reads and writes are queued on an io_uring of this depth
+
+/**
+ * @brief Sets up block access to an open virtual disk. When use_mmap is set the whole
+ * image is mapped with MAP_SHARED, if the mapping fails the disk falls back to pread/pwrite.
+ * When ring_depth is set (and the disk is not mapped) an io_uring is set up for the
+ * disk_read_async()/disk_write_async() calls, if io_uring is not available they are synchronous.
+ *
+ * @param dev - Disk to initialize
+ * @param fd - File descriptor of the virtual disk
+ * @param nblocks - # of blocks on the virtual disk
+ * @param use_mmap - If 1 try to map the disk into memory
+ * @param ring_depth - # of requests the io_uring can have in flight (0 = no io_uring, the disk must only be used by one thread otherwise)
+ */
+void disk_attach(Disk *dev, int fd, int nblocks, int use_mmap, int ring_depth);
+
+/**
+ * @brief Waits for queued requests, unmaps the virtual disk (if mapped) and closes its file descriptor.
+ *
+ * @param dev - Disk to release
+ */
+void disk_detach(Disk *dev);
+
+/**
+ * @brief Gets a pointer to a block of a memory mapped disk.
+ *
+ * @param dev - Disk to access
+ * @param block - Index of the block
+ * @return Pointer to the first byte of the block, NULL if the disk is not mapped
+ */
+uint8_t *disk_block_ptr(Disk *dev, int block);
+
+/**
+ * @brief Queues a read of one block of the virtual disk. buff is only filled in once
+ * disk_wait() or any other (synchronous) disk function has been called.
+ *
+ * @param dev - Disk to read from
+ * @param block - Index of the block to read
+ * @param buff - Buffer to read 1024 bytes into
+ */
+void disk_read_async(Disk *dev, int block, uint8_t *buff);
+
+/**
+ * @brief Queues a write of one block of the virtual disk. buff is copied, so it can be
+ * changed right away.
+ *
+ * @param dev - Disk to write to
+ * @param block - Index of the block to write
+ * @param buff - Buffer holding 1024 bytes
+ */
+void disk_write_async(Disk *dev, int block, const uint8_t *buff);
+
+/**
+ * @brief Waits until every queued read and write of the virtual disk has completed.
+ * Every other disk function does this first, so the queued requests stay ordered with
+ * superblock writes, zeroing and moves.
+ *
+ * @param dev - Disk to wait on
+ */
+void disk_wait(Disk *dev);
+
+/**
+ * @brief Reads contiguous blocks of the virtual disk.
+ *
+ * @param dev - Disk to read from
+ * @param block - Index of the first block to read
+ * @param count - # of blocks to read
+ * @param buff - Buffer to read count * 1024 bytes into
+ */
+void disk_read(Disk *dev, int block, int count, uint8_t *buff);
+
+/**
+ * @brief Writes contiguous blocks of the virtual disk.
+ *
+ * @param dev - Disk to write to
+ * @param block - Index of the first block to write
+ * @param count - # of blocks to write
+ * @param buff - Buffer holding count * 1024 bytes
+ */
+void disk_write(Disk *dev, int block, int count, const uint8_t *buff);
+
+/**
+ * @brief Reads contiguous blocks of the virtual disk into a list of buffers with preadv()
+ * (several calls if there are more than IOV_MAX buffers). Every buffer holds a whole # of blocks.
+ *
+ * @param dev - Disk to read from
+ * @param block - Index of the first block to read
+ * @param iov - Buffers to fill in order
+ * @param iovcnt - # of buffers
+ */
+void disk_readv(Disk *dev, int block, const struct iovec *iov, int iovcnt);
+
+/**
+ * @brief Writes a list of buffers to contiguous blocks of the virtual disk with pwritev()
+ * (several calls if there are more than IOV_MAX buffers). Every buffer holds a whole # of blocks.
+ *
+ * @param dev - Disk to write to
+ * @param block - Index of the first block to write
+ * @param iov - Buffers to write in order
+ * @param iovcnt - # of buffers
+ */
+void disk_writev(Disk *dev, int block, const struct iovec *iov, int iovcnt);
+
+/**
+ * @brief Copies contiguous blocks to another location on the virtual disk (the two ranges may overlap).
+ * The source is split into runs of data and holes with lseek(SEEK_DATA/SEEK_HOLE) as it is copied: each
+ * run of data is copied with one read and one write, and holes are punched at the destination instead.
+ * A range that is moved up over itself is copied back to front in windows of 256 blocks.
+ *
+ * @param dev - Disk to update
+ * @param src - Index of the first block to copy
+ * @param dst - Index of the first block to copy to
+ * @param count - # of blocks to copy
+ */
+void disk_move(Disk *dev, int src, int dst, int count);
+
+/**
+ * @brief Copies contiguous blocks to another location on the virtual disk that does not overlap them.
+ * Runs of data are copied inside the kernel with copy_file_range(), and where the host does not support
+ * it (or it copies nothing) the rest is copied through a buffer with large reads and writes. Holes of
+ * the source (found with lseek(SEEK_DATA/SEEK_HOLE)) are punched at the destination instead.
+ *
+ * @param dev - Disk to update
+ * @param src - Index of the first block to copy
+ * @param dst - Index of the first block to copy to
+ * @param count - # of blocks to copy
+ */
+void disk_copy(Disk *dev, int src, int dst, int count);
+
+/**
+ * @brief Zeroes out contiguous blocks of the virtual disk by punching a hole over them with
+ * fallocate(FALLOC_FL_PUNCH_HOLE), so freed blocks take no space on the host. Where the host file
+ * system does not support holes it falls back to fallocate(FALLOC_FL_ZERO_RANGE), then to a single write.
+ *
+ * @param dev - Disk to update
+ * @param block - Index of the first block to zero
+ * @param count - # of blocks to zero
+ */
+void disk_zero(Disk *dev, int block, int count);
+
+/**
+ * @brief Zeroes out contiguous blocks like disk_zero(), but without waiting for queued requests,
+ * so it can be called from another thread while the disk is in use. No request may be queued for
+ * the blocks, and the disk must stay attached until it returns.
+ *
+ * @param dev - Disk to update
+ * @param block - Index of the first block to zero
+ * @param count - # of blocks to zero
+ */
+void disk_scrub(Disk *dev, int block, int count);
+
+/**
+ * @brief Checks if a block of the virtual disk is a hole of the image with lseek(SEEK_DATA/SEEK_HOLE).
+ * A block that shares a host block with data is not a hole.
+ *
+ * @param dev - Disk to query
+ * @param block - Index of the block
+ * @return Integer value 1 if the block is a hole (reads back as zeros), 0 if it may hold data
+ */
+int disk_is_hole(Disk *dev, int block);
+
+/**
+ * @brief Flushes a memory mapped disk to the underlying file with msync().
+ * Disks accessed through pread/pwrite have nothing to flush.
+ *
+ * @param dev - Disk to flush
+ */
+void disk_sync(Disk *dev);
+
+/**
+ * @brief Makes every write to the virtual disk so far durable with fdatasync() (through the
+ * mapping as well, when the disk is memory mapped).
+ *
+ * @param dev - Disk to flush
+ */
+void disk_flush(Disk *dev);
+
+/**
+ * @brief Adds the block I/O done on a disk so far (including io_uring_enter() calls) to an I/O record.
+ *
+ * @param dev - Disk to query
+ * @param io - Record to add the counters to
+ */
+void disk_stats(Disk *dev, IoStats *io);
+
+#endif
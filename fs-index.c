@@ -0,0 +1,181 @@
+#include "fs-index.h"
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Hashes a (parent, name) key with FNV-1a.
+ *
+ * @param parent - Index of the parent directory inode
+ * @param name - Name of the file or directory
+ * @return Hash value of the key
+ */
+static uint32_t hash_key(uint32_t parent, const char name[5]) {
+    uint32_t h = 2166136261u;
+    for (size_t i=0; i < 5; i++) {
+        h ^= (uint8_t)name[i];
+        h *= 16777619u;
+    }
+    for (size_t i=0; i < 4; i++) {
+        h ^= (parent >> (8 * i)) & 0xFF;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/**
+ * @brief Gets the home slot of the key of a used inode.
+ *
+ * @param index - Index that owns the table
+ * @param inode_idx - Index of the inode
+ * @return Slot the inode hashes to
+ */
+static int home_slot(NameIndex *index, int inode_idx) {
+    FsInode *inode = &index->meta->inode[inode_idx];
+    return hash_key(inode->parent, inode->name) & (index->capacity - 1);
+}
+
+int index_create(NameIndex *index, FsMeta *m) {
+    index->meta = m;
+    index->capacity = 256; // keep the load factor below 1/2
+    while (index->capacity < 2 * m->ninodes) index->capacity *= 2;
+    index->slots = malloc(index->capacity * sizeof(int));
+    if (index->slots == NULL) {
+        index->capacity = 0;
+        return -1;
+    }
+    for (int i=0; i < index->capacity; i++) index->slots[i] = -1;
+    return 0;
+}
+
+int index_init(NameIndex *index, FsMeta *m) {
+    if (index_create(index, m) == -1) return -1;
+    for (int i=0; i < m->ninodes; i++) {
+        if (m->inode[i].flags & INODE_USED) index_insert(index, i);
+    }
+    return 0;
+}
+
+void index_destroy(NameIndex *index) {
+    free(index->slots);
+    index->slots = NULL;
+    index->meta = NULL;
+}
+
+void index_insert(NameIndex *index, int inode_idx) {
+    int mask = index->capacity - 1;
+    int slot = home_slot(index, inode_idx);
+    while (index->slots[slot] != -1) slot = (slot + 1) & mask; // linear probing
+    index->slots[slot] = inode_idx;
+}
+
+void index_remove(NameIndex *index, int inode_idx) {
+    int mask = index->capacity - 1;
+    int slot = home_slot(index, inode_idx);
+    while (index->slots[slot] != inode_idx) {
+        if (index->slots[slot] == -1) return; // Inode was never indexed
+        slot = (slot + 1) & mask;
+    }
+
+    // Shift later entries of the probe chain back so lookups never hit a false gap
+    int hole = slot;
+    int next = (slot + 1) & mask;
+    while (index->slots[next] != -1) {
+        int home = home_slot(index, index->slots[next]);
+        // Move the entry if its home slot is not cyclically between the hole and its position
+        int dist_hole = (next - home) & mask;
+        int dist_next = (next - hole) & mask;
+        if (dist_hole >= dist_next) {
+            index->slots[hole] = index->slots[next];
+            hole = next;
+        }
+        next = (next + 1) & mask;
+    }
+    index->slots[hole] = -1;
+}
+
+int index_lookup(NameIndex *index, uint32_t parent, const char name[5]) {
+    int mask = index->capacity - 1;
+    int slot = hash_key(parent, name) & mask;
+    while (index->slots[slot] != -1) {
+        FsInode *inode = &index->meta->inode[index->slots[slot]];
+        if ((inode->parent == parent) && (memcmp(name, inode->name, 5) == 0)) {
+            return index->slots[slot];
+        }
+        slot = (slot + 1) & mask;
+    }
+    return -1; // No file with given name exists in the parent directory
+}
+
+/**
+ * @brief Gets the home slot of a start block (multiplicative hashing).
+ *
+ * @param index - Index that owns the table
+ * @param block - Start block of a file
+ * @return Slot the block hashes to
+ */
+static int start_slot(StartIndex *index, uint32_t block) {
+    return (block * 2654435761u) & (index->capacity - 1);
+}
+
+int start_index_init(StartIndex *index, FsMeta *m) {
+    index->meta = m;
+    index->capacity = 256; // keep the load factor below 1/2
+    while (index->capacity < 2 * m->ninodes) index->capacity *= 2;
+    index->slots = malloc(index->capacity * sizeof(int));
+    if (index->slots == NULL) {
+        index->capacity = 0;
+        return -1;
+    }
+    for (int i=0; i < index->capacity; i++) index->slots[i] = -1;
+    for (int i=0; i < m->ninodes; i++) {
+        if ((m->inode[i].flags & INODE_USED) && !(m->inode[i].flags & INODE_DIR)) start_index_insert(index, i);
+    }
+    return 0;
+}
+
+void start_index_destroy(StartIndex *index) {
+    free(index->slots);
+    index->slots = NULL;
+    index->meta = NULL;
+}
+
+void start_index_insert(StartIndex *index, int inode_idx) {
+    int mask = index->capacity - 1;
+    int slot = start_slot(index, index->meta->inode[inode_idx].start_block);
+    while (index->slots[slot] != -1) slot = (slot + 1) & mask; // linear probing
+    index->slots[slot] = inode_idx;
+}
+
+void start_index_remove(StartIndex *index, int inode_idx) {
+    int mask = index->capacity - 1;
+    int slot = start_slot(index, index->meta->inode[inode_idx].start_block);
+    while (index->slots[slot] != inode_idx) {
+        if (index->slots[slot] == -1) return; // File was never indexed
+        slot = (slot + 1) & mask;
+    }
+
+    // Shift later entries of the probe chain back, like index_remove()
+    int hole = slot;
+    int next = (slot + 1) & mask;
+    while (index->slots[next] != -1) {
+        int home = start_slot(index, index->meta->inode[index->slots[next]].start_block);
+        int dist_hole = (next - home) & mask;
+        int dist_next = (next - hole) & mask;
+        if (dist_hole >= dist_next) {
+            index->slots[hole] = index->slots[next];
+            hole = next;
+        }
+        next = (next + 1) & mask;
+    }
+    index->slots[hole] = -1;
+}
+
+int start_index_lookup(StartIndex *index, int block) {
+    int mask = index->capacity - 1;
+    int slot = start_slot(index, block);
+    while (index->slots[slot] != -1) {
+        if ((int)index->meta->inode[index->slots[slot]].start_block == block) return index->slots[slot];
+        slot = (slot + 1) & mask;
+    }
+    return -1; // No file starts at the block
+}
@@ -0,0 +1,113 @@
+#ifndef FS_INDEX_H
+#define FS_INDEX_H
+
+#include "fs-meta.h"
+
+typedef struct {
+    FsMeta *meta;       // Metadata whose inodes are indexed
+    int capacity;       // # of slots in the hash table (power of 2)
+    int *slots;         // inode index stored in each slot, -1 if the slot is empty
+} NameIndex;
+
+typedef struct {
+    FsMeta *meta;       // Metadata whose files are indexed
+    int capacity;       // # of slots in the hash table (power of 2)
+    int *slots;         // inode index stored in each slot, -1 if the slot is empty
+} StartIndex;
+
+/**
+ * @brief Builds the (parent inode, name) hash index for every used inode of a disk.
+ *
+ * @param index - Index to initialize
+ * @param m - Metadata of the disk to build the index from
+ * @return Integer value 0 if built, -1 if its table cannot be allocated
+ */
+int index_init(NameIndex *index, FsMeta *m);
+
+/**
+ * @brief Sets up an empty (parent inode, name) hash index for a disk.
+ *
+ * @param index - Index to initialize
+ * @param m - Metadata of the disk whose inodes will be indexed
+ * @return Integer value 0 if set up, -1 if its table cannot be allocated
+ */
+int index_create(NameIndex *index, FsMeta *m);
+
+/**
+ * @brief Releases all memory held by the index.
+ *
+ * @param index - Index to free
+ */
+void index_destroy(NameIndex *index);
+
+/**
+ * @brief Adds a used inode to the index. The name and parent are read from the inode table,
+ * so the inode must be filled in before it is inserted.
+ *
+ * @param index - Index to update
+ * @param inode_idx - Index of the inode to add
+ */
+void index_insert(NameIndex *index, int inode_idx);
+
+/**
+ * @brief Removes an inode from the index. Must be called before the inode is cleared.
+ *
+ * @param index - Index to update
+ * @param inode_idx - Index of the inode to remove
+ */
+void index_remove(NameIndex *index, int inode_idx);
+
+/**
+ * @brief Looks up the inode with the given name in the given parent directory.
+ *
+ * @param index - Index to search
+ * @param parent - Index of the parent directory inode (the root index for root)
+ * @param name - Name of the file or directory
+ * @return Integer value index of the inode if it exists, -1 otherwise
+ */
+int index_lookup(NameIndex *index, uint32_t parent, const char name[5]);
+
+/**
+ * @brief Builds the start block hash index for every file of a disk (directories have no blocks).
+ *
+ * @param index - Index to initialize
+ * @param m - Metadata of the disk to build the index from
+ * @return Integer value 0 if built, -1 if its table cannot be allocated
+ */
+int start_index_init(StartIndex *index, FsMeta *m);
+
+/**
+ * @brief Releases all memory held by the start block index.
+ *
+ * @param index - Index to free
+ */
+void start_index_destroy(StartIndex *index);
+
+/**
+ * @brief Adds a file to the start block index. The start block is read from the inode table,
+ * so it must be set before the file is inserted.
+ *
+ * @param index - Index to update
+ * @param inode_idx - Index of the inode of the file
+ */
+void start_index_insert(StartIndex *index, int inode_idx);
+
+/**
+ * @brief Removes a file from the start block index. Must be called before its start block changes
+ * or the inode is cleared.
+ *
+ * @param index - Index to update
+ * @param inode_idx - Index of the inode of the file
+ */
+void start_index_remove(StartIndex *index, int inode_idx);
+
+/**
+ * @brief Looks up the file whose blocks start at the given block.
+ *
+ * @param index - Index to search
+ * @param block - Index of the block
+ * @return Integer value index of the inode of the file if one starts there, -1 otherwise
+ */
+int start_index_lookup(StartIndex *index, int block);
+
+#endif
@@ -0,0 +1,227 @@
+#define _GNU_SOURCE // fallocate()
+#include "fs-journal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#define ENTRY_SIZE (sizeof(uint32_t) + 1024) // # of bytes of each (block index, block) pair of a record
+
+/**
+ * @brief Builds the name of the journal of a disk image (the caller frees it), NULL if it cannot be allocated.
+ */
+static char *journal_path(const char *disk_name) {
+    size_t len = strlen(disk_name);
+    char *path = malloc(len + sizeof(JOURNAL_SUFFIX));
+    if (path == NULL) return NULL;
+    memcpy(path, disk_name, len);
+    memcpy(path + len, JOURNAL_SUFFIX, sizeof(JOURNAL_SUFFIX));
+    return path;
+}
+
+/**
+ * @brief Hashes a record with FNV-1a, the checksum field counts as 0.
+ */
+static uint64_t record_hash(const uint8_t *record, size_t len) {
+    uint64_t hash = 14695981039346656037ULL;
+    size_t field = offsetof(JournalRecord, checksum);
+    for (size_t i=0; i < len; i++) {
+        uint8_t byte = (i >= field && i < field + sizeof(uint64_t)) ? 0 : record[i];
+        hash = (hash ^ byte) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+/**
+ * @brief Syncs the directory a file is in, so a file that was just created survives a crash.
+ */
+static void sync_dir(const char *path) {
+    const char *slash = strrchr(path, '/');
+    char *dir = slash == NULL ? strdup(".") : strndup(path, slash == path ? 1 : slash - path);
+    int fd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (fd != -1) {
+        fsync(fd);
+        close(fd);
+    }
+    free(dir);
+}
+
+/**
+ * @brief Writes every byte of a buffer at an offset of a file.
+ */
+static void write_full(int fd, const uint8_t *buff, size_t len, off_t offset) {
+    while (len > 0) {
+        ssize_t n = pwrite(fd, buff, len, offset);
+        if (n <= 0) return;
+        buff += n;
+        len -= n;
+        offset += n;
+    }
+}
+
+int journal_replay(int fd, const char *disk_name) {
+    char *path = journal_path(disk_name);
+    if (path == NULL) return -2;
+    int jfd = open(path, O_RDONLY);
+    free(path);
+    if (jfd == -1) return -1;
+
+    // The journal is small, read it whole
+    struct stat st;
+    fstat(jfd, &st);
+    size_t size = st.st_size;
+    uint8_t *data = malloc(size > 0 ? size : 1);
+    if (data == NULL) {
+        close(jfd);
+        return -2;
+    }
+    size_t got = 0;
+    while (got < size) {
+        ssize_t n = pread(jfd, data + got, size - got, got);
+        if (n <= 0) break;
+        got += n;
+    }
+    close(jfd);
+    fstat(fd, &st);
+    long disk_blocks = st.st_size / 1024;
+
+    // Replay records while they follow each other, the first one that is torn, stale or zero
+    // (space allocated up front) ends the journal
+    int replayed = 0;
+    uint64_t seq = 0;
+    size_t pos = 0;
+    while (pos + sizeof(JournalRecord) <= got) {
+        JournalRecord *rec = (JournalRecord *)(data + pos);
+        if (memcmp(rec->magic, JOURNAL_MAGIC, 4) != 0) break;
+        if (replayed > 0 && rec->seq != seq + 1) break;
+        size_t len = sizeof(JournalRecord) + (size_t)rec->nblocks * ENTRY_SIZE;
+        if (len > got - pos || record_hash(data + pos, len) != rec->checksum) break;
+        uint8_t *entry = data + pos + sizeof(JournalRecord);
+        int valid = 1;
+        for (uint32_t b=0; b < rec->nblocks; b++) {
+            uint32_t block;
+            memcpy(&block, entry + b * ENTRY_SIZE, sizeof(block));
+            if (block >= disk_blocks) valid = 0;
+        }
+        if (!valid) break;
+        for (uint32_t b=0; b < rec->nblocks; b++) {
+            uint32_t block;
+            memcpy(&block, entry + b * ENTRY_SIZE, sizeof(block));
+            write_full(fd, entry + b * ENTRY_SIZE + sizeof(block), 1024, (off_t)1024 * block);
+        }
+        seq = rec->seq;
+        replayed++;
+        pos += len;
+    }
+    free(data);
+    if (replayed > 0) fdatasync(fd);
+    return replayed;
+}
+
+void journal_remove(const char *disk_name) {
+    char *path = journal_path(disk_name);
+    if (path == NULL) return; // Left in place, replaying it again changes nothing
+    unlink(path);
+    free(path);
+}
+
+int journal_init(Journal *j, Disk *dev, const char *disk_name, int enabled) {
+    memset(j, 0, sizeof(Journal));
+    j->fd = -1;
+    j->dev = dev;
+    if (!enabled) return 0;
+    j->path = journal_path(disk_name);
+    j->buff = malloc(sizeof(JournalRecord) + 16 * ENTRY_SIZE);
+    j->fd = j->path == NULL || j->buff == NULL ? -1 : open(j->path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (j->fd == -1) {
+        free(j->buff);
+        j->buff = NULL;
+        free(j->path);
+        j->path = NULL;
+        return -1;
+    }
+    // Records are written into allocated space, so the fdatasync() of a commit has no file size to update
+    fallocate(j->fd, 0, 0, JOURNAL_SIZE);
+    fsync(j->fd);
+    sync_dir(j->path);
+    j->seq = 1;
+    j->capacity = sizeof(JournalRecord) + 16 * ENTRY_SIZE;
+    return 0;
+}
+
+void journal_destroy(Journal *j) {
+    if (j->fd == -1) return;
+    disk_flush(j->dev); // Every committed change is on the image, the records are not needed any more
+    close(j->fd);
+    unlink(j->path);
+    free(j->path);
+    free(j->buff);
+    j->fd = -1;
+    j->path = NULL;
+    j->buff = NULL;
+}
+
+int journal_commit(Journal *j, FsMeta *m) {
+    if (j->fd == -1 || m->ndirty == 0) return 0;
+
+    // Build the record from the blocks meta_write() is about to write
+    meta_prepare_write(m);
+    size_t len = sizeof(JournalRecord) + (size_t)m->ndirty * ENTRY_SIZE;
+    if (len > j->capacity) {
+        size_t capacity = j->capacity;
+        while (len > capacity) capacity *= 2;
+        uint8_t *grown = realloc(j->buff, capacity);
+        if (grown == NULL) {
+            // The blocks go to the image without a record. Once the image holds every committed change
+            // the journal is emptied, so a replay cannot write older copies of the blocks over them.
+            disk_flush(j->dev);
+            static const uint8_t no_magic[4];
+            write_full(j->fd, no_magic, sizeof(no_magic), 0);
+            fdatasync(j->fd);
+            j->syncs += 2;
+            j->end = 0;
+            j->ordered = 0;
+            return -1;
+        }
+        j->buff = grown;
+        j->capacity = capacity;
+    }
+    JournalRecord *rec = (JournalRecord *)j->buff;
+    memcpy(rec->magic, JOURNAL_MAGIC, 4);
+    rec->nblocks = m->ndirty;
+    rec->seq = j->seq;
+    rec->checksum = 0;
+    uint8_t *entry = j->buff + sizeof(JournalRecord);
+    for (int k=0; k < m->ndirty; k++) {
+        uint32_t block = m->dirty_list[k];
+        memcpy(entry, &block, sizeof(block));
+        meta_encode_block(m, block, entry + sizeof(block));
+        entry += ENTRY_SIZE;
+    }
+    rec->checksum = record_hash(j->buff, len);
+
+    // A full journal starts over once the image holds every change it committed (checkpoint).
+    // Older records past the new ones have lower sequence #s, so replay stops before them.
+    int synced = 0;
+    if (j->end > 0 && j->end + (off_t)len > JOURNAL_SIZE) {
+        disk_flush(j->dev);
+        j->syncs++;
+        j->end = 0;
+        synced = 1;
+    }
+    // Data the new metadata points to must be on the image before the record that makes it reachable
+    if (j->ordered && !synced) {
+        disk_flush(j->dev);
+        j->syncs++;
+    }
+    j->ordered = 0;
+
+    write_full(j->fd, j->buff, len, j->end);
+    fdatasync(j->fd);
+    j->syncs++;
+    j->end += len;
+    j->seq++;
+    j->commits++;
+    return 0;
+}
@@ -0,0 +1,93 @@
+#ifndef FS_JOURNAL_H
+#define FS_JOURNAL_H
+
+#include "fs-meta.h"
+#include "fs-disk.h"
+#include <stdint.h>
+#include <sys/types.h>
+
+#define JOURNAL_MAGIC "FSJ1"        // First 4 bytes of every journal record
+#define JOURNAL_SUFFIX ".journal"   // The journal of a disk image is the image name with this suffix
+#define JOURNAL_SIZE (4 << 20)      // # of bytes of records the journal holds before the image is checkpointed
+#define JOURNAL_INTERVAL_MS 10      // Default time between two group commits
+
+typedef struct {
+    char magic[4];          // JOURNAL_MAGIC
+    uint32_t nblocks;       // # of metadata blocks in the record
+    uint64_t seq;           // Sequence # of the record (one more than the record before it)
+    uint64_t checksum;      // FNV-1a hash of the record with this field set to 0, a torn record is never replayed
+} JournalRecord;            // Header of a journal record, followed by nblocks (uint32_t block index, 1024 byte block) pairs
+
+typedef struct {
+    int fd;                 // Journal file, -1 if the disk is not journaled
+    char *path;             // Name of the journal file
+    Disk *dev;              // Virtual disk the metadata blocks go to
+    uint64_t seq;           // Sequence # of the next record
+    off_t end;              // Offset the next record is written at
+    int ordered;            // 1 if data blocks the metadata points to changed since the last commit
+    long commits;           // # of records committed
+    long syncs;             // # of fdatasync() calls on the journal and the image
+    uint8_t *buff;          // Record being built
+    size_t capacity;        // # of bytes buff can hold
+} Journal;
+
+extern int journal_enabled; // If 1, metadata changes of every mounted disk are committed through a journal
+extern int journal_batch; // Journaled disks: group commit after this many metadata changes (0 = by time and at sync points)
+extern int journal_interval_ms; // Journaled disks: group commit the pending changes this often (0 = by count and at sync points)
+
+/**
+ * @brief Replays the journal of a virtual disk left by a mount that did not shut down cleanly: every
+ * complete record, in sequence order, is written over the metadata blocks it holds and the image is
+ * synced. Records are block images, so replaying a record that already reached the image changes nothing.
+ * The journal file itself is left in place (see journal_remove()).
+ *
+ * @param fd - File descriptor of the virtual disk
+ * @param disk_name - Name of the disk image
+ * @return Integer value # of records replayed, -1 if the disk has no journal (it was shut down cleanly),
+ * -2 if the memory to read the journal cannot be allocated (nothing is replayed)
+ */
+int journal_replay(int fd, const char *disk_name);
+
+/**
+ * @brief Deletes the journal file of a virtual disk.
+ *
+ * @param disk_name - Name of the disk image
+ */
+void journal_remove(const char *disk_name);
+
+/**
+ * @brief Sets up the journal of a mounted virtual disk. When enabled an empty journal file is created
+ * (replacing the one journal_replay() read) and its space is allocated up front, so a commit does not
+ * have to grow the file.
+ *
+ * @param j - Journal to initialize
+ * @param dev - Virtual disk the metadata blocks go to
+ * @param disk_name - Name of the disk image
+ * @param enabled - If 1 create the journal file, if 0 the disk is not journaled
+ * @return Integer value 0 if set up, -1 if the journal file cannot be created or its record buffer allocated
+ */
+int journal_init(Journal *j, Disk *dev, const char *disk_name, int enabled);
+
+/**
+ * @brief Shuts the journal down cleanly: the image is synced, so every committed change is on it,
+ * and the journal file is deleted. Changes that were never committed are NOT written.
+ *
+ * @param j - Journal to release
+ */
+void journal_destroy(Journal *j);
+
+/**
+ * @brief Commits the dirty metadata blocks as one record: if data blocks changed since the last commit
+ * the image is synced first, then the record is written and synced with a single fdatasync(). Once this
+ * returns the blocks can be written in place (meta_write()). When the journal is full the image is
+ * synced and the journal starts over, every record before holds changes that are on the image by then.
+ * If the record buffer cannot grow the image is synced and the journal emptied instead, and the caller
+ * writes the blocks in place unjournaled.
+ *
+ * @param j - Journal of the disk
+ * @param m - Metadata with the dirty blocks to commit
+ * @return Integer value 0 if committed (or nothing to commit), -1 if the blocks could not be journaled
+ */
+int journal_commit(Journal *j, FsMeta *m);
+
+#endif
@@ -1,189 +1,484 @@
 #include "fs-sim.h"
+#include "fs-context.h"
 #include "fs-validate.h"
+#include "fs-parse.h"
+#include "fs-server.h"
 #include <stdio.h>
 #include <string.h>
 #include <fcntl.h>
 #include <stdlib.h>
 #include <unistd.h>
-#include <ctype.h>
+#include <pthread.h>
 
 /**
- * @brief Used for specifically parsing the buffer command by getting all characters after
- * the B as one single string.
+ * @brief Runs a MOUNT command.
+ */
+static void run_mount(FsContext *ctx, Command *cmd) {
+    fs_mount(ctx, cmd->argv[1]);
+}
+
+/**
+ * @brief Runs a CREATE command.
+ */
+static void run_create(FsContext *ctx, Command *cmd) {
+    fs_create(ctx, cmd->name, cmd->num);
+}
+
+/**
+ * @brief Runs a DELETE command.
+ */
+static void run_delete(FsContext *ctx, Command *cmd) {
+    fs_delete(ctx, cmd->name);
+}
+
+/**
+ * @brief Runs a READ command.
+ */
+static void run_read(FsContext *ctx, Command *cmd) {
+    fs_read(ctx, cmd->name, cmd->num);
+}
+
+/**
+ * @brief Runs a WRITE command.
+ */
+static void run_write(FsContext *ctx, Command *cmd) {
+    fs_write(ctx, cmd->name, cmd->num);
+}
+
+/**
+ * @brief Runs a COPY command.
+ */
+static void run_copy(FsContext *ctx, Command *cmd) {
+    fs_copy(ctx, cmd->name, cmd->new_name);
+}
+
+/**
+ * @brief Runs a range READ command.
+ */
+static void run_read_range(FsContext *ctx, Command *cmd) {
+    fs_read_range(ctx, cmd->name, cmd->num, cmd->count);
+}
+
+/**
+ * @brief Runs a range WRITE command.
+ */
+static void run_write_range(FsContext *ctx, Command *cmd) {
+    fs_write_range(ctx, cmd->name, cmd->num, cmd->count);
+}
+
+/**
+ * @brief Runs a BUFFER command.
+ */
+static void run_buff(FsContext *ctx, Command *cmd) {
+    fs_buff(ctx, cmd->buff);
+}
+
+/**
+ * @brief Runs a LIST command.
+ */
+static void run_ls(FsContext *ctx, Command *cmd) {
+    fs_ls(ctx);
+}
+
+/**
+ * @brief Runs a DEFRAGMENT command.
+ */
+static void run_defrag(FsContext *ctx, Command *cmd) {
+    fs_defrag(ctx, cmd->num, cmd->count);
+}
+
+/**
+ * @brief Runs a CHANGE DIRECTORY command.
+ */
+static void run_cd(FsContext *ctx, Command *cmd) {
+    fs_cd(ctx, cmd->name);
+}
+
+/**
+ * @brief Runs a SYNC command.
+ */
+static void run_sync(FsContext *ctx, Command *cmd) {
+    fs_sync(ctx);
+}
+
+/**
+ * @brief Runs a STATS command.
+ */
+static void run_stats(FsContext *ctx, Command *cmd) {
+    fs_stats(ctx);
+}
+
+/**
+ * @brief Runs an ALLOCATION POLICY command.
+ */
+static void run_policy(FsContext *ctx, Command *cmd) {
+    fs_policy(ctx, cmd->num);
+}
+
+/**
+ * @brief Runs a free EXTENTS command.
+ */
+static void run_frag(FsContext *ctx, Command *cmd) {
+    fs_frag(ctx);
+}
+
+typedef struct {
+    int (*valid)(FsContext *ctx, Command *cmd); // Validates the command and decodes its arguments into typed fields
+    void (*run)(FsContext *ctx, Command *cmd);  // Runs the command
+    int needs_disk;             // 1 if the command can only run while a disk is mounted
+} CommandHandler;
+
+// Handler of every command type, indexed by the command byte
+static const CommandHandler handlers[256] = {
+    ['M'] = { fs_mount_valid,  run_mount,  0 }, // MOUNT virtual disk
+    ['C'] = { fs_create_valid, run_create, 1 }, // CREATE a file
+    ['D'] = { fs_delete_valid, run_delete, 1 }, // DELETE a file
+    ['R'] = { fs_read_valid,   run_read,   1 }, // READ a file
+    ['W'] = { fs_write_valid,  run_write,  1 }, // WRITE to a file
+    ['F'] = { fs_copy_valid,   run_copy,   1 }, // copy a FILE
+    ['G'] = { fs_read_range_valid,  run_read_range,  1 }, // GET (read) a range of blocks of a file
+    ['P'] = { fs_write_range_valid, run_write_range, 1 }, // PUT (write) a range of blocks of a file
+    ['B'] = { fs_buff_valid,   run_buff,   1 }, // update the BUFFER
+    ['L'] = { fs_ls_valid,     run_ls,     1 }, // LISTS files and directories in cwd
+    ['O'] = { fs_defrag_valid, run_defrag, 1 }, // DEFRAGMENT the disk
+    ['Y'] = { fs_cd_valid,     run_cd,     1 }, // CHANGE the cwd
+    ['S'] = { fs_sync_valid,   run_sync,   1 }, // SYNC the superblock to the disk
+    ['T'] = { fs_stats_valid,  run_stats,  0 }, // print STATS of the commands run so far
+    ['A'] = { fs_policy_valid, run_policy, 0 }, // set the ALLOCATION policy of new files
+    ['E'] = { fs_frag_valid,   run_frag,   1 }, // print the free EXTENTS (fragmentation) of the disk
+};
+
+/**
+ * @brief Validate the command stored in the given command struct and run it if it is valid,
+ * in a single pass: the command byte selects the handler, validation decodes the arguments
+ * (padded name and number) and the command runs on the decoded fields. Prints an error if the
+ * command is invalid or needs a mounted disk. The time from start until the command finished is
+ * recorded in the latency histogram of its command type (or of invalid commands).
  * 
- * @param str - The command string
- * @param cmd - The command struct to store the buffer string in
+ * @param ctx - Context of the simulator instance to run the command in
+ * @param cmd - Instance of the command struct that contains information about command to run
+ * @param start - Time the command was parsed (stats_now())
+ * @return Time the command finished (stats_now()), so the caller can time the next line without another clock read
  */
-int parse_buff(char *str, Command *cmd) {
-    // If there is no characters after the B command, return 1
-    if (strlen(str) <= 2) return 1;
-    char *buffer_string = str + 2;
-    
-    // Trim newline
-    size_t len = strlen(buffer_string);
-    if (len > 0 && buffer_string[len - 1] == '\n') len--;  // ignore newline
+long runCommand(FsContext *ctx, Command *cmd, long start) {
+    // Every command type is a single character
+    const CommandHandler *handler = NULL;
+    if (cmd->size != 0 && cmd->type[1] == '\0') handler = &handlers[(unsigned char)cmd->type[0]];
 
-    if (len > 1024 || len <= 0) return 1;   // too long or too short
+    Latency *lat = &ctx->stats.invalid;
+    if (handler == NULL || handler->valid == NULL || !handler->valid(ctx, cmd)) {
+        fprintf(ctx->err, "Command Error: %s, %ld\n", cmd->input_file, cmd->line_num);
+    } else if (handler->needs_disk && ctx->mnt == NULL) {
+        fprintf(ctx->err, "Error: No file system is mounted\n");
+    } else {
+        handler->run(ctx, cmd);
+        lat = &ctx->stats.command[(unsigned char)cmd->type[0]]; // Every valid command byte is < STATS_COMMANDS
+    }
+    long end = stats_now();
+    stats_record(lat, end - start);
+    return end;
+}
 
-    memcpy(cmd->buff, buffer_string, len);
-    return 2;
+/**
+ * @brief Parse a non-negative integer command line option value.
+ * 
+ * @param str - The option value
+ * @param val - Where to store the parsed value
+ * @return Integer value 1 if the value is valid, 0 otherwise
+ */
+int parse_option_int(char *str, int *val) {
+    char *endptr;
+    long num = strtol(str, &endptr, 10);
+    if (endptr == str || *endptr != '\0' || num < 0 || num > 1000000000) return 0;
+    *val = (int)num;
+    return 1;
 }
 
 /**
- * @brief Pad a string to a given length (determined by the size of padded_str arg)
+ * @brief Runs every command of an input file in a context, then unmounts its disk.
  * 
- * @param str - The string to pad
- * @param len - length of the original string 
- * @param padded_str - The padded string to fill with characters of the orginal string (up to len)
- */
-void pad_string(char *str, int len, char *padded_str) {
-    for (size_t i = 0; i < (size_t)len; i++) {
-        char c = str[i];
-        if (isupper((unsigned char)c)) {
-            c = tolower((unsigned char)c);
-        }
-        padded_str[i] = c;
+ * @param ctx - Context of the simulator instance to run the script in
+ * @param input_file - Name of the input file
+ * @return Integer value 0 if the script ran, -1 if the input file cannot be opened or a line of it cannot be
+ * parsed for lack of memory (the script stops there)
+ */
+int run_script(FsContext *ctx, char *input_file) {
+    // Open the input file
+    CommandParser parser;
+    if (parser_open(&parser, input_file) == -1) {
+        return -1;
     }
+
+    // For each line in the input file, parse it and run the command if valid
+    Command *cmd;
+    long start = stats_now();
+    while ((cmd = parser_next(&parser)) != NULL) {
+        long parsed = stats_now();
+        stats_record(&ctx->stats.parse, parsed - start);
+        // If the command is valid, run it. Otherwise print error.
+        start = runCommand(ctx, cmd, parsed);
+    }
+    int failed = parser.failed;
+    if (failed) fprintf(ctx->err, "Error: Cannot allocate memory to parse line %zu of %s\n", parser.cmd.line_num, input_file);
+    parser_close(&parser);
+    fs_unmount(ctx); // End of the script is a sync point
+    return failed ? -1 : 0;
 }
 
+typedef struct {
+    char *input_file;   // Name of the input file
+    char *out;          // ls output of the script
+    size_t out_size;    // # of bytes in out
+    char *err;          // Error messages of the script
+    size_t err_size;    // # of bytes in err
+    int status;         // Return value of run_script()
+    int done;           // 1 once the script has finished
+} Script;
+
+typedef struct {
+    Script *scripts;        // Scripts in input order
+    int num_of_scripts;     // # of scripts
+    int next;               // Index of the next script a worker takes
+    pthread_mutex_t lock;   // Protects next and the done flags
+    pthread_cond_t finished; // Signalled every time a script finishes
+    FsStats *stats;         // Statistics of every finished script (protected by lock)
+} ScriptPool;
+
 /**
- * @brief Parse a command string from an input file into a command struct
+ * @brief Worker thread of the script runner. Takes scripts off the pool until none are left
+ * and runs each in its own context, collecting its output in memory.
  * 
- * @param str - The command string
- * @param delim - The C string containing delimiter character(s) 
- * @param cmd - The cmd struct to parse information into
- */
-void parse_command(char* str, const char* delim, Command *cmd) {
-    size_t maxSize = 2; // Max array size
-    size_t currSize = 0; // Current array size
-    cmd->argv = malloc(maxSize * sizeof(char *)); // Initialize array
-    char* token;
-    char *str_cpy = strdup(str);
-    token = strtok(str, delim);
-    for(size_t i = 0; token != NULL; ++i){
-        if (currSize == maxSize) {
-            // If array is full double the memory allocated to it
-            maxSize = maxSize * 2;
-            char **argvNew = realloc(cmd->argv, maxSize * sizeof(char *));
-            cmd->argv = argvNew;
-        }
-        cmd->argv[i] = token;
+ * @param arg - The ScriptPool
+ */
+void *script_worker(void *arg) {
+    ScriptPool *pool = arg;
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        int idx = pool->next < pool->num_of_scripts ? pool->next++ : -1;
+        pthread_mutex_unlock(&pool->lock);
+        if (idx == -1) return NULL;
 
-        // If the command type is B, call unique buffer parsing function
-        if (i == 0 && (strcmp(token, "B") == 0)) {
-            currSize = parse_buff(str_cpy, cmd);
-            break;
+        Script *script = &pool->scripts[idx];
+        FILE *out = open_memstream(&script->out, &script->out_size);
+        FILE *err = open_memstream(&script->err, &script->err_size);
+        FsContext *ctx = malloc(sizeof(FsContext));
+        int ran = (out != NULL && err != NULL && ctx != NULL);
+        int status = -1; // The script fails like a missing input file if its context cannot be set up
+        if (ran) {
+            fs_init(ctx, out, err);
+            status = run_script(ctx, script->input_file);
+            fs_destroy(ctx);
         }
-        
-        token = strtok(NULL, delim);
-        currSize++;
+        if (out != NULL) fclose(out);
+        if (err != NULL) fclose(err);
+
+        pthread_mutex_lock(&pool->lock);
+        if (ran) stats_merge(pool->stats, &ctx->stats);
+        script->status = status;
+        script->done = 1;
+        pthread_cond_broadcast(&pool->finished);
+        pthread_mutex_unlock(&pool->lock);
+        free(ctx);
     }
-    cmd->size = currSize; // Set size of argument array
-    if (currSize != 0) cmd->type = cmd->argv[0]; // If arg array has elements, set the first as command 'type'
-    free(str_cpy);
-    return;
 }
 
 /**
- * @brief Run the command stored in the given command struct. 
+ * @brief Runs several input files at the same time on a pool of threads. Each script gets its own
+ * context (so scripts should mount different disks), and the output of each script is printed in
+ * input order as soon as it and every script before it have finished.
  * 
- * @param cmd - Instance of the command struct that contains information about command to run
+ * @param input_files - Names of the input files
+ * @param num_of_scripts - # of input files
+ * @param num_of_threads - # of worker threads (0 = # of online CPUs)
+ * @param stats - Where the statistics of every script are added up
+ * @return Integer value 0 if every script ran, 1 if an input file cannot be opened or the memory or
+ * threads to run the scripts cannot be set up
  */
-void runCommands(Command *cmd) {
-    if (!strcmp(cmd->type, "M")) {
-        // MOUNT virtual disk
-        // args: char *name
-        fs_mount(cmd->argv[1]);
-    } else if (!strcmp(cmd->type, "C")) {
-        // CREATE a file
-        // args: char name[5], int size
-        char padded_name[5] = {0};
-        pad_string(cmd->argv[1], strlen(cmd->argv[1]), padded_name);
-        fs_create(padded_name, atoi(cmd->argv[2]));
-    } else if (!strcmp(cmd->type, "D")) {
-        // DELETE a file
-        // args: char name[5]
-        char padded_name[5] = {0};
-        pad_string(cmd->argv[1], strlen(cmd->argv[1]), padded_name);
-        fs_delete(padded_name);
-    } else if (!strcmp(cmd->type, "R")) {
-        // READ a file
-        // args: char name[5], int block_num
-        char padded_name[5] = {0};
-        pad_string(cmd->argv[1], strlen(cmd->argv[1]), padded_name);
-        fs_read(padded_name, atoi(cmd->argv[2]));
-    } else if (!strcmp(cmd->type, "W")) {
-        // WRITE to a file
-        // args: char name[5], int block_num
-        char padded_name[5] = {0};
-        pad_string(cmd->argv[1], strlen(cmd->argv[1]), padded_name);
-        fs_write(padded_name, atoi(cmd->argv[2]));
-    } else if (!strcmp(cmd->type, "B")) {
-        // update the BUFFER
-        // args: uint8_t buff[1024]
-        fs_buff(cmd->buff);
-    } else if (!strcmp(cmd->type, "L")) {
-        // LISTS files and directories in cwd
-        fs_ls();
-    } else if (!strcmp(cmd->type, "O")) {
-        // DEFRAGMENT the disk
-        fs_defrag();
-    } else if (!strcmp(cmd->type, "Y")) {
-        // CHANGE the cwd
-        // args: char name[5]
-        char padded_name[5] = {0};
-        pad_string(cmd->argv[1], strlen(cmd->argv[1]), padded_name);
-        fs_cd(padded_name);
+int run_scripts(char **input_files, int num_of_scripts, int num_of_threads, FsStats *stats) {
+    if (num_of_threads == 0) num_of_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_of_threads < 1) num_of_threads = 1;
+    if (num_of_threads > num_of_scripts) num_of_threads = num_of_scripts;
+
+    ScriptPool pool;
+    pool.scripts = calloc(num_of_scripts, sizeof(Script));
+    pthread_t *threads = malloc(num_of_threads * sizeof(pthread_t));
+    if (pool.scripts == NULL || threads == NULL) {
+        free(pool.scripts);
+        free(threads);
+        return 1;
+    }
+    pool.num_of_scripts = num_of_scripts;
+    pool.next = 0;
+    pool.stats = stats;
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.finished, NULL);
+    for (int i=0; i < num_of_scripts; i++) pool.scripts[i].input_file = input_files[i];
+
+    // The scripts run on the workers that could be started, none started fails the run
+    int started = 0;
+    while (started < num_of_threads && pthread_create(&threads[started], NULL, script_worker, &pool) == 0) started++;
+    if (started == 0) {
+        pthread_mutex_destroy(&pool.lock);
+        pthread_cond_destroy(&pool.finished);
+        free(threads);
+        free(pool.scripts);
+        return 1;
+    }
+
+    // Print the output of each script in input order
+    int ret = 0;
+    for (int i=0; i < num_of_scripts; i++) {
+        Script *script = &pool.scripts[i];
+        pthread_mutex_lock(&pool.lock);
+        while (!script->done) pthread_cond_wait(&pool.finished, &pool.lock);
+        pthread_mutex_unlock(&pool.lock);
+
+        fwrite(script->out, 1, script->out_size, stdout);
+        fflush(stdout);
+        fwrite(script->err, 1, script->err_size, stderr);
+        if (script->status != 0) ret = 1;
+        free(script->out);
+        free(script->err);
     }
+
+    for (int t=0; t < started; t++) pthread_join(threads[t], NULL);
+    pthread_mutex_destroy(&pool.lock);
+    pthread_cond_destroy(&pool.finished);
+    free(threads);
+    free(pool.scripts);
+    return ret;
 }
 
-int main(int argc, char **argv) {
-    if (argc < 2) return 1;
-    for (size_t i=0; i < 1024; i++) fs_buffer[i] = 0;
-    char *input_file = argv[1]; // Name of the input file
-    FILE *fd = fopen(input_file, "r"); // Initialize the input file descriptor
+/**
+ * @brief Writes the end-of-run statistics summary to a file descriptor, which is left open.
+ * 
+ * @param stats - Statistics of every script that ran
+ * @param fd - File descriptor to write to
+ * @param json - If 1 write a JSON object, if 0 the same table as the STATS command
+ */
+void write_summary(FsStats *stats, int fd, int json) {
+    fflush(stdout); // The summary may go to stdout, after the output of the scripts
+    FILE *out = fdopen(dup(fd), "w");
+    if (out == NULL) return;
+    if (json) stats_print_json(out, stats);
+    else stats_print(out, stats);
+    fclose(out);
+}
 
-    // Open the input file
-    if (fd == NULL) {
+int main(int argc, char **argv) {
+    // Options:
+    //   -w N  hold superblock changes in memory (write-back), sync every N changes (0 = only at sync points)
+    //   -c N  cache up to N data blocks in memory (LRU, write-back)
+    //   -m    access mounted disks through mmap() instead of pread/pwrite
+    //   -t    print how long each phase of the consistency check took on every mount
+    //   -u N  queue block reads and writes on an io_uring with N requests in flight
+    //   -j N  run several input files on N threads (0 = # of online CPUs, the default)
+    //   -s    scripts that mount the same disk image share one mount (thread-safe)
+    //   -a POLICY  allocation policy of new files: first (the default), next, best or segregated
+    //   -b N  defrag every mounted disk on a background thread between commands, at most N blocks per step
+    //   -z    zero the blocks freed by delete and defrag on a background thread (done by every sync point)
+    //   -l N  commit metadata changes through a journal next to each disk image, in groups of N changes (0 = by time only)
+    //   -i MS with -l, also commit the pending changes every MS milliseconds (0 = only by count and at sync points)
+    //   -T FD write a statistics summary (STATS table) to file descriptor FD at the end of the run
+    //   -J FD write the statistics summary as JSON to file descriptor FD at the end of the run
+    //   -D SOCKET  run as a daemon serving command lines on a Unix domain socket (no input files)
+    //   -C SOCKET  send the input files to a daemon and print its replies
+    char *serve_path = NULL;
+    char *connect_path = NULL;
+    int num_of_threads = 0;
+    int summary_fd = -1;
+    int summary_json = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "w:c:mtu:j:sa:b:zl:i:T:J:D:C:")) != -1) {
+        switch (opt) {
+            case 'D':
+                serve_path = optarg;
+                break;
+            case 'C':
+                connect_path = optarg;
+                break;
+            case 'T':
+            case 'J':
+                if (!parse_option_int(optarg, &summary_fd)) return 1;
+                summary_json = (opt == 'J');
+                break;
+            case 's':
+                disk_shared = 1;
+                break;
+            case 'j':
+                if (!parse_option_int(optarg, &num_of_threads)) return 1;
+                break;
+            case 'u':
+                if (!parse_option_int(optarg, &disk_ring_depth)) return 1;
+                break;
+            case 't':
+                check_timing_report = 1;
+                break;
+            case 'm':
+                disk_use_mmap = 1;
+                break;
+            case 'a':
+                alloc_policy = alloc_policy_parse(optarg);
+                if (alloc_policy == -1) return 1;
+                break;
+            case 'b':
+                if (!parse_option_int(optarg, &defrag_blocks)) return 1;
+                break;
+            case 'z':
+                scrub_deferred = 1;
+                break;
+            case 'l':
+                if (!parse_option_int(optarg, &journal_batch)) return 1;
+                journal_enabled = 1;
+                break;
+            case 'i':
+                if (!parse_option_int(optarg, &journal_interval_ms)) return 1;
+                break;
+            case 'c':
+                if (!parse_option_int(optarg, &cache_blocks)) return 1;
+                break;
+            case 'w':
+                if (!parse_option_int(optarg, &sb_sync_every)) return 1;
+                sb_writeback = 1;
+                break;
+            default:
+                return 1;
+        }
+    }
+    FsStats *stats = calloc(1, sizeof(FsStats));
+    if (stats == NULL) return 1;
+    int ret;
+    if (serve_path != NULL) {
+        ret = server_run(serve_path, runCommand, stats);
+        if (ret == 0 && summary_fd != -1) write_summary(stats, summary_fd, summary_json);
+        free(stats);
+        return ret;
+    }
+    if (optind >= argc) {
+        free(stats);
         return 1;
     }
-    
-    // For each line in the input file, parse it and run the command if valid
-    char* line = NULL; // Command line
-    size_t lineNum = 0; // Keeps track of the current line #
-    size_t size = 0; // Size of command line
-    while (getline(&line, &size, fd) != -1) {
-        lineNum++;
-
-        // Create command struct and initalize values
-        Command *cmd = malloc(sizeof(Command));
-        cmd->input_file = input_file;
-        cmd->line_num = lineNum;
-        cmd->type = NULL;
-        cmd->argv = NULL;
-        for (size_t i=0; i < 1024; i++) cmd->buff[i] = 0; // Zero out the buffer
-        cmd->size = 0;
-
-        char *line_cpy = strdup(line); // Create copy of command line to parse
-        parse_command(line, " \n\"", cmd);
-        
-        // If the command is valid, run it. Otherwise print error.
-        if(validateCommand(cmd)) {
-            if ((vd == -1) && (strcmp(cmd->type, "M") != 0)) fprintf(stderr, "Error: No file system is mounted\n");
-            else runCommands(cmd);
-        } else {
-            fprintf(stderr, "Command Error: %s, %ld\n", cmd->input_file, cmd->line_num);
-        }
+    if (connect_path != NULL) {
+        free(stats);
+        return client_run(connect_path, &argv[optind], argc - optind);
+    }
 
-        // Free allocated memory
-        free(cmd->argv);
-        free(cmd);
-        free(line_cpy);
+    // Several input files are run concurrently, each on its own context
+    if (argc - optind > 1) {
+        ret = run_scripts(&argv[optind], argc - optind, num_of_threads, stats);
+    } else {
+        FsContext *ctx = malloc(sizeof(FsContext));
+        if (ctx == NULL) {
+            free(stats);
+            return 1;
+        }
+        fs_init(ctx, stdout, stderr);
+        ret = run_script(ctx, argv[optind]) == -1 ? 1 : 0;
+        stats_merge(stats, &ctx->stats);
+        fs_destroy(ctx);
+        free(ctx);
     }
-    free(line);
-    fclose(fd);
-    if (vd != -1) close(vd);
-    if (sb != NULL) free(sb);
-    if (disk_name != NULL) free(disk_name);
-    return 0;
+    if (summary_fd != -1) write_summary(stats, summary_fd, summary_json);
+    free(stats);
+    return ret;
 }
\ No newline at end of file
@@ -0,0 +1,282 @@
+#include "fs-meta.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * @brief Reads exactly len bytes at an offset of a file (short reads past the end are zero filled).
+ */
+static void read_full(int fd, off_t offset, uint8_t *buff, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = pread(fd, buff + done, len - done, offset + done);
+        if (n <= 0) break;
+        done += n;
+    }
+    if (done < len) memset(buff + done, 0, len - done);
+}
+
+/**
+ * @brief Fills in the v2 geometry header for a disk size and inode count.
+ *
+ * @param header - Header to fill in
+ * @param nblocks - # of blocks on the disk
+ * @param ninodes - # of inodes in the inode table
+ * @return Integer value 0 if the geometry is valid, -1 otherwise
+ */
+static int v2_geometry(SuperblockV2 *header, long nblocks, long ninodes) {
+    if (ninodes < 1 || ninodes > (1 << 24)) return -1;
+    if (nblocks < 2 || nblocks > (long)V2_MAX_BITMAP_BLOCKS * V2_BITS_PER_BLOCK) return -1;
+    memset(header, 0, sizeof(SuperblockV2));
+    memcpy(header->magic, V2_MAGIC, 4);
+    header->version = 2;
+    header->block_size = 1024;
+    header->nblocks = nblocks;
+    header->ninodes = ninodes;
+    header->inode_start = 1;
+    header->inode_blocks = (ninodes * V2_INODE_SIZE + 1023) / 1024;
+    header->bitmap_start = header->inode_start + header->inode_blocks;
+    header->bitmap_blocks = (nblocks + V2_BITS_PER_BLOCK - 1) / V2_BITS_PER_BLOCK;
+    header->data_start = header->bitmap_start + header->bitmap_blocks;
+    if (header->data_start >= nblocks) return -1; // No room for any data block
+    return 0;
+}
+
+/**
+ * @brief Marks a metadata block as dirty.
+ */
+static void mark_block(FsMeta *m, int block) {
+    if (m->dirty[block]) return;
+    m->dirty[block] = 1;
+    m->dirty_list[m->ndirty++] = block;
+}
+
+/**
+ * @brief Compares two block indexes for qsort.
+ */
+static int compare_block(const void *a, const void *b) {
+    return *(const int *)a - *(const int *)b;
+}
+
+/**
+ * @brief Decodes a packed v1 superblock into the in-memory format.
+ */
+static int load_v1(FsMeta *m, uint8_t block0[1024]) {
+    Superblock *raw = (Superblock *)block0;
+    m->version = 1;
+    m->nblocks = 128;
+    m->ninodes = 126;
+    m->root = 127;
+    m->data_start = 1;
+    m->max_file_blocks = 127;
+    m->inode = calloc(m->ninodes, sizeof(FsInode));
+    m->bitmap = malloc(sizeof(raw->free_block_list));
+    m->dirty = calloc(1, 1); // The whole superblock is one metadata block
+    m->dirty_list = malloc(sizeof(int));
+    if (m->inode == NULL || m->bitmap == NULL || m->dirty == NULL || m->dirty_list == NULL) return -1;
+    for (int i=0; i < m->ninodes; i++) {
+        Inode *in = &raw->inode[i];
+        FsInode *out = &m->inode[i];
+        memcpy(out->name, in->name, 5);
+        out->flags = ((in->isused_size & (1 << 7)) ? INODE_USED : 0) | ((in->isdir_parent & (1 << 7)) ? INODE_DIR : 0);
+        out->size = in->isused_size & ~(1 << 7);
+        out->start_block = in->start_block;
+        out->parent = in->isdir_parent & ~(1 << 7);
+    }
+    memcpy(m->bitmap, raw->free_block_list, sizeof(raw->free_block_list));
+    m->summary = NULL;
+    m->ndirty = 0;
+    return 0;
+}
+
+/**
+ * @brief Reads the inode table and free block list of a v2 disk.
+ */
+static int load_v2(FsMeta *m, int fd, uint8_t block0[1024]) {
+    SuperblockV2 *header = (SuperblockV2 *)block0;
+    SuperblockV2 expected;
+    if (header->version != 2 || header->block_size != 1024) return 7;
+    if (v2_geometry(&expected, header->nblocks, header->ninodes) != 0) return 7;
+    if (memcmp(header, &expected, sizeof(SuperblockV2)) != 0) return 7;
+    off_t end = lseek(fd, 0, SEEK_END);
+    if (end < (off_t)1024 * header->nblocks) return 7; // Image is smaller than its geometry
+
+    m->version = 2;
+    m->nblocks = header->nblocks;
+    m->ninodes = header->ninodes;
+    m->root = header->ninodes;
+    m->data_start = header->data_start;
+    m->max_file_blocks = header->nblocks - header->data_start;
+    m->inode_start = header->inode_start;
+    m->bitmap_start = header->bitmap_start;
+    m->bitmap_blocks = header->bitmap_blocks;
+
+    // Read the inode table and the free block list with one read each
+    m->inode = malloc((size_t)header->inode_blocks * 1024);
+    m->bitmap = malloc((size_t)header->bitmap_blocks * 1024);
+    m->summary = malloc(1024 - V2_SUMMARY_OFFSET);
+    m->dirty = calloc(m->data_start, 1);
+    m->dirty_list = malloc(m->data_start * sizeof(int));
+    if (m->inode == NULL || m->bitmap == NULL || m->summary == NULL || m->dirty == NULL || m->dirty_list == NULL) return -1;
+    read_full(fd, (off_t)1024 * header->inode_start, (uint8_t *)m->inode, (size_t)header->inode_blocks * 1024);
+    read_full(fd, (off_t)1024 * header->bitmap_start, m->bitmap, (size_t)header->bitmap_blocks * 1024);
+    memcpy(m->summary, block0 + V2_SUMMARY_OFFSET, 1024 - V2_SUMMARY_OFFSET);
+    m->ndirty = 0;
+    return 0;
+}
+
+int meta_load(FsMeta *m, int fd) {
+    uint8_t block0[1024];
+    memset(m, 0, sizeof(FsMeta));
+    read_full(fd, 0, block0, 1024);
+    if (memcmp(block0, V2_MAGIC, 4) == 0) return load_v2(m, fd, block0);
+    return load_v1(m, block0);
+}
+
+void meta_free(FsMeta *m) {
+    free(m->inode);
+    free(m->bitmap);
+    free(m->summary);
+    free(m->dirty);
+    free(m->dirty_list);
+    memset(m, 0, sizeof(FsMeta));
+}
+
+void meta_prepare_write(FsMeta *m) {
+    if (m->version == 1) return; // The only metadata block is block 0
+
+    // Refresh the summary bits of changed free block list blocks, block 0 holds the summary
+    int ndirty = m->ndirty;
+    for (int k=0; k < ndirty; k++) {
+        int block = m->dirty_list[k];
+        if (block < m->bitmap_start) continue;
+        int bb = block - m->bitmap_start;
+        int bit = meta_summary_bit(m, bb);
+        int old = (m->summary[bb / 8] >> (7 - bb % 8)) & 1;
+        if (bit == old) continue;
+        if (bit) m->summary[bb / 8] |= (1 << (7 - bb % 8));
+        else m->summary[bb / 8] &= ~(1 << (7 - bb % 8));
+        mark_block(m, 0);
+    }
+    qsort(m->dirty_list, m->ndirty, sizeof(int), compare_block);
+}
+
+void meta_encode_block(FsMeta *m, int block, uint8_t buff[1024]) {
+    if (m->version == 1) {
+        // Encode the packed v1 superblock
+        Superblock *raw = (Superblock *)buff;
+        memcpy(raw->free_block_list, m->bitmap, sizeof(raw->free_block_list));
+        for (int i=0; i < m->ninodes; i++) {
+            FsInode *in = &m->inode[i];
+            Inode *out = &raw->inode[i];
+            memcpy(out->name, in->name, 5);
+            out->isused_size = (uint8_t)in->size | ((in->flags & INODE_USED) ? (1 << 7) : 0);
+            out->start_block = (uint8_t)in->start_block;
+            out->isdir_parent = (uint8_t)in->parent | ((in->flags & INODE_DIR) ? (1 << 7) : 0);
+        }
+    } else if (block == 0) {
+        memset(buff, 0, 1024);
+        v2_geometry((SuperblockV2 *)buff, m->nblocks, m->ninodes);
+        memcpy(buff + V2_SUMMARY_OFFSET, m->summary, 1024 - V2_SUMMARY_OFFSET);
+    } else if (block < m->bitmap_start) {
+        memcpy(buff, (uint8_t *)m->inode + (size_t)1024 * (block - m->inode_start), 1024);
+    } else {
+        memcpy(buff, m->bitmap + (size_t)1024 * (block - m->bitmap_start), 1024);
+    }
+}
+
+void meta_write(FsMeta *m, Disk *dev) {
+    if (m->ndirty == 0) return;
+    meta_prepare_write(m);
+
+    // Write the dirty blocks in disk order, contiguous blocks of the same table in one write
+    for (int k=0; k < m->ndirty; ) {
+        int block = m->dirty_list[k];
+        if (block == 0) {
+            uint8_t block0[1024];
+            meta_encode_block(m, 0, block0);
+            disk_write(dev, 0, 1, block0);
+            m->dirty[0] = 0;
+            k++;
+            continue;
+        }
+        int table_end = (block < m->bitmap_start) ? m->bitmap_start : m->data_start;
+        int count = 1;
+        while (k + count < m->ndirty && m->dirty_list[k + count] == block + count && block + count < table_end) count++;
+        uint8_t *src = (block < m->bitmap_start)
+            ? (uint8_t *)m->inode + (size_t)1024 * (block - m->inode_start)
+            : m->bitmap + (size_t)1024 * (block - m->bitmap_start);
+        disk_write(dev, block, count, src);
+        for (int c=0; c < count; c++) m->dirty[block + c] = 0;
+        k += count;
+    }
+    m->ndirty = 0;
+}
+
+void meta_mark_inode(FsMeta *m, int inode_idx) {
+    if (m->version == 1) mark_block(m, 0);
+    else mark_block(m, m->inode_start + (inode_idx * V2_INODE_SIZE) / 1024);
+}
+
+void meta_set_blocks(FsMeta *m, int start_idx, int size, int set) {
+    int last_marked = -1;
+    for (int i=start_idx; i < start_idx+size; i++) {
+        if (i < m->data_start) continue;   // skip metadata block bits
+        int byte = i / 8;
+        int bit  = 7 - (i % 8);
+        if (set)
+            m->bitmap[byte] |=  (1 << bit);
+        else
+            m->bitmap[byte] &= ~(1 << bit);
+        int block = (m->version == 1) ? 0 : m->bitmap_start + i / V2_BITS_PER_BLOCK;
+        if (block != last_marked) {
+            mark_block(m, block);
+            last_marked = block;
+        }
+    }
+}
+
+int meta_block_used(FsMeta *m, int block) {
+    return (m->bitmap[block / 8] >> (7 - block % 8)) & 1;
+}
+
+int meta_summary_bit(FsMeta *m, int bitmap_block) {
+    const uint8_t *bits = m->bitmap + (size_t)1024 * bitmap_block;
+    for (size_t i=0; i < 1024; i++) {
+        if (bits[i] != 0xFF) return 1;
+    }
+    return 0;
+}
+
+int meta_format(int fd, int nblocks, int ninodes) {
+    SuperblockV2 header;
+    if (v2_geometry(&header, nblocks, ninodes) != 0) return -1;
+    size_t bitmap_len = (size_t)1024 * header.bitmap_blocks;
+    uint8_t *bitmap = calloc(bitmap_len, 1);
+    if (bitmap == NULL) return -2; // Checked before the file is touched
+
+    // Start from an all zero (sparse) image, which is an empty inode table
+    if (ftruncate(fd, 0) == -1 || ftruncate(fd, (off_t)1024 * nblocks) == -1) {
+        free(bitmap);
+        return -1;
+    }
+
+    // Metadata blocks and the bits past the last block are marked used
+    for (size_t i=0; i < bitmap_len * 8; i++) {
+        if (i < header.data_start || i >= (size_t)nblocks) bitmap[i / 8] |= (1 << (7 - i % 8));
+    }
+    lseek(fd, (off_t)1024 * header.bitmap_start, SEEK_SET);
+    write(fd, bitmap, bitmap_len);
+
+    // Block 0 holds the geometry header and the free block list summary
+    uint8_t block0[1024] = {0};
+    memcpy(block0, &header, sizeof(SuperblockV2));
+    FsMeta m = { .bitmap = bitmap };
+    for (uint32_t bb=0; bb < header.bitmap_blocks; bb++) {
+        if (meta_summary_bit(&m, bb)) block0[V2_SUMMARY_OFFSET + bb / 8] |= (1 << (7 - bb % 8));
+    }
+    lseek(fd, 0, SEEK_SET);
+    write(fd, block0, 1024);
+    free(bitmap);
+    return 0;
+}
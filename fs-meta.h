@@ -0,0 +1,151 @@
+#ifndef FS_META_H
+#define FS_META_H
+
+#include "fs-sim.h"
+#include "fs-disk.h"
+
+#define INODE_USED (1 << 7) // FsInode flag: inode is in use
+#define INODE_DIR  (1 << 6) // FsInode flag: inode is a directory
+
+#define V2_MAGIC "FSV2"            // First 4 bytes of a v2 disk
+#define V2_INODE_SIZE 32           // # of bytes of each inode in the v2 inode table
+#define V2_BITS_PER_BLOCK 8192     // # of blocks tracked by each block of the v2 free block list
+#define V2_SUMMARY_OFFSET 64       // Offset of the free block list summary in block 0 of a v2 disk
+#define V2_MAX_BITMAP_BLOCKS ((1024 - V2_SUMMARY_OFFSET) * 8) // # of free block list blocks the summary can track
+
+typedef struct {
+    char name[5];           // name of the file/directory
+    uint8_t flags;          // INODE_USED and INODE_DIR bits
+    uint8_t reserved[2];
+    uint32_t size;          // # of blocks of the file (0 for directories)
+    uint32_t start_block;   // index of the first block of the file (0 for directories)
+    uint32_t parent;        // index of the parent inode (root index for the root directory)
+    uint8_t padding[12];
+} FsInode;                  // In-memory inode of every format, also the on-disk inode of v2
+
+typedef struct {
+    char magic[4];          // V2_MAGIC
+    uint32_t version;       // 2
+    uint32_t block_size;    // 1024
+    uint32_t nblocks;       // # of blocks on the disk (including metadata blocks)
+    uint32_t ninodes;       // # of inodes in the inode table
+    uint32_t inode_start;   // first block of the inode table
+    uint32_t inode_blocks;  // # of blocks of the inode table
+    uint32_t bitmap_start;  // first block of the free block list
+    uint32_t bitmap_blocks; // # of blocks of the free block list
+    uint32_t data_start;    // first block that can be allocated to a file
+} SuperblockV2;             // Geometry header stored at the start of block 0 of a v2 disk
+
+typedef struct {
+    int version;            // On-disk format version (1 or 2)
+    int nblocks;            // # of blocks on the disk
+    int ninodes;            // # of inodes
+    int root;               // parent index of files in the root directory (127 for v1)
+    int data_start;         // first block that can be allocated to a file
+    int max_file_blocks;    // largest file size the format can store
+    int inode_start;        // first block of the inode table (v2)
+    int bitmap_start;       // first block of the free block list (v2)
+    int bitmap_blocks;      // # of blocks of the free block list (v2)
+    FsInode *inode;         // inode table
+    uint8_t *bitmap;        // free block list, 1 bit per block (most significant bit first), 1 = used
+    uint8_t *summary;       // 1 bit per free block list block, 1 = it tracks at least one free block (v2)
+    uint8_t *dirty;         // 1 for each metadata block that has changes not written to the disk
+    int *dirty_list;        // metadata blocks that are dirty
+    int ndirty;             // # of entries in dirty_list
+} FsMeta;
+
+/**
+ * @brief Reads the metadata of a virtual disk into memory. v1 disks (a single 1024 byte
+ * superblock) are decoded into the in-memory format, v2 disks are detected by the magic
+ * bytes in block 0 and have their inode table and free block list read in large reads.
+ *
+ * @param m - Metadata to fill in
+ * @param fd - File descriptor of the virtual disk
+ * @return Integer value 0 if loaded, 7 if the disk has a v2 header with an invalid geometry, -1 if the
+ * tables cannot be allocated (meta_free() frees what was)
+ */
+int meta_load(FsMeta *m, int fd);
+
+/**
+ * @brief Releases all memory held by the metadata.
+ *
+ * @param m - Metadata to free
+ */
+void meta_free(FsMeta *m);
+
+/**
+ * @brief Gets the dirty metadata blocks ready to be written: the summary bits of changed free block
+ * list blocks are refreshed (which dirties block 0 if one changed) and dirty_list is sorted, so it
+ * lists every block meta_write() writes, in disk order.
+ *
+ * @param m - Metadata to update
+ */
+void meta_prepare_write(FsMeta *m);
+
+/**
+ * @brief Encodes a metadata block in its on-disk form, as meta_write() writes it.
+ *
+ * @param m - Metadata to read
+ * @param block - Index of the metadata block
+ * @param buff - Buffer to encode 1024 bytes into
+ */
+void meta_encode_block(FsMeta *m, int block, uint8_t buff[1024]);
+
+/**
+ * @brief Writes every dirty metadata block to the virtual disk. A v1 superblock is encoded
+ * back into its packed 1024 byte form.
+ *
+ * @param m - Metadata to write
+ * @param dev - Disk to write to
+ */
+void meta_write(FsMeta *m, Disk *dev);
+
+/**
+ * @brief Marks the metadata block holding an inode as dirty.
+ *
+ * @param m - Metadata to update
+ * @param inode_idx - Index of the inode that changed
+ */
+void meta_mark_inode(FsMeta *m, int inode_idx);
+
+/**
+ * @brief Sets the bits of a range of blocks in the free block list to 1 (used) or 0 (free)
+ * and marks the changed metadata blocks as dirty. Metadata blocks are skipped.
+ *
+ * @param m - Metadata to update
+ * @param start_idx - Index of first block to set
+ * @param size - # of blocks to set
+ * @param set - If 1 set bits to 1, if 0 set bits to 0
+ */
+void meta_set_blocks(FsMeta *m, int start_idx, int size, int set);
+
+/**
+ * @brief Checks if a block is marked as used in the free block list.
+ *
+ * @param m - Metadata to read
+ * @param block - Index of the block
+ * @return Integer value 1 if the block is used, 0 if it is free
+ */
+int meta_block_used(FsMeta *m, int block);
+
+/**
+ * @brief Recomputes the summary bit of a free block list block.
+ *
+ * @param m - Metadata to read
+ * @param bitmap_block - Index of the block inside the free block list
+ * @return Integer value 1 if the block tracks at least one free block, 0 otherwise
+ */
+int meta_summary_bit(FsMeta *m, int bitmap_block);
+
+/**
+ * @brief Formats an open file as an empty v2 disk.
+ *
+ * @param fd - File descriptor of the file to format
+ * @param nblocks - # of blocks on the disk
+ * @param ninodes - # of inodes in the inode table
+ * @return Integer value 0 if the disk was formatted, -1 if the geometry is invalid, -2 if the free block
+ * list cannot be allocated (the file is left as it was)
+ */
+int meta_format(int fd, int nblocks, int ninodes);
+
+#endif
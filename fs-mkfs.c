@@ -0,0 +1,45 @@
+#include "fs-meta.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/**
+ * @brief Creates an empty v2 virtual disk.
+ * Usage: ./create_fs_v2 disk_name nblocks ninodes
+ */
+int main(int argc, char **argv) {
+    if (argc != 4) {
+        fprintf(stderr, "Usage: %s disk_name nblocks ninodes\n", argv[0]);
+        return 1;
+    }
+
+    char *endptr;
+    long nblocks = strtol(argv[2], &endptr, 10);
+    if (endptr == argv[2] || *endptr != '\0') nblocks = -1;
+    long ninodes = strtol(argv[3], &endptr, 10);
+    if (endptr == argv[3] || *endptr != '\0') ninodes = -1;
+    if (nblocks < 0 || nblocks > 0x7FFFFFFF || ninodes < 0 || ninodes > 0x7FFFFFFF) {
+        fprintf(stderr, "Error: Invalid geometry %s blocks, %s inodes\n", argv[2], argv[3]);
+        return 1;
+    }
+
+    int fd = open(argv[1], O_RDWR | O_CREAT, 0644);
+    if (fd == -1) {
+        fprintf(stderr, "Error: Cannot create disk %s\n", argv[1]);
+        return 1;
+    }
+    int error = meta_format(fd, nblocks, ninodes);
+    if (error == -2) {
+        fprintf(stderr, "Error: Cannot allocate memory to format disk %s\n", argv[1]);
+        close(fd);
+        return 1;
+    }
+    if (error != 0) {
+        fprintf(stderr, "Error: Invalid geometry %ld blocks, %ld inodes\n", nblocks, ninodes);
+        close(fd);
+        return 1;
+    }
+    close(fd);
+    return 0;
+}
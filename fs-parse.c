@@ -0,0 +1,165 @@
+#include "fs-parse.h"
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+ * @brief Checks if a character separates the arguments of a command (space, newline or double quote).
+ */
+static int is_delim(char c) {
+    return c == ' ' || c == '\n' || c == '"';
+}
+
+/**
+ * @brief Reads a whole file into memory, used when the input file cannot be mapped (e.g. a pipe).
+ * Returns NULL if the memory cannot be allocated.
+ */
+static char *read_all(int fd, size_t *size) {
+    size_t cap = 4096;
+    size_t len = 0;
+    char *data = malloc(cap);
+    if (data == NULL) return NULL;
+    ssize_t n;
+    while ((n = read(fd, data + len, cap - len)) > 0) {
+        len += n;
+        if (len == cap) {
+            char *grown = realloc(data, 2 * cap);
+            if (grown == NULL) {
+                free(data);
+                return NULL;
+            }
+            data = grown;
+            cap *= 2;
+        }
+    }
+    *size = len;
+    return data;
+}
+
+int parser_init(CommandParser *parser, char *input_file) {
+    memset(parser, 0, sizeof(CommandParser));
+    parser->argv = malloc(8 * sizeof(char *));
+    if (parser->argv == NULL) return -1;
+    parser->argv_cap = 8;
+    parser->cmd.input_file = input_file;
+    return 0;
+}
+
+int parser_open(CommandParser *parser, char *input_file) {
+    if (parser_init(parser, input_file) == -1) return -1;
+    int fd = open(input_file, O_RDONLY);
+    if (fd == -1) {
+        parser_close(parser);
+        return -1;
+    }
+
+    // Map regular files (writes only touch private copies of the pages), read anything else
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            parser->data = map;
+            parser->size = st.st_size;
+            parser->mapped = 1;
+        }
+    }
+    if (!parser->mapped) parser->data = read_all(fd, &parser->size);
+    close(fd);
+    if (parser->data == NULL) {
+        parser_close(parser);
+        return -1;
+    }
+    return 0;
+}
+
+Command *parse_command(CommandParser *parser, char *line, size_t len) {
+    char *nul = memchr(line, '\0', len);
+    if (nul != NULL) len = nul - line; // The line ends at the first NUL byte like a C string
+    char *end = line + len;
+
+    Command *cmd = &parser->cmd;
+    cmd->line_num++;
+    cmd->type = NULL;
+    cmd->argv = parser->argv;
+    cmd->buff = parser->buff;
+    cmd->size = 0;
+
+    char *p = line;
+    while (p < end) {
+        while (p < end && is_delim(*p)) p++;
+        if (p == end) break;
+        char *token = p;
+        while (p < end && !is_delim(*p)) p++;
+
+        // The B command takes everything after its first 2 characters as the buffer (minus the newline)
+        if (cmd->size == 0 && p - token == 1 && *token == 'B') {
+            cmd->size = 1;
+            if (len > 2) {
+                size_t buff_len = len - 2;
+                if (line[len - 1] == '\n') buff_len--;
+                if (buff_len > 0 && buff_len <= 1024) {
+                    memset(parser->buff, 0, 1024);
+                    memcpy(parser->buff, line + 2, buff_len);
+                    cmd->size = 2;
+                }
+            }
+            *p = '\0'; // The buffer was already copied
+            parser->argv[0] = token;
+            break;
+        }
+
+        if (cmd->size == parser->argv_cap) {
+            char **grown = realloc(parser->argv, 2 * parser->argv_cap * sizeof(char *));
+            if (grown == NULL) {
+                parser->failed = 1;
+                return NULL;
+            }
+            parser->argv = grown;
+            parser->argv_cap *= 2;
+            cmd->argv = parser->argv;
+        }
+        parser->argv[cmd->size++] = token;
+        if (p < end) *p++ = '\0'; // At the end of the line the next byte already is a NUL
+    }
+    if (cmd->size != 0) cmd->type = cmd->argv[0];
+    return cmd;
+}
+
+Command *parser_next(CommandParser *parser) {
+    if (parser->pos >= parser->size) return NULL;
+
+    // Find the line, it includes its newline (a line that has none is copied so it can be terminated)
+    char *line = parser->data + parser->pos;
+    size_t avail = parser->size - parser->pos;
+    char *nl = memchr(line, '\n', avail);
+    size_t len;
+    if (nl != NULL) {
+        len = nl - line + 1;
+        parser->pos += len;
+    } else {
+        len = avail;
+        parser->pos = parser->size;
+        free(parser->tail);
+        parser->tail = malloc(len + 1);
+        if (parser->tail == NULL) {
+            parser->cmd.line_num++; // The error names the line that was not parsed
+            parser->failed = 1;
+            return NULL;
+        }
+        memcpy(parser->tail, line, len);
+        parser->tail[len] = '\0';
+        line = parser->tail;
+    }
+    return parse_command(parser, line, len);
+}
+
+void parser_close(CommandParser *parser) {
+    if (parser->mapped) munmap(parser->data, parser->size);
+    else free(parser->data);
+    free(parser->tail);
+    free(parser->argv);
+    memset(parser, 0, sizeof(CommandParser));
+}
@@ -0,0 +1,68 @@
+#ifndef FS_PARSE_H
+#define FS_PARSE_H
+
+#include "fs-sim.h"
+
+typedef struct {
+    char *data;             // Contents of the input file (private mapping, tokenized in place)
+    size_t size;            // # of bytes in data
+    int mapped;             // 1 if data is a mapping of the input file, 0 if it was read into memory
+    size_t pos;             // Offset of the next line in data
+    char *tail;             // Copy of a last line that has no newline (it cannot be terminated in place)
+    char **argv;            // Arena for the argument arrays, reused by every line
+    size_t argv_cap;        // # of entries argv can hold
+    int failed;             // 1 once a line could not be parsed for lack of memory
+    uint8_t buff[1024];     // Arena for the buffer of B commands
+    Command cmd;            // Command returned by parser_next()
+} CommandParser;
+
+/**
+ * @brief Sets up a parser with no input, for lines that are passed to parse_command() directly.
+ *
+ * @param parser - Parser to initialize
+ * @param input_file - Name error messages give for the commands it parses
+ * @return Integer value 0 if set up, -1 if its argument arena cannot be allocated
+ */
+int parser_init(CommandParser *parser, char *input_file);
+
+/**
+ * @brief Opens an input file for parsing. The file is mapped with mmap() (or read into
+ * memory if it cannot be mapped) and is tokenized in place, so parsing a line allocates nothing.
+ *
+ * @param parser - Parser to initialize
+ * @param input_file - Name of the input file
+ * @return Integer value 0 if the file was opened, -1 if it cannot be opened or read into memory
+ */
+int parser_open(CommandParser *parser, char *input_file);
+
+/**
+ * @brief Parses the next line of the input file. The returned command and its arguments
+ * are only valid until the next call.
+ *
+ * @param parser - Parser to read from
+ * @return Pointer to the parsed command, NULL at the end of the file or if the line cannot be parsed
+ * for lack of memory (failed is set)
+ */
+Command *parser_next(CommandParser *parser);
+
+/**
+ * @brief Parses one line of input in place (its delimiters are overwritten with NUL bytes). The line
+ * counts as the next line of the input for error messages. If the last argument is not followed by a
+ * delimiter, the byte after the line must be a NUL byte. The returned command and its arguments are
+ * only valid until the next call.
+ *
+ * @param parser - Parser that owns the argument arrays
+ * @param line - First character of the line
+ * @param len - # of characters in the line (including its newline, if any)
+ * @return Pointer to the parsed command, NULL if the argument arena cannot grow (failed is set)
+ */
+Command *parse_command(CommandParser *parser, char *line, size_t len);
+
+/**
+ * @brief Unmaps the input file and releases the parser's memory.
+ *
+ * @param parser - Parser to close
+ */
+void parser_close(CommandParser *parser);
+
+#endif
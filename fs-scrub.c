@@ -0,0 +1,192 @@
+#include "fs-scrub.h"
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Finds the first pending range that ends past a block (binary search).
+ */
+static int first_after(ScrubList *list, int block) {
+    int lo = 0;
+    int hi = list->count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (list->range[mid][0] + list->range[mid][1] <= block) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/**
+ * @brief Opens a slot for a new range at index r.
+ *
+ * @return Integer value 0 if inserted, -1 if the list cannot grow (the caller zeroes the range itself)
+ */
+static int insert_at(ScrubList *list, int r, int block, int count) {
+    if (list->count == list->capacity) {
+        int (*grown)[2] = realloc(list->range, 2 * list->capacity * sizeof(list->range[0]));
+        if (grown == NULL) return -1;
+        list->range = grown;
+        list->capacity *= 2;
+    }
+    memmove(&list->range[r+1], &list->range[r], (list->count - r) * sizeof(list->range[0]));
+    list->range[r][0] = block;
+    list->range[r][1] = count;
+    list->count++;
+    return 0;
+}
+
+/**
+ * @brief Removes the range at index r.
+ */
+static void remove_at(ScrubList *list, int r) {
+    memmove(&list->range[r], &list->range[r+1], (list->count - r - 1) * sizeof(list->range[0]));
+    list->count--;
+}
+
+/**
+ * @brief Takes the pending blocks of a range off the list (lock held), zeroing them first if zero is set.
+ * Waits until the background thread is not zeroing any block of the range.
+ */
+static void take_range(ScrubList *list, int block, int count, int zero) {
+    int end = block + count;
+    while (list->busy_count > 0 && list->busy_start < end && block < list->busy_start + list->busy_count) {
+        pthread_cond_wait(&list->done, &list->lock);
+    }
+    int r = first_after(list, block);
+    while (r < list->count && list->range[r][0] < end) {
+        int range_start = list->range[r][0];
+        int range_end = range_start + list->range[r][1];
+        int s = range_start > block ? range_start : block;
+        int e = range_end < end ? range_end : end;
+        if (zero) disk_zero(list->dev, s, e - s);
+        if (range_start < s && range_end > e) {
+            // The range sticks out on both sides, split it in two
+            list->range[r][1] = s - range_start;
+            if (insert_at(list, r+1, e, range_end - e) == -1) disk_zero(list->dev, e, range_end - e);
+            return;
+        }
+        if (range_start < s) {
+            list->range[r][1] = s - range_start;
+            r++;
+        } else if (range_end > e) {
+            list->range[r][0] = e;
+            list->range[r][1] = range_end - e;
+            return;
+        } else {
+            remove_at(list, r);
+        }
+    }
+}
+
+/**
+ * @brief Background thread of a list: zeroes the pending ranges front to back, SCRUB_CHUNK blocks at a time.
+ */
+static void *scrub_thread(void *arg) {
+    ScrubList *list = arg;
+    pthread_mutex_lock(&list->lock);
+    for (;;) {
+        while (!list->stop && list->count == 0) pthread_cond_wait(&list->wake, &list->lock);
+        if (list->stop) break;
+
+        // Take the front of the first range off the list and zero it without holding the lock
+        int block = list->range[0][0];
+        int count = list->range[0][1] < SCRUB_CHUNK ? list->range[0][1] : SCRUB_CHUNK;
+        list->range[0][0] += count;
+        list->range[0][1] -= count;
+        if (list->range[0][1] == 0) remove_at(list, 0);
+        list->busy_start = block;
+        list->busy_count = count;
+        pthread_mutex_unlock(&list->lock);
+        disk_scrub(list->dev, block, count);
+        pthread_mutex_lock(&list->lock);
+        list->busy_count = 0;
+        pthread_cond_broadcast(&list->done);
+    }
+    pthread_mutex_unlock(&list->lock);
+    return NULL;
+}
+
+int scrub_init(ScrubList *list, Disk *dev, int deferred) {
+    memset(list, 0, sizeof(ScrubList));
+    list->dev = dev;
+    if (!deferred) return 0;
+    list->range = malloc(16 * sizeof(list->range[0]));
+    if (list->range == NULL) return -1; // Not deferred, so scrub_destroy() has nothing to stop
+    list->capacity = 16;
+    list->deferred = 1;
+    pthread_mutex_init(&list->lock, NULL);
+    pthread_cond_init(&list->wake, NULL);
+    pthread_cond_init(&list->done, NULL);
+    pthread_create(&list->thread, NULL, scrub_thread, list);
+    return 0;
+}
+
+void scrub_destroy(ScrubList *list) {
+    if (!list->deferred) return;
+    pthread_mutex_lock(&list->lock);
+    list->stop = 1;
+    pthread_cond_signal(&list->wake);
+    pthread_mutex_unlock(&list->lock);
+    pthread_join(list->thread, NULL);
+    pthread_mutex_destroy(&list->lock);
+    pthread_cond_destroy(&list->wake);
+    pthread_cond_destroy(&list->done);
+    free(list->range);
+    list->range = NULL;
+    list->count = 0;
+    list->capacity = 0;
+}
+
+void scrub_add(ScrubList *list, int block, int count) {
+    if (count <= 0) return;
+    if (!list->deferred) {
+        disk_zero(list->dev, block, count);
+        return;
+    }
+    disk_wait(list->dev); // A queued write to the blocks must land before they are zeroed
+
+    // Freed blocks are never pending already, merge the new range with the ranges it touches
+    pthread_mutex_lock(&list->lock);
+    int r = first_after(list, block);
+    int merge_prev = r > 0 && list->range[r-1][0] + list->range[r-1][1] == block;
+    int merge_next = r < list->count && list->range[r][0] == block + count;
+    if (merge_prev && merge_next) {
+        list->range[r-1][1] += count + list->range[r][1];
+        remove_at(list, r);
+    } else if (merge_prev) {
+        list->range[r-1][1] += count;
+    } else if (merge_next) {
+        list->range[r][0] = block;
+        list->range[r][1] += count;
+    } else if (insert_at(list, r, block, count) == -1) {
+        // No room to queue the range, zero it now so freed blocks are never left unscrubbed
+        pthread_mutex_unlock(&list->lock);
+        disk_zero(list->dev, block, count);
+        return;
+    }
+    pthread_cond_signal(&list->wake);
+    pthread_mutex_unlock(&list->lock);
+}
+
+void scrub_claim(ScrubList *list, int block, int count) {
+    if (!list->deferred || count <= 0) return;
+    pthread_mutex_lock(&list->lock);
+    take_range(list, block, count, 1);
+    pthread_mutex_unlock(&list->lock);
+}
+
+void scrub_cancel(ScrubList *list, int block, int count) {
+    if (!list->deferred || count <= 0) return;
+    pthread_mutex_lock(&list->lock);
+    take_range(list, block, count, 0);
+    pthread_mutex_unlock(&list->lock);
+}
+
+void scrub_flush(ScrubList *list) {
+    if (!list->deferred) return;
+    pthread_mutex_lock(&list->lock);
+    while (list->busy_count > 0) pthread_cond_wait(&list->done, &list->lock);
+    for (int r=0; r < list->count; r++) disk_zero(list->dev, list->range[r][0], list->range[r][1]);
+    list->count = 0;
+    pthread_mutex_unlock(&list->lock);
+}
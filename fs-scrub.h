@@ -0,0 +1,84 @@
+#ifndef FS_SCRUB_H
+#define FS_SCRUB_H
+
+#include "fs-disk.h"
+#include <pthread.h>
+
+#define SCRUB_CHUNK 1024 // Most # of blocks the background thread zeroes at a time
+
+typedef struct {
+    Disk *dev;              // Virtual disk the freed blocks are on
+    int deferred;           // 1 if freed blocks are zeroed by the background thread, 0 if right away
+    int (*range)[2];        // Pending ranges sorted by first block, range[r] = { first block, # of blocks }
+    int count;              // # of pending ranges
+    int capacity;           // # of ranges the array can hold
+    int busy_start;         // First block the thread is zeroing right now (busy_count = 0 if none)
+    int busy_count;         // # of blocks the thread is zeroing right now
+    int stop;               // Set to make the thread exit
+    pthread_mutex_t lock;   // Protects everything above (not held while the thread zeroes)
+    pthread_cond_t wake;    // Signalled when a range is added or the thread has to stop
+    pthread_cond_t done;    // Signalled when the thread is done zeroing a range
+    pthread_t thread;       // Background thread that zeroes the pending ranges
+} ScrubList;
+
+extern int scrub_deferred; // If 1, blocks freed by delete and defrag are zeroed in the background
+
+/**
+ * @brief Sets up the list of freed blocks waiting to be zeroed for a virtual disk, and
+ * starts its background thread if zeroing is deferred.
+ *
+ * @param list - List to initialize
+ * @param dev - Virtual disk the freed blocks are on
+ * @param deferred - If 1 freed blocks are zeroed in the background, if 0 scrub_add() zeroes them right away
+ * @return Integer value 0 if set up, -1 if the list cannot be allocated (no thread is started)
+ */
+int scrub_init(ScrubList *list, Disk *dev, int deferred);
+
+/**
+ * @brief Stops the background thread and releases all memory held by the list. Pending blocks
+ * are NOT zeroed, call scrub_flush() first.
+ *
+ * @param list - List to release
+ */
+void scrub_destroy(ScrubList *list);
+
+/**
+ * @brief Adds freed blocks to the list, to be zeroed by the background thread. Without deferred
+ * zeroing the blocks are zeroed right away. Queued requests are waited for first, so nothing
+ * is still being written to the blocks when the thread zeroes them.
+ *
+ * @param list - List to update
+ * @param block - Index of the first freed block
+ * @param count - # of freed blocks
+ */
+void scrub_add(ScrubList *list, int block, int count);
+
+/**
+ * @brief Zeroes the pending blocks of a range that is about to be allocated, waiting for the
+ * background thread if it is zeroing any of them, so a new file always starts out zeroed.
+ *
+ * @param list - List to update
+ * @param block - Index of the first block of the range
+ * @param count - # of blocks in the range
+ */
+void scrub_claim(ScrubList *list, int block, int count);
+
+/**
+ * @brief Takes the blocks of a range that is about to be overwritten in full off the list
+ * without zeroing them, waiting for the background thread if it is zeroing any of them.
+ *
+ * @param list - List to update
+ * @param block - Index of the first block of the range
+ * @param count - # of blocks in the range
+ */
+void scrub_cancel(ScrubList *list, int block, int count);
+
+/**
+ * @brief Zeroes every pending block (sync points), so the disk image is the same as if
+ * every freed block had been zeroed right away.
+ *
+ * @param list - List to flush
+ */
+void scrub_flush(ScrubList *list);
+
+#endif
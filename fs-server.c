@@ -0,0 +1,384 @@
+#include "fs-server.h"
+#include "fs-context.h"
+#include "fs-parse.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define SERVER_READ_SIZE 65536 // # of bytes read from a socket at a time
+
+typedef struct Connection {
+    int fd;                     // Socket of the connection
+    char *socket_path;          // Path of the server socket (error messages name it as the input file)
+    CommandRunner run;          // Runs each command
+    FsStats *stats;             // Where the statistics of the connection are added up (protected by connections_lock)
+    struct Connection *next;    // Next open connection
+} Connection;
+
+static volatile sig_atomic_t server_stop = 0; // Set by SIGINT/SIGTERM
+static Connection *connections = NULL; // Open connections
+static pthread_mutex_t connections_lock = PTHREAD_MUTEX_INITIALIZER; // Protects connections
+static pthread_cond_t connections_closed = PTHREAD_COND_INITIALIZER; // Signalled every time a connection closes
+
+/**
+ * @brief Asks the server to stop accepting connections.
+ */
+static void on_stop_signal(int sig) {
+    server_stop = 1;
+}
+
+/**
+ * @brief Writes every byte to a socket.
+ *
+ * @return Integer value 0 if everything was written, -1 if the other end went away
+ */
+static int send_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL); // A client that went away must not kill the server
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Moves what a command printed to one of its streams into the reply,
+ * starting every line with the channel byte.
+ */
+static void frame_output(FILE *stream, char **data, size_t *size, char channel, FILE *reply) {
+    if (ftell(stream) == 0) return; // Most commands print nothing
+    fflush(stream);
+    size_t start = 0;
+    for (size_t i=0; i < *size; i++) {
+        if ((*data)[i] != '\n') continue;
+        fputc(channel, reply);
+        fwrite(*data + start, 1, i - start + 1, reply);
+        start = i + 1;
+    }
+    if (start < *size) {
+        // Every reply line ends with a newline, even if the output did not
+        fputc(channel, reply);
+        fwrite(*data + start, 1, *size - start, reply);
+        fputc('\n', reply);
+    }
+    rewind(stream); // The next command overwrites the stream from the start
+}
+
+/**
+ * @brief Closes the socket of a connection and takes it off the list of open connections.
+ */
+static void close_connection(Connection *conn) {
+    close(conn->fd);
+    pthread_mutex_lock(&connections_lock);
+    Connection **link = &connections;
+    while (*link != conn) link = &(*link)->next;
+    *link = conn->next;
+    pthread_cond_broadcast(&connections_closed);
+    pthread_mutex_unlock(&connections_lock);
+    free(conn);
+}
+
+/**
+ * @brief Thread of one connection. Runs every line received in a context of its own and sends the
+ * output back once all the lines it received so far have run, so a client can pipeline any number of lines.
+ */
+static void *serve_connection(void *arg) {
+    Connection *conn = arg;
+    char *out_data = NULL, *err_data = NULL, *reply_data = NULL;
+    size_t out_size = 0, err_size = 0, reply_size = 0;
+    FILE *out = open_memstream(&out_data, &out_size);
+    FILE *err = open_memstream(&err_data, &err_size);
+    FILE *reply = open_memstream(&reply_data, &reply_size);
+    FsContext *ctx = malloc(sizeof(FsContext));
+    size_t cap = SERVER_READ_SIZE;
+    size_t len = 0;
+    char *buff = malloc(cap + 1); // One more byte for the NUL after the last line
+    CommandParser parser;
+    if (out == NULL || err == NULL || reply == NULL || ctx == NULL || buff == NULL ||
+        parser_init(&parser, conn->socket_path) == -1) {
+        // Nothing has run yet, the client only sees the connection close
+        if (out != NULL) fclose(out);
+        if (err != NULL) fclose(err);
+        if (reply != NULL) fclose(reply);
+        free(out_data);
+        free(err_data);
+        free(reply_data);
+        free(ctx);
+        free(buff);
+        close_connection(conn);
+        return NULL;
+    }
+    fs_init(ctx, out, err);
+
+    int eof = 0;
+    int gone = 0;
+    while (!eof) {
+        if (len == cap) {
+            // A line longer than the buffer
+            char *grown = realloc(buff, 2 * cap + 1);
+            if (grown == NULL) {
+                fprintf(err, "Error: Cannot allocate memory to read a line from %s\n", conn->socket_path);
+                len = 0; // The line is dropped and the connection closed
+                eof = 1;
+            } else {
+                buff = grown;
+                cap *= 2;
+            }
+        }
+        if (!eof) {
+            ssize_t n = recv(conn->fd, buff + len, cap - len, 0);
+            if (n == -1 && errno == EINTR) continue;
+            if (n <= 0) eof = 1;
+            else len += n;
+        }
+        buff[len] = '\0';
+
+        // Run every complete line, and the last line once the client is done sending
+        size_t pos = 0;
+        while (pos < len) {
+            char *line = buff + pos;
+            char *nl = memchr(line, '\n', len - pos);
+            size_t line_len;
+            if (nl != NULL) line_len = nl - line + 1;
+            else if (eof) line_len = len - pos;
+            else break;
+
+            long start = stats_now();
+            Command *cmd = parse_command(&parser, line, line_len);
+            if (cmd == NULL) {
+                fprintf(err, "Error: Cannot allocate memory to parse line %zu of %s\n", parser.cmd.line_num, conn->socket_path);
+                pos = len; // The rest of the input is dropped and the connection closed
+                eof = 1;
+                break;
+            }
+            long parsed = stats_now();
+            stats_record(&ctx->stats.parse, parsed - start);
+            conn->run(ctx, cmd, parsed);
+            frame_output(out, &out_data, &out_size, '1', reply);
+            frame_output(err, &err_data, &err_size, '2', reply);
+            pos += line_len;
+        }
+        memmove(buff, buff + pos, len - pos);
+        len -= pos;
+
+        if (eof) {
+            fs_unmount(ctx); // End of the script is a sync point (the mount itself stays loaded)
+            frame_output(out, &out_data, &out_size, '1', reply);
+            frame_output(err, &err_data, &err_size, '2', reply);
+        }
+        fflush(reply);
+        if (!gone && reply_size > 0 && send_all(conn->fd, reply_data, reply_size) == -1) gone = 1;
+        rewind(reply);
+    }
+
+    pthread_mutex_lock(&connections_lock);
+    stats_merge(conn->stats, &ctx->stats);
+    pthread_mutex_unlock(&connections_lock);
+
+    free(buff);
+    parser_close(&parser);
+    fs_destroy(ctx);
+    free(ctx);
+    fclose(out);
+    fclose(err);
+    fclose(reply);
+    free(out_data);
+    free(err_data);
+    free(reply_data);
+    close_connection(conn);
+    return NULL;
+}
+
+int server_run(char *socket_path, CommandRunner run, FsStats *stats) {
+    // Every connection shares the mounts, and they stay warm between connections
+    disk_shared = 1;
+    disk_keep_mounted = 1;
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) return 1;
+    strcpy(addr.sun_path, socket_path);
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd == -1) return 1;
+    unlink(socket_path); // Replace the socket of a server that is not running any more
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(listen_fd, 64) == -1) {
+        close(listen_fd);
+        return 1;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_stop_signal; // No SA_RESTART, so the signal interrupts poll()
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    while (!server_stop) {
+        // Wake up every second in case the signal was delivered to a connection thread
+        struct pollfd pfd = { listen_fd, POLLIN, 0 };
+        if (poll(&pfd, 1, 1000) <= 0) continue;
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd == -1) continue;
+
+        Connection *conn = malloc(sizeof(Connection));
+        if (conn == NULL) {
+            close(fd);
+            continue;
+        }
+        conn->fd = fd;
+        conn->socket_path = socket_path;
+        conn->run = run;
+        conn->stats = stats;
+        pthread_mutex_lock(&connections_lock);
+        conn->next = connections;
+        connections = conn;
+        pthread_mutex_unlock(&connections_lock);
+
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, serve_connection, conn) != 0) {
+            close_connection(conn); // No thread would ever take it off the list
+            continue;
+        }
+        pthread_detach(thread);
+    }
+    close(listen_fd);
+    unlink(socket_path);
+
+    // Stop reading from every open connection, each runs what it already received, syncs and closes
+    pthread_mutex_lock(&connections_lock);
+    for (Connection *conn = connections; conn != NULL; conn = conn->next) shutdown(conn->fd, SHUT_RD);
+    while (connections != NULL) pthread_cond_wait(&connections_closed, &connections_lock);
+    pthread_mutex_unlock(&connections_lock);
+    fs_release_kept_mounts(stats);
+    return 0;
+}
+
+/**
+ * @brief Prints reply data to stdout or stderr by the channel byte at the start of each line.
+ *
+ * @param data - Reply data received
+ * @param len - # of bytes received
+ * @param channel - Channel of the line being printed, 0 at the start of a line (kept between calls)
+ */
+static void print_reply(const char *data, size_t len, char *channel) {
+    size_t i = 0;
+    while (i < len) {
+        if (*channel == 0) {
+            *channel = data[i++];
+            continue;
+        }
+        const char *nl = memchr(data + i, '\n', len - i);
+        size_t end = nl != NULL ? (size_t)(nl - data) + 1 : len;
+        fwrite(data + i, 1, end - i, *channel == '2' ? stderr : stdout);
+        if (nl != NULL) *channel = 0;
+        i = end;
+    }
+}
+
+/**
+ * @brief Sends one input file over a new connection and prints the replies until the server closes it.
+ *
+ * @return Integer value 0 if the file was run, -1 if the server cannot be reached (or the reply buffer cannot be allocated)
+ */
+static int run_remote(char *socket_path, char *data, size_t size) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) return -1;
+    strcpy(addr.sun_path, socket_path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1) return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    // Send while reading, the server may block on its replies before it reads the rest of the file
+    char *buff = malloc(SERVER_READ_SIZE);
+    if (buff == NULL) {
+        close(fd);
+        return -1;
+    }
+    char channel = 0;
+    size_t sent = 0;
+    int sending = 1;
+    if (size == 0) {
+        shutdown(fd, SHUT_WR);
+        sending = 0;
+    }
+    for (;;) {
+        struct pollfd pfd = { fd, POLLIN | (sending ? POLLOUT : 0), 0 };
+        if (poll(&pfd, 1, -1) == -1) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (sending && (pfd.revents & POLLOUT)) {
+            ssize_t n = send(fd, data + sent, size - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (n > 0) sent += n;
+            if (n == -1 && errno != EAGAIN && errno != EINTR) sending = 0;
+            if (sent == size) {
+                shutdown(fd, SHUT_WR); // Tells the server the script is complete
+                sending = 0;
+            }
+        }
+        if (pfd.revents & (POLLIN | POLLHUP | POLLERR)) {
+            ssize_t n = recv(fd, buff, SERVER_READ_SIZE, 0);
+            if (n == -1 && errno == EINTR) continue;
+            if (n <= 0) break;
+            print_reply(buff, n, &channel);
+        }
+    }
+    fflush(stdout);
+    free(buff);
+    close(fd);
+    return 0;
+}
+
+int client_run(char *socket_path, char **input_files, int num_of_scripts) {
+    int ret = 0;
+    for (int i=0; i < num_of_scripts; i++) {
+        int fd = open(input_files[i], O_RDONLY);
+        if (fd == -1) {
+            ret = 1;
+            continue;
+        }
+        size_t cap = 4096;
+        size_t size = 0;
+        char *data = malloc(cap);
+        ssize_t n = data == NULL ? -1 : 0;
+        while (data != NULL && (n = read(fd, data + size, cap - size)) > 0) {
+            size += n;
+            if (size == cap) {
+                char *grown = realloc(data, 2 * cap);
+                if (grown == NULL) {
+                    n = -1;
+                    break;
+                }
+                data = grown;
+                cap *= 2;
+            }
+        }
+        close(fd);
+        if (n == -1) {
+            free(data); // The file cannot be read whole
+            ret = 1;
+            continue;
+        }
+        int status = run_remote(socket_path, data, size);
+        free(data);
+        if (status == -1) return 1;
+    }
+    return ret;
+}
@@ -0,0 +1,38 @@
+#ifndef FS_SERVER_H
+#define FS_SERVER_H
+
+#include "fs-sim.h"
+#include "fs-stats.h"
+
+// Runs one parsed command in a context (see runCommand() in fs-main.c), start is when it was parsed
+// and the return value is when it finished (stats_now())
+typedef long (*CommandRunner)(FsContext *ctx, Command *cmd, long start);
+
+/**
+ * @brief Serves command lines over a Unix domain socket until SIGINT or SIGTERM. Every connection
+ * runs like an input file in its own context on its own thread: lines are run in the order they
+ * arrive, and their output is sent back as lines that start with '1' (ls output) or '2' (error
+ * messages). When the client closes its end, the pending changes are synced and the connection is
+ * closed. Disks stay mounted between connections (disk_shared and disk_keep_mounted are turned on)
+ * until the server stops.
+ *
+ * @param socket_path - Path to create the socket at (an old socket there is replaced)
+ * @param run - Function that runs each command
+ * @param stats - Where the statistics of every connection are added up when it closes
+ * @return Integer value 0 after a clean shutdown, 1 if the socket cannot be created
+ */
+int server_run(char *socket_path, CommandRunner run, FsStats *stats);
+
+/**
+ * @brief Sends input files to a server one after the other, each on its own connection, and prints
+ * the output of each to stdout and stderr. The whole file is sent without waiting for replies
+ * (pipelined), while the replies are read as they arrive.
+ *
+ * @param socket_path - Path of the server socket
+ * @param input_files - Names of the input files
+ * @param num_of_scripts - # of input files
+ * @return Integer value 0 if every file was run, 1 if an input file cannot be opened or read whole or the server cannot be reached
+ */
+int client_run(char *socket_path, char **input_files, int num_of_scripts);
+
+#endif
@@ -1,23 +1,137 @@
+#define _GNU_SOURCE // pthread_rwlockattr_setkind_np()
 #include "fs-sim.h"
+#include "fs-context.h"
 #include <stdio.h>
 #include <fcntl.h>
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 
-// GLOBAL VARIABLES
-int vd = -1; // Initialize file descriptor for the virtual disk
-int cwd; // Current working directory of mounted file system
-char *disk_name = NULL; // Name of current mounted disk
-uint8_t fs_buffer[1024]; // File system buffer
-Superblock *sb = NULL; // Superblock of current virtual disk
+// GLOBAL VARIABLES (options shared by every context, only set before any script runs)
+int sb_writeback = 0; // If 1, superblock changes are held in memory until a sync point
+int sb_sync_every = 0; // In write-back mode, sync after this many mutations (0 = only at sync points)
+int check_timing_report = 0; // If 1, fs_mount prints the consistency check timing to stderr
+int disk_use_mmap = 0; // If 1, mounted disks are accessed through mmap() instead of pread/pwrite
+int disk_ring_depth = 0; // If > 0, single block reads and writes are queued on an io_uring of this depth
+int cache_blocks = 0; // # of blocks the block cache holds for each mounted disk (0 = disabled)
+int disk_shared = 0; // If 1, every context that mounts the same disk image shares one thread-safe mount
+int scrub_deferred = 0; // If 1, blocks freed by delete and defrag are zeroed in the background
+int alloc_policy = ALLOC_FIRST_FIT; // Policy new files get their blocks by in every context (changed per script with the A command)
+int defrag_blocks = 0; // If > 0, a background thread defrags every mounted disk, moving at most this many blocks per step
+int disk_keep_mounted = 0; // If 1 (daemon mode), shared mounts stay loaded after their last user leaves
+int journal_enabled = 0; // If 1, metadata changes of every mounted disk are committed through a journal
+int journal_batch = 0; // Journaled disks: group commit after this many metadata changes (0 = by time and at sync points)
+int journal_interval_ms = JOURNAL_INTERVAL_MS; // Journaled disks: group commit the pending changes this often (0 = by count and at sync points)
+
+FsMount *shared_mounts = NULL; // Shared mounts in use (disk_shared mode)
+pthread_mutex_t shared_mounts_lock = PTHREAD_MUTEX_INITIALIZER; // Protects shared_mounts and the user counts
+
+/**
+ * @brief Sets up a context with no disk mounted and a zeroed buffer.
+ * 
+ * @param ctx - Context to initialize
+ * @param out - Stream that ls output is printed to
+ * @param err - Stream that error messages are printed to
+ */
+void fs_init(FsContext *ctx, FILE *out, FILE *err) {
+    memset(ctx, 0, sizeof(FsContext));
+    ctx->mnt = NULL;
+    ctx->buffer_zero = 1;
+    ctx->alloc_policy = alloc_policy;
+    ctx->out = out;
+    ctx->err = err;
+}
+
+/**
+ * @brief Releases the memory held by a context (its disk must be unmounted first).
+ * 
+ * @param ctx - Context to release
+ */
+void fs_destroy(FsContext *ctx) {
+    free(ctx->range_buffer);
+    ctx->range_buffer = NULL;
+    ctx->range_capacity = 0;
+    ctx->range_blocks = 0;
+}
+
+/**
+ * @brief Takes the lock of a shared mount, for reading (lookups and data blocks) or for writing
+ * (metadata changes). A private mount is only used by one context and is never locked, unless a
+ * background thread (defrag or group commit) uses it too. If another context deleted the cwd, the cwd
+ * falls back to the root directory (also when the inode was reused since, its generation changed).
+ * 
+ * @param ctx - Context that is about to use its mount
+ * @param write - If 1 lock for writing, if 0 lock for reading
+ */
+void lock_mount(FsContext *ctx, int write) {
+    FsMount *mnt = ctx->mnt;
+    if (!mnt->locked) return;
+    if (write) pthread_rwlock_wrlock(&mnt->lock);
+    else pthread_rwlock_rdlock(&mnt->lock);
+    if (ctx->cwd != mnt->meta.root && alloc_inode_generation(&mnt->allocator, ctx->cwd) != ctx->cwd_gen) {
+        ctx->cwd = mnt->meta.root;
+    }
+}
+
+/**
+ * @brief Releases the lock taken by lock_mount().
+ */
+void unlock_mount(FsContext *ctx) {
+    if (ctx->mnt->locked) pthread_rwlock_unlock(&ctx->mnt->lock);
+}
 
 /**
- * @brief Writes current superblock in memory to the virtual disk
+ * @brief Locks the blocks of a file of a shared mount (the mount must be read locked), so block
+ * reads and writes of the same file do not interleave while other files are used in parallel.
+ * 
+ * @param mnt - Mount the file is on
+ * @param inode_idx - Index of the inode of the file
+ * @param lock - If 1 lock the file, if 0 unlock it
+ */
+void lock_file(FsMount *mnt, int inode_idx, int lock) {
+    if (!mnt->shared) return;
+    pthread_mutex_t *file_lock = &mnt->file_lock[inode_idx % MOUNT_INODE_LOCKS];
+    if (lock) pthread_mutex_lock(file_lock);
+    else pthread_mutex_unlock(file_lock);
+}
+
+/**
+ * @brief Writes the changed metadata blocks of the current superblock in memory to the virtual disk.
+ * A journaled disk commits them to its journal first (see journal_commit()), so they are written in
+ * place only once a crash can no longer leave the image with part of them.
  */
-void write_superblock() {
-    lseek(vd, 0, SEEK_SET);
-    write(vd, sb, 1024);
+void write_superblock(FsMount *mnt) {
+    long start = stats_now();
+    if (mnt->journal.fd != -1) {
+        if (mnt->journal.ordered) cache_flush(&mnt->block_cache); // Data the commit points to goes out first
+        journal_commit(&mnt->journal, &mnt->meta); // If it cannot be journaled the change is written in place alone
+    }
+    meta_write(&mnt->meta, &mnt->disk);
+    stats_record(&mnt->sb_write, stats_now() - start);
+    mnt->sb_dirty = 0;
+    mnt->sb_mutations = 0;
+}
+
+/**
+ * @brief Records a change to the superblock in memory. In write-through mode (the default) the
+ * superblock is written to the virtual disk right away, in write-back mode it is only marked dirty
+ * and written at the next sync point or after sb_sync_every changes. A journaled disk groups its
+ * changes the same way, committing after journal_batch changes (or when the commit thread runs).
+ */
+void mark_superblock_dirty(FsMount *mnt) {
+    int journaled = (mnt->journal.fd != -1);
+    if (!sb_writeback && !journaled) {
+        write_superblock(mnt);
+        return;
+    }
+    mnt->sb_dirty = 1;
+    mnt->sb_mutations++;
+    int sync_every = journaled ? journal_batch : sb_sync_every;
+    if (sync_every > 0 && mnt->sb_mutations >= sync_every) write_superblock(mnt);
 }
 
 /**
@@ -26,18 +140,9 @@ void write_superblock() {
  * @param name - Name to perform check on
  * @return Integer value index of the inode if it exists, -1 otherwise
  */
-int file_exists(char name[5]) {
-    for (size_t i=0; i < 126; i++) {
-        Inode *inode_temp = &sb->inode[i];
-        uint8_t isused_temp = inode_temp->isused_size & (1 << 7);
-        uint8_t parent_temp = inode_temp->isdir_parent & ~(1 << 7);
-        uint8_t isdir = inode_temp->isdir_parent & (1 << 7);
-        // If current inode shares the same name and parent directory, return true
-        if ((isused_temp) && (memcmp(name,inode_temp->name,5) == 0) && (parent_temp == cwd)) {
-            return i;
-        }
-    }
-    return -1; // No file with given name exists in the cwd
+int file_exists(FsContext *ctx, char name[5]) {
+    ctx->stats.lookups++;
+    return index_lookup(&ctx->mnt->name_index, ctx->cwd, name);
 }
 
 /**
@@ -47,340 +152,859 @@ int file_exists(char name[5]) {
  * @param size - Size of the block array to update
  * @param set - If 1 set bits to 1, if 0 set bits to 0
  */
-void set_fbl_bits(int start_idx, int size, int set) {
-    for (int i=start_idx; i < start_idx+size; i++) {
-        if (i == 0) continue;   // skip super block bit
-        int byte = i / 8;
-        int bit  = 7 - (i % 8);
-        if (set)
-            sb->free_block_list[byte] |=  (1 << bit);
-        else
-            sb->free_block_list[byte] &= ~(1 << bit);
-    }
+void set_fbl_bits(FsMount *mnt, int start_idx, int size, int set) {
+    meta_set_blocks(&mnt->meta, start_idx, size, set); // Metadata block bits are skipped
+    alloc_mark_blocks(&mnt->allocator, start_idx, size, set); // Keep the extent index in sync
+}
+
+/**
+ * @brief Compares two extents (start block, size pairs) by start block for qsort.
+ */
+int compare_extent(const void *a, const void *b) {
+    return ((const int *)a)[0] - ((const int *)b)[0];
+}
+
+/**
+ * @brief Tells the background defrag thread of a mount (write locked) that blocks were freed.
+ */
+static void wake_defrag(FsMount *mnt) {
+    if (!mnt->defrag_running) return;
+    pthread_mutex_lock(&mnt->defrag_lock);
+    mnt->defrag_idle = 0;
+    pthread_cond_signal(&mnt->defrag_wake);
+    pthread_mutex_unlock(&mnt->defrag_lock);
 }
 
 /**
- * @brief deletes files and directories. If inode is directory, recursively delete all files in the directory.
+ * @brief deletes files and directories. If inode is directory, all files and directories inside it
+ * are deleted too. The subtree is collected first so that the freed blocks can be zeroed out as
+ * merged contiguous ranges and the bitmap and inodes can be cleared in bulk.
  * 
  * @param inode_idx - Index of the Inode of the file or directory to be deleted
+ * @return Integer value 0 if deleted, -1 if the memory to collect the subtree cannot be allocated (nothing is deleted)
  */
-void delete_file(int inode_idx) {
-    // Get inode to be deleted
-    //printf("deleteing inode: %d\n", inode_idx); // TESTING PRINT STATEMENT
-    Inode *inode = &sb->inode[inode_idx];
-    uint8_t size = inode->isused_size & ~(1 << 7);
-    uint8_t start_block = inode->start_block;
-    uint8_t isdir = inode->isdir_parent & (1 << 7);
-    uint8_t parent = inode->isdir_parent & ~(1 << 7);
-
-    // Zero buffer
-    uint8_t zero_buff[1024] = {0};
+int delete_file(FsMount *mnt, int inode_idx) {
+    // Collect the subtree rooted at the inode (parents always come before their children)
+    int *nodes = malloc(mnt->meta.ninodes * sizeof(int));
+    if (nodes == NULL) return -1;
+    int num_of_nodes = 0;
+    nodes[num_of_nodes++] = inode_idx;
+    for (int n=0; n < num_of_nodes; n++) {
+        for (int c = mnt->dir_tree.first_child[nodes[n]]; c != -1; c = mnt->dir_tree.next_sibling[c]) {
+            nodes[num_of_nodes++] = c;
+        }
+    }
 
-    if (isdir) {
-        // DIRECTORY
-        // Delete all files in the directory
-        for (size_t i=0; i < 126; i++) {
-            if (i == inode_idx) continue; // Skip the current directory inode
-            if ((sb->inode[i].isused_size & (1 << 7)) && ((sb->inode[i].isdir_parent & ~(1 << 7)) == inode_idx)) {
-                delete_file(i);
-            }
+    // Collect the extents of every file in the subtree and merge the ones that touch
+    int (*extents)[2] = malloc(num_of_nodes * sizeof(extents[0]));
+    if (extents == NULL) {
+        free(nodes);
+        return -1;
+    }
+    int num_of_extents = 0;
+    for (int n=0; n < num_of_nodes; n++) {
+        FsInode *inode = &mnt->meta.inode[nodes[n]];
+        if (inode->flags & INODE_DIR) continue; // Directories have no blocks
+        extents[num_of_extents][0] = inode->start_block;
+        extents[num_of_extents][1] = inode->size;
+        num_of_extents++;
+    }
+    qsort(extents, num_of_extents, sizeof(extents[0]), compare_extent);
+    int num_of_ranges = 0;
+    for (int e=0; e < num_of_extents; e++) {
+        if (num_of_ranges > 0 && extents[num_of_ranges-1][0] + extents[num_of_ranges-1][1] == extents[e][0]) {
+            extents[num_of_ranges-1][1] += extents[e][1];
+        } else {
+            extents[num_of_ranges][0] = extents[e][0];
+            extents[num_of_ranges][1] = extents[e][1];
+            num_of_ranges++;
         }
-    } else {
-        // FILE
-        lseek(vd, (1024)*start_block, SEEK_SET); // Move virtual disk position to start block
-        for (size_t i=0; i < size; i ++) write(vd, zero_buff, 1024); // Zero out all blocks
-        set_fbl_bits(start_block, size, 0); // "Un"set bits in free block array
     }
 
-    // Zero out Inode in superblock struct
-    for (size_t i=0; i < 5; i++) inode->name[i] = 0;
-    inode->isused_size = 0;
-    inode->start_block = 0;
-    inode->isdir_parent = 0;
+    // Zero out each range with a single write (or leave it to the background thread) and "un"set its bits
+    // in the free block array
+    for (int r=0; r < num_of_ranges; r++) {
+        cache_invalidate(&mnt->block_cache, extents[r][0], extents[r][1]); // Cached data is being zeroed
+        scrub_add(&mnt->scrub, extents[r][0], extents[r][1]);
+        set_fbl_bits(mnt, extents[r][0], extents[r][1], 0);
+    }
 
-    return;
+    // Zero out the Inodes in the inode table, children before their parents
+    for (int n = num_of_nodes - 1; n >= 0; n--) {
+        FsInode *inode = &mnt->meta.inode[nodes[n]];
+        index_remove(&mnt->name_index, nodes[n]); // Must happen while the name and parent are still set
+        if (!(inode->flags & INODE_DIR)) start_index_remove(&mnt->start_index, nodes[n]);
+        tree_remove(&mnt->dir_tree, nodes[n]);
+        memset(inode, 0, sizeof(FsInode));
+        meta_mark_inode(&mnt->meta, nodes[n]);
+        alloc_release_inode(&mnt->allocator, nodes[n]); // Inode can be reused by fs_create
+    }
+    if (num_of_ranges > 0) wake_defrag(mnt); // The freed blocks may leave files to move
+
+    free(nodes);
+    free(extents);
+    return 0;
+}
+
+/**
+ * @brief Gets the time elapsed since a starting point in nanoseconds.
+ * 
+ * @param start - Starting point taken with clock_gettime(CLOCK_MONOTONIC)
+ * @return Elapsed time in nanoseconds
+ */
+long elapsed_ns(struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000000000L + (now.tv_nsec - start->tv_nsec);
 }
 
 /**
- * @brief checks the consitency of the current virtual disk
+ * @brief checks the consitency of a virtual disk. Rules 1-4 are checked in a single pass
+ * over the inodes (which also builds the block map for rule 6), rule 5 uses a hash set of
+ * (parent, name) keys. The time spent in each phase is stored in check_timing.
  * 
- * @param super_block - pointer to superblock to perform a consitency check on
- * @return Integer value that corresponds to the smallest error code encountered
+ * @param m - pointer to the metadata to perform a consitency check on
+ * @return Integer value that corresponds to the smallest error code encountered, -1 if the memory
+ * of the check cannot be allocated
  */
-int consistency_check(Superblock *super_block) {
-    int alloced_blocks[128]; // Array of 1s and 0s to track which blocks are allocated by inodes
+int consistency_check(FsContext *ctx, FsMeta *m) {
+    struct timespec start, phase;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ctx->check_timing.rules_1_4_ns = ctx->check_timing.rule_5_ns = ctx->check_timing.rule_6_ns = 0;
+
+    uint8_t *alloced_blocks = calloc(m->nblocks, 1); // Array of 1s and 0s to track which blocks are allocated by inodes
+    if (alloced_blocks == NULL) {
+        ctx->check_timing.total_ns = elapsed_ns(&start);
+        return -1;
+    }
     int fbl_error = 0;
-    for (size_t i=0; i < 128; i++) alloced_blocks[i] = 0;
+    int error = 0; // Smallest error code found so far (0 if none)
+    long last_block = m->nblocks - 1;
 
-    // 1. If the state of an inode is free, then all bits in this inode must be zero. Otherwise, the name attribute
-    // stored in the inode must start with a nonzero byte.
-    for (size_t i=0; i < 126; ++i) {
+    // Single pass for rules 1-4, rule 6 only needs the block map built here
+    for (int i=0; i < m->ninodes; ++i) {
         // get inode properties
-        Inode *inode = &super_block->inode[i];
-        uint8_t isused = inode->isused_size & (1 << 7);
-        uint8_t size = inode->isused_size & ~(1 << 7);
-        uint8_t start_block = inode->start_block;
-        uint8_t isdir = inode->isdir_parent & (1 << 7);
-        uint8_t parent = inode->isdir_parent & ~(1 << 7);
-
-        // check if inode is used
-        if (isused) {
-            // IN USE
-            if ((uint8_t)inode->name[0] == 0) return 1; // inode is in use and name is invalid
-        } else {
-            // FREE
-            for (size_t k=0; k < 5; k++){
-                if ((uint8_t)inode->name[k] != 0) return 1;
+        FsInode *inode = &m->inode[i];
+        int isused = inode->flags & INODE_USED;
+        long size = inode->size;
+        long start_block = inode->start_block;
+        int isdir = inode->flags & INODE_DIR;
+        long parent = inode->parent;
+        int code = 0; // Smallest rule this inode breaks
+
+        if (!isused) {
+            // 1. If the state of an inode is free, then all bits in this inode must be zero.
+            uint32_t bits = inode->flags | inode->size | inode->start_block | inode->parent;
+            for (size_t k=0; k < 5; k++) bits |= (uint8_t)inode->name[k];
+            if (bits != 0) code = 1;
+        } else if ((uint8_t)inode->name[0] == 0 || (inode->flags & ~(INODE_USED | INODE_DIR))) {
+            // 1. Otherwise, the name attribute stored in the inode must start with a nonzero byte.
+            code = 1;
+        } else if (!isdir && (start_block < m->data_start || start_block > last_block || (start_block + (size - 1)) > last_block)) {
+            // 2. The start block and last block of every file must be data blocks (between 1 and 127 inclusive on v1).
+            code = 2;
+        } else if (isdir && (size != 0 || start_block != 0)) {
+            // 3. The size and start block of a directory must be zero.
+            code = 3;
+        } else if (i == parent || (parent != m->root && parent >= m->ninodes)) {
+            // 4. The parent inode index cannot be the inode's own index and must be an inode or the root (126 is invalid on v1).
+            code = 4;
+        } else if (parent < m->ninodes && (!(m->inode[parent].flags & INODE_USED) ||
+                                           !(m->inode[parent].flags & INODE_DIR))) {
+            // 4. A parent inode that is not the root must be in use and marked as a directory.
+            code = 4;
+        }
+        if (code != 0 && (error == 0 || code < error)) error = code;
+
+        // Updated alloced_blocks list when blocks of file within valid range
+        if (isused && !isdir && code != 1 && code != 2) { // Range was checked by rule 2
+            for (long k=start_block; k < start_block + size; k++) {
+                if (alloced_blocks[k]) fbl_error = 1; // Block is allocated to more than one file
+                alloced_blocks[k] = 1;
             }
-            if (inode->isused_size != 0) return 1;
-            if (inode->start_block != 0) return 1;
-            if (inode->isdir_parent != 0) return 1;
         }
+        if (error == 1) break; // Nothing smaller can be found
     }
+    ctx->check_timing.rules_1_4_ns = elapsed_ns(&start);
 
-    // 2. The start block of every inode that is in use and pertains to a file (i.e. when the isdir bit is not set)
-    // must have a value between 1 and 127 inclusive. Moreover, the size of every inode that is in use and
-    // pertains to a file must be such that its last block is also between 1 and 127.
-    for (size_t i=0; i < 126; ++i) {
-        // get inode properties
-        Inode *inode = &super_block->inode[i];
-        uint8_t isused = inode->isused_size & (1 << 7);
-        uint8_t size = inode->isused_size & ~(1 << 7);
-        uint8_t start_block = inode->start_block;
-        uint8_t isdir = inode->isdir_parent & (1 << 7);
-
-        // check if inode is used
-        if (isused) {
-            // IN USE
-            // Check if inode pertains to a file
-            if (!isdir) {
-                // FILE
-                if (start_block < 1 || start_block > 127) return 2; // Start block index out of range
-                if ((start_block + (size - 1)) > 127) return 2; // End block index out of range
-                // Updated alloced_blocks list when blocks of file within valid range
-                for (size_t k=start_block; k < start_block + size; k++) {
-                    if (alloced_blocks[k] == 1) {
-                        fbl_error = 1; // Block is allocated to more than one file
-                    } else {
-                        alloced_blocks[k] = 1;
-                    }
-            }
-            }       
+    // 5. The name of every file/directory must be unique in each directory (names do not need to be unique
+    // across the entire file system).
+    if (error == 0) {
+        clock_gettime(CLOCK_MONOTONIC, &phase);
+        NameIndex names;
+        if (index_create(&names, m) == -1) error = -1;
+        for (int i=0; i < m->ninodes && error == 0; i++) {
+            FsInode *inode = &m->inode[i];
+            if (!(inode->flags & INODE_USED)) continue;
+            if (index_lookup(&names, inode->parent, inode->name) != -1) error = 5;
+            else index_insert(&names, i);
         }
+        index_destroy(&names);
+        ctx->check_timing.rule_5_ns = elapsed_ns(&phase);
     }
 
-    // 3. The size and start block of an inode pertaining to a directory (i.e. the directory bit is set) must
-    // be zero.
-    for (size_t i=0; i < 126; ++i) {
-        // get inode properties
-        Inode *inode = &super_block->inode[i];
-        uint8_t isused = inode->isused_size & (1 << 7);
-        uint8_t size = inode->isused_size & ~(1 << 7);
-        uint8_t start_block = inode->start_block;
-        uint8_t isdir = inode->isdir_parent & (1 << 7);
-
-        // check if inode is used
-        if (isused) {
-            // Check if inode pertains to a directory
-            if (isdir) {
-                // DIRECTORY
-                if (size != 0 || start_block != 0) return 3; // Directory size and/or start_block is not 0
+    // 6. Blocks that are marked free in the free-space list cannot be allocated to any file. Similarly, blocks that
+    // are marked in use in the free-space list must be allocated to exactly one file
+    if (error == 0) {
+        clock_gettime(CLOCK_MONOTONIC, &phase);
+        if (fbl_error) error = 6;
+        for (int i=m->data_start; i < m->nblocks && error == 0; i++) {
+            // Block is marked as free in fbl but is used by inode
+            if (alloced_blocks[i] && !meta_block_used(m, i)) error = 6;
+        }
+        if (m->version == 2) {
+            // v2 metadata blocks must be marked used and the summary in block 0 must match the free block list
+            for (int i=0; i < m->data_start && error == 0; i++) {
+                if (!meta_block_used(m, i)) error = 6;
+            }
+            for (int bb=0; bb < m->bitmap_blocks && error == 0; bb++) {
+                int bit = (m->summary[bb / 8] >> (7 - bb % 8)) & 1;
+                if (bit != meta_summary_bit(m, bb)) error = 6;
             }
         }
+        ctx->check_timing.rule_6_ns = elapsed_ns(&phase);
     }
 
-    // 4. For every inode that is in use, the index of its parent inode cannot be the same as its own index and
-    // cannot be 126. Moreover, if the index of the parent inode is between 0 and 125 inclusive, then the
-    // parent inode must be in use and marked as a directory.    
-    for (size_t i=0; i < 126; ++i) {
-        // get inode properties
-        Inode *inode = &super_block->inode[i];
-        uint8_t isused = inode->isused_size & (1 << 7);
-        uint8_t parent = inode->isdir_parent & ~(1 << 7);
-
-        // check if inode is used
-        if (isused) {
-            if (i == parent || parent == 126) return 4; // inode idx = parent idx OR parent idx = 126
-            if (parent >= 0 && parent <= 125) {
-                Inode *parent_node = &super_block->inode[parent];
-                if (!(parent_node->isused_size & (1 << 7))) return 4; // parent inode not in use
-                if (!(parent_node->isdir_parent & (1 << 7))) return 4; // parent inode not directory
-            }
+    free(alloced_blocks);
+    ctx->check_timing.total_ns = elapsed_ns(&start);
+    return error;
+}
+
+/**
+ * @brief Writes every dirty cached block and the superblock of a mount to its virtual disk.
+ */
+void sync_mount(FsMount *mnt) {
+    cache_flush(&mnt->block_cache); // Data blocks go out before the metadata that points to them
+    scrub_flush(&mnt->scrub); // Freed blocks are zeroed before the metadata that frees them
+    if (mnt->sb_dirty) write_superblock(mnt);
+    disk_sync(&mnt->disk);
+}
+
+/**
+ * @brief Records the modification time and size of the image of a kept mount (shared_mounts_lock held),
+ * so fs_mount() can tell if anything else changed the image since.
+ */
+static void remember_image(FsMount *mnt) {
+    struct stat st;
+    fstat(mnt->disk.fd, &st);
+    mnt->mtime = st.st_mtim;
+    mnt->size = st.st_size;
+}
+
+/**
+ * @brief Runs one defrag step on a mount (write locked), see fs_defrag(). The files past the first
+ * free block are moved down in start block order, the old blocks that no moved file overwrote are
+ * zeroed, and the free block list and the inodes of the moved files are committed once at the end.
+ * The next file to move is the one that starts at the next used block of the extent tree (found
+ * through the start block index), so a step only looks at the files it moves.
+ *
+ * @return Long value # of blocks moved, 0 if no file is past the first free block
+ */
+static long defrag_step(FsMount *mnt, long max_blocks, long max_us) {
+    long start_ns = stats_now();
+
+    // Every block below the first free block is packed already, so that is where the step starts
+    int first_free = alloc_first_free(&mnt->allocator);
+    if (first_free == -1) return 0;
+    int block = alloc_next_used(&mnt->allocator, first_free);
+    if (block == -1) return 0; // No free holes between used blocks
+
+    // Move each file down to the end of the packed blocks with one read and one write, until the budget
+    // runs out. Files only move down and in start block order, so the blocks of a file are never
+    // overwritten before the file has been moved. The extent tree is only updated at the end, so the
+    // used blocks past the first free one are still the old blocks of the files.
+    int *files = NULL; // Inode indexes of the moved files, in start block order
+    int capacity = 0;
+    cache_flush(&mnt->block_cache); // The disk is changed directly below
+    int next_free = first_free;
+    long moved = 0;
+    int num_of_moved = 0;
+    for (; block != -1; block = alloc_next_used(&mnt->allocator, block)) {
+        int idx = start_index_lookup(&mnt->start_index, block);
+        if (idx == -1) break; // Only on an inconsistent disk, a used data block past a file starts the next file
+        FsInode *inode = &mnt->meta.inode[idx];
+        if (num_of_moved > 0 && ((max_blocks > 0 && moved + inode->size > max_blocks) ||
+                                 (max_us > 0 && stats_now() - start_ns >= max_us * 1000))) break;
+        if (num_of_moved == capacity) {
+            capacity = capacity == 0 ? 64 : 2 * capacity;
+            int *grown = realloc(files, capacity * sizeof(int));
+            if (grown == NULL) break; // Commit the files moved so far
+            files = grown;
         }
+        files[num_of_moved] = idx;
+        cache_invalidate(&mnt->block_cache, inode->start_block, inode->size);
+        cache_invalidate(&mnt->block_cache, next_free, inode->size);
+        // The move overwrites the new blocks, freed blocks there need no zeroing any more
+        scrub_cancel(&mnt->scrub, next_free, inode->size);
+        disk_move(&mnt->disk, inode->start_block, next_free, inode->size);
+        next_free += inode->size;
+        moved += inode->size;
+        num_of_moved++;
+        block += inode->size; // The next file starts at the next used block past this one
+    }
+    if (num_of_moved == 0) {
+        free(files);
+        return 0;
     }
 
-    // 5. The name of every file/directory must be unique in each directory (names do not need to be unique
-    // across the entire file system).
-    for (size_t i=0; i < 126; i++) {
-        Inode *inode1 = &super_block->inode[i];
-        uint8_t isused1 = inode1->isused_size & (1 << 7);
-        uint8_t parent1 = inode1->isdir_parent & ~(1 << 7);
-        if (!isused1) continue;
-        for (size_t k=0; k < 126; k++) {
-            Inode *inode2 = &super_block->inode[k];
-            uint8_t isused2 = inode2->isused_size & (1 << 7);
-            uint8_t parent2 = inode2->isdir_parent & ~(1 << 7);
-            // Check that Inode 2 is in use and not the same node as inode1
-            if ((isused2) && (i != k)) {
-                // If two names are the same and of the same parent return error code 5
-                if ((memcmp(inode1->name,inode2->name,5) == 0) && (parent1 == parent2)) return 5;
+    // Zero out the old blocks past the new end of the packed blocks, one write per contiguous run
+    int run_start = -1;
+    int run_end = -1;
+    for (int f=0; f < num_of_moved; f++) {
+        FsInode *inode = &mnt->meta.inode[files[f]];
+        int start = inode->start_block;
+        int end = start + inode->size; // One past the last block
+        if (end <= next_free) continue; // Every old block was overwritten by moved data
+        if (start < next_free) start = next_free;
+        if (start != run_end) {
+            if (run_start != -1) scrub_add(&mnt->scrub, run_start, run_end - run_start);
+            run_start = start;
+        }
+        run_end = end;
+    }
+    if (run_start != -1) scrub_add(&mnt->scrub, run_start, run_end - run_start);
+
+    // Update the free block list and the inodes, then commit the superblock once. Every moved file leaves
+    // the start block index before any is put back, a new start block may be the old one of a later file.
+    int new_start = first_free;
+    for (int f=0; f < num_of_moved; f++) start_index_remove(&mnt->start_index, files[f]);
+    for (int f=0; f < num_of_moved; f++) {
+        FsInode *inode = &mnt->meta.inode[files[f]];
+        set_fbl_bits(mnt, inode->start_block, inode->size, 0); // "Un"set bits for old blocks
+        inode->start_block = new_start; // Set the new start block for the inode
+        meta_mark_inode(&mnt->meta, files[f]);
+        start_index_insert(&mnt->start_index, files[f]);
+        new_start += inode->size;
+    }
+    set_fbl_bits(mnt, first_free, next_free - first_free, 1); // Set bits for new blocks
+    mnt->defrags++;
+    mnt->journal.ordered = 1; // The moved data goes out before the inodes that point to it
+    mark_superblock_dirty(mnt);
+    // A journaled step is committed right away, the moved data and the old inodes are never left apart for long
+    if (mnt->journal.fd != -1 && mnt->sb_dirty) write_superblock(mnt);
+    free(files);
+    return moved;
+}
+
+/**
+ * @brief Sets a deadline (CLOCK_REALTIME, for pthread_cond_timedwait()) a # of microseconds from now.
+ */
+static void deadline_after(struct timespec *until, long us) {
+    clock_gettime(CLOCK_REALTIME, until);
+    until->tv_sec += us / 1000000;
+    until->tv_nsec += (us % 1000000) * 1000L;
+    if (until->tv_nsec >= 1000000000L) {
+        until->tv_sec++;
+        until->tv_nsec -= 1000000000L;
+    }
+}
+
+/**
+ * @brief Background defrag thread of a mount. While there are files to move it runs a step of at most
+ * defrag_blocks blocks and DEFRAG_STEP_US every DEFRAG_INTERVAL_US. The step write locks the mount, so
+ * it runs between commands, and the lock prefers writers, so a busy mount cannot starve it while no
+ * command waits for more than one step. Every step is synced once it is done, so the metadata on the
+ * image is consistent after each committed step. A step is not atomic: a crash in the middle of one leaves
+ * the old inodes, and the files it was moving can lose their data. Once the disk is packed it sleeps
+ * until blocks are freed.
+ */
+static void *defrag_thread(void *arg) {
+    FsMount *mnt = arg;
+    pthread_mutex_lock(&mnt->defrag_lock);
+    while (!mnt->defrag_stop) {
+        if (mnt->defrag_idle) {
+            pthread_cond_wait(&mnt->defrag_wake, &mnt->defrag_lock);
+            continue;
+        }
+        struct timespec until;
+        deadline_after(&until, DEFRAG_INTERVAL_US);
+        pthread_cond_timedwait(&mnt->defrag_wake, &mnt->defrag_lock, &until);
+        if (mnt->defrag_stop) break;
+        pthread_mutex_unlock(&mnt->defrag_lock);
+
+        pthread_rwlock_wrlock(&mnt->lock);
+        long moved = defrag_step(mnt, defrag_blocks, DEFRAG_STEP_US);
+        if (moved > 0) {
+            sync_mount(mnt);
+            // A kept mount the thread changed must not look changed by something else. The list lock is
+            // only tried, free_mount() may hold it while it waits for this thread.
+            if (mnt->shared && pthread_mutex_trylock(&shared_mounts_lock) == 0) {
+                if (mnt->users == 0) remember_image(mnt);
+                pthread_mutex_unlock(&shared_mounts_lock);
             }
         }
+        // Still write locked, so no delete can free blocks between the step and the idle flag
+        pthread_mutex_lock(&mnt->defrag_lock);
+        mnt->defrag_idle = (moved == 0);
+        pthread_rwlock_unlock(&mnt->lock);
     }
+    pthread_mutex_unlock(&mnt->defrag_lock);
+    return NULL;
+}
 
-    // 6. Blocks that are marked free in the free-space list cannot be allocated to any file. Similarly, blocks that
-    // are marked in use in the free-space list must be allocated to exactly one file
-    
-    if (fbl_error) return 6;
-    for (int i=0; i < 128; i++) {
-        if (i == 0) continue;   // skip super block bit
-        int byte = i / 8;
-        int bit  = 7 - (i % 8);
-        if (!(super_block->free_block_list[byte] & (1 << bit))) {
-            // Block is marked as free
-            if (alloced_blocks[i] == 1) return 6; // Block is marked as free in fbl but is used by inode
+/**
+ * @brief Stops the background defrag thread of a mount, if it has one. A step that is running finishes
+ * (and syncs) first, so the counters of the mount can be read and the mount synced or freed after.
+ */
+static void stop_defrag(FsMount *mnt) {
+    if (!mnt->defrag_running) return;
+    pthread_mutex_lock(&mnt->defrag_lock);
+    mnt->defrag_stop = 1;
+    pthread_cond_signal(&mnt->defrag_wake);
+    pthread_mutex_unlock(&mnt->defrag_lock);
+    pthread_join(mnt->defrag_thread, NULL);
+    pthread_mutex_destroy(&mnt->defrag_lock);
+    pthread_cond_destroy(&mnt->defrag_wake);
+    mnt->defrag_running = 0;
+}
+
+/**
+ * @brief Group commit thread of a journaled mount. Every journal_interval_ms it write locks the mount
+ * and commits the metadata changes made since the last commit, so a change waits at most that long
+ * to be durable however few changes follow it. The mount is locked, so it has no io_uring (see fs_mount()).
+ */
+static void *commit_thread(void *arg) {
+    FsMount *mnt = arg;
+    pthread_mutex_lock(&mnt->commit_lock);
+    while (!mnt->commit_stop) {
+        struct timespec until;
+        deadline_after(&until, journal_interval_ms * 1000L);
+        pthread_cond_timedwait(&mnt->commit_wake, &mnt->commit_lock, &until);
+        if (mnt->commit_stop) break;
+        pthread_mutex_unlock(&mnt->commit_lock);
+        pthread_rwlock_wrlock(&mnt->lock);
+        if (mnt->sb_dirty) write_superblock(mnt);
+        pthread_rwlock_unlock(&mnt->lock);
+        pthread_mutex_lock(&mnt->commit_lock);
+    }
+    pthread_mutex_unlock(&mnt->commit_lock);
+    return NULL;
+}
+
+/**
+ * @brief Stops the background threads of a mount (defrag and group commit), if it has any. A step or
+ * commit that is running finishes first, so the counters of the mount can be read and the mount synced
+ * or freed after.
+ */
+static void stop_threads(FsMount *mnt) {
+    stop_defrag(mnt);
+    if (!mnt->commit_running) return;
+    pthread_mutex_lock(&mnt->commit_lock);
+    mnt->commit_stop = 1;
+    pthread_cond_signal(&mnt->commit_wake);
+    pthread_mutex_unlock(&mnt->commit_lock);
+    pthread_join(mnt->commit_thread, NULL);
+    pthread_mutex_destroy(&mnt->commit_lock);
+    pthread_cond_destroy(&mnt->commit_wake);
+    mnt->commit_running = 0;
+}
+
+/**
+ * @brief Frees a mount that no context uses any more: its superblock, indexes and cache are freed and
+ * the disk is closed (a journaled disk is synced and its journal deleted). Pending changes are NOT
+ * written, call sync_mount() first.
+ */
+void free_mount(FsMount *mnt) {
+    stop_threads(mnt);
+    if (mnt->locked) pthread_rwlock_destroy(&mnt->lock);
+    if (mnt->shared) {
+        for (int l=0; l < MOUNT_INODE_LOCKS; l++) pthread_mutex_destroy(&mnt->file_lock[l]);
+    }
+    meta_free(&mnt->meta);
+    free(mnt->disk_name);
+    alloc_destroy(&mnt->allocator);
+    index_destroy(&mnt->name_index);
+    start_index_destroy(&mnt->start_index);
+    tree_destroy(&mnt->dir_tree);
+    cache_destroy(&mnt->block_cache);
+    scrub_destroy(&mnt->scrub); // The background thread must be done with the disk before it is closed
+    journal_destroy(&mnt->journal);
+    disk_detach(&mnt->disk);
+    free(mnt);
+}
+
+/**
+ * @brief Detaches the mounted disk from a context. The superblock, indexes and cache are freed and
+ * the disk is closed once no other context uses the mount (the last user of a shared mount writes
+ * the changes other users left pending). With disk_keep_mounted the last user leaves a shared mount
+ * loaded instead, recording the state of the image so fs_mount() can tell if it changed since.
+ * Pending changes of a private mount are NOT written, call fs_sync() first.
+ */
+void release_disk(FsContext *ctx) {
+    FsMount *mnt = ctx->mnt;
+    if (mnt == NULL) return;
+    ctx->mnt = NULL;
+    if (mnt->shared) {
+        pthread_mutex_lock(&shared_mounts_lock);
+        int last = (--mnt->users == 0);
+        if (last && disk_keep_mounted) {
+            // Every user syncs before it leaves, so the image now holds every change made through the mount
+            remember_image(mnt);
+            pthread_mutex_unlock(&shared_mounts_lock);
+            return;
+        }
+        if (last) {
+            FsMount **link = &shared_mounts;
+            while (*link != mnt) link = &(*link)->next;
+            *link = mnt->next;
         }
+        pthread_mutex_unlock(&shared_mounts_lock);
+        if (!last) return;
     }
+    stop_threads(mnt);
+    if (mnt->shared) sync_mount(mnt);
+    // The superblock writes and block I/O of a shared mount go to the stats of its last user
+    stats_merge_latency(&ctx->stats.sb_write, &mnt->sb_write);
+    disk_stats(&mnt->disk, &ctx->stats.io);
+    free_mount(mnt);
+}
 
-    return 0;
+/**
+ * @brief Closes every shared mount that disk_keep_mounted left loaded with no users, adding
+ * their superblock writes and block I/O to a set of statistics.
+ * 
+ * @param stats - Statistics to add the counters of the closed mounts to
+ */
+void fs_release_kept_mounts(FsStats *stats) {
+    pthread_mutex_lock(&shared_mounts_lock);
+    FsMount **link = &shared_mounts;
+    while (*link != NULL) {
+        FsMount *mnt = *link;
+        if (mnt->users != 0) {
+            link = &mnt->next;
+            continue;
+        }
+        *link = mnt->next;
+        stop_threads(mnt);
+        stats_merge_latency(&stats->sb_write, &mnt->sb_write);
+        disk_stats(&mnt->disk, &stats->io);
+        free_mount(mnt);
+    }
+    pthread_mutex_unlock(&shared_mounts_lock);
+}
+
+/**
+ * @brief Zeroes every free block of a disk that was not shut down cleanly. Blocks freed before the crash
+ * may have been zeroed on the host only (or were still waiting for the background thread), and a new file
+ * must read as zeros. The zeros are synced, so the journal can be deleted after.
+ */
+static void zero_free_blocks(Disk *dev, FsMeta *m) {
+    int run_start = -1;
+    for (int b = m->data_start; b <= m->nblocks; b++) {
+        int is_free = (b < m->nblocks && !meta_block_used(m, b));
+        if (is_free && run_start == -1) run_start = b;
+        if (!is_free && run_start != -1) {
+            disk_zero(dev, run_start, b - run_start);
+            run_start = -1;
+        }
+    }
+    disk_flush(dev);
 }
 
 /**
  * @brief Mounts the file system residing on the specified virtual disk.
  * 
+ * @param ctx - Context of the simulator instance
  * @param new_disk_name - name of disk to be mounted
  */
-void fs_mount(char *new_disk_name) {
+void fs_mount(FsContext *ctx, char *new_disk_name) {
+    // Remounting is a sync point, pending changes must reach the disk before it is read again
+    fs_sync(ctx);
+
     // First, check if virtual disk with the given name exists in the cwd
     // If it exists, mount the virtual disk
     int vd_new;
     if ((vd_new = open(new_disk_name,O_RDWR)) == -1) {
-        fprintf(stderr, "Error: Cannot find disk %s\n", new_disk_name);
+        fprintf(ctx->err, "Error: Cannot find disk %s\n", new_disk_name);
         return;
     }
 
-    Superblock *sb_new = malloc(sizeof(Superblock)); // Allocate memory for the superblock
-    lseek(vd_new, 0, SEEK_SET);
-    read(vd_new, sb_new, 1024); // Load the superblock of the new virtual disk
+    // A disk image that is already mounted in disk_shared mode is used as it is in memory. The list
+    // stays locked until the new mount is in it, so two contexts never load the same disk.
+    struct stat st;
+    if (disk_shared) {
+        fstat(vd_new, &st);
+        pthread_mutex_lock(&shared_mounts_lock);
+        for (FsMount **link = &shared_mounts; *link != NULL; link = &(*link)->next) {
+            FsMount *mnt = *link;
+            if (mnt->dev != st.st_dev || mnt->ino != st.st_ino) continue;
+            // A kept mount is only reused if nothing else changed the image since its last user left
+            if (mnt->users == 0 && (mnt->size != st.st_size || mnt->mtime.tv_sec != st.st_mtim.tv_sec ||
+                                    mnt->mtime.tv_nsec != st.st_mtim.tv_nsec)) {
+                *link = mnt->next;
+                stop_threads(mnt);
+                stats_merge_latency(&ctx->stats.sb_write, &mnt->sb_write);
+                disk_stats(&mnt->disk, &ctx->stats.io);
+                free_mount(mnt);
+                break;
+            }
+            mnt->users++;
+            pthread_mutex_unlock(&shared_mounts_lock);
+            close(vd_new);
+            release_disk(ctx);
+            ctx->mnt = mnt;
+            ctx->cwd = mnt->meta.root;
+            return;
+        }
+    }
+
+    // A journal left next to the image means the last mount did not shut down cleanly, its
+    // committed metadata changes go onto the image before anything reads it
+    int replayed = journal_replay(vd_new, new_disk_name);
+    if (replayed == -2) {
+        fprintf(ctx->err, "Error: Cannot allocate memory to mount disk %s\n", new_disk_name);
+        close(vd_new);
+        if (disk_shared) pthread_mutex_unlock(&shared_mounts_lock);
+        return;
+    }
+
+    // Load the superblock of the new virtual disk (v1 or v2 format)
+    FsMeta meta_new;
+    int error = meta_load(&meta_new, vd_new);
+    if (error != 0) {
+        if (error == -1) fprintf(ctx->err, "Error: Cannot allocate memory to mount disk %s\n", new_disk_name);
+        else fprintf(ctx->err, "Error: File system in %s is inconsistent (error code: %d)\n", new_disk_name, error);
+        meta_free(&meta_new);
+        close(vd_new);
+        if (disk_shared) pthread_mutex_unlock(&shared_mounts_lock);
+        return;
+    }
 
     // Perform consistency check on the virtual disk and print error if neccessary
-    int error = consistency_check(sb_new);
+    error = consistency_check(ctx, &meta_new);
+    if (check_timing_report) {
+        fprintf(ctx->err, "Consistency check of %s: rules 1-4 %ld ns, rule 5 %ld ns, rule 6 %ld ns, total %ld ns\n",
+                new_disk_name, ctx->check_timing.rules_1_4_ns, ctx->check_timing.rule_5_ns, ctx->check_timing.rule_6_ns,
+                ctx->check_timing.total_ns);
+    }
     if (error != 0) {
-        fprintf(stderr, "Error: File system in %s is inconsistent (error code: %d)\n", new_disk_name, error);
+        if (error == -1) fprintf(ctx->err, "Error: Cannot allocate memory to mount disk %s\n", new_disk_name);
+        else fprintf(ctx->err, "Error: File system in %s is inconsistent (error code: %d)\n", new_disk_name, error);
+        meta_free(&meta_new);
         close(vd_new);
-        free(sb_new);
+        if (disk_shared) pthread_mutex_unlock(&shared_mounts_lock);
         return;
     }
 
-    // If no error is encountered, free old global vars and assign new ones
-    if (vd != -1) close(vd);
-    if (sb != NULL) free(sb);
-    if (disk_name != NULL) free(disk_name);
-    vd = vd_new;
-    sb = sb_new;
-    disk_name = strdup(new_disk_name);
-    cwd = 127;
+    // If no error is encountered, build the new mount (the allocator is the largest part of it, so it goes first)
+    FsMount *mnt = calloc(1, sizeof(FsMount));
+    if (mnt == NULL || alloc_init(&mnt->allocator, &meta_new) == -1) {
+        fprintf(ctx->err, "Error: Cannot allocate memory to mount disk %s\n", new_disk_name);
+        free(mnt);
+        meta_free(&meta_new);
+        close(vd_new);
+        if (disk_shared) pthread_mutex_unlock(&shared_mounts_lock);
+        return;
+    }
+    // A mount that more than one thread uses (shared, or with a background defrag or group commit thread) is locked
+    int commit_timer = (journal_enabled && journal_interval_ms > 0);
+    mnt->locked = (disk_shared || defrag_blocks > 0 || commit_timer);
+    // An io_uring belongs to one thread, so a locked mount gets none. A shared mount gets no block cache either
+    // (it is not thread-safe, and several contexts use the mount at once).
+    disk_attach(&mnt->disk, vd_new, meta_new.nblocks, disk_use_mmap, mnt->locked ? 0 : disk_ring_depth);
+    if (replayed != -1) zero_free_blocks(&mnt->disk, &meta_new);
+    if (journal_init(&mnt->journal, &mnt->disk, new_disk_name, journal_enabled) == -1) {
+        fprintf(ctx->err, "Error: Cannot create journal of disk %s\n", new_disk_name);
+        disk_detach(&mnt->disk);
+        alloc_destroy(&mnt->allocator);
+        meta_free(&meta_new);
+        free(mnt);
+        if (disk_shared) pthread_mutex_unlock(&shared_mounts_lock);
+        return;
+    }
+    if (replayed != -1 && !journal_enabled) journal_remove(new_disk_name); // Recovered, journal_init() replaced it otherwise
+    mnt->meta = meta_new;
+    // Index names, start blocks and directory structure of the new disk and set up its block cache (a mapped disk needs none)
+    if (index_init(&mnt->name_index, &mnt->meta) == -1 || start_index_init(&mnt->start_index, &mnt->meta) == -1 ||
+        tree_init(&mnt->dir_tree, &mnt->meta) == -1 ||
+        cache_init(&mnt->block_cache, &mnt->disk, mnt->disk.map == NULL && !disk_shared ? cache_blocks : 0) == -1 ||
+        scrub_init(&mnt->scrub, &mnt->disk, scrub_deferred) == -1 || (mnt->disk_name = strdup(new_disk_name)) == NULL) {
+        fprintf(ctx->err, "Error: Cannot allocate memory to mount disk %s\n", new_disk_name);
+        mnt->locked = 0; // Its lock is not set up yet
+        free_mount(mnt);
+        if (disk_shared) pthread_mutex_unlock(&shared_mounts_lock);
+        return;
+    }
+    mnt->users = 1;
+    if (mnt->locked) {
+        pthread_rwlockattr_t attr;
+        pthread_rwlockattr_init(&attr);
+        // Readers that keep coming must not starve the background defrag thread
+        if (defrag_blocks > 0) pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+        pthread_rwlock_init(&mnt->lock, &attr);
+        pthread_rwlockattr_destroy(&attr);
+    }
+    if (defrag_blocks > 0) {
+        mnt->defrag_running = 1;
+        pthread_mutex_init(&mnt->defrag_lock, NULL);
+        pthread_cond_init(&mnt->defrag_wake, NULL);
+        pthread_create(&mnt->defrag_thread, NULL, defrag_thread, mnt);
+    }
+    if (commit_timer) {
+        mnt->commit_running = 1;
+        pthread_mutex_init(&mnt->commit_lock, NULL);
+        pthread_cond_init(&mnt->commit_wake, NULL);
+        pthread_create(&mnt->commit_thread, NULL, commit_thread, mnt);
+    }
+    if (disk_shared) {
+        mnt->shared = 1;
+        mnt->dev = st.st_dev;
+        mnt->ino = st.st_ino;
+        for (int l=0; l < MOUNT_INODE_LOCKS; l++) pthread_mutex_init(&mnt->file_lock[l], NULL);
+        mnt->next = shared_mounts;
+        shared_mounts = mnt;
+        pthread_mutex_unlock(&shared_mounts_lock);
+    }
+
+    // Free the old mount and switch to the new one
+    release_disk(ctx);
+    ctx->mnt = mnt;
+    ctx->cwd = mnt->meta.root;
 
     return;
 }
 
 /**
- * @brief Creates a new file or directory in the current working directory 
- * with the given name and the given number of blocks, 
- * and stores the attributes in the first available inode. 
+ * @brief Assigns the first available inode to a new file or directory in the current working directory,
+ * allocating its blocks by the allocation policy of the context. Prints an error if the inode table is full,
+ * the name is taken or there is no contiguous run of free blocks large enough. The mount must be write locked, and the
+ * superblock is only changed in memory (the caller commits it).
  * 
+ * @param ctx - Context of the simulator instance
  * @param name - Name of the file or directory to create
  * @param size - # of contiguous block the file will require (0 if directory)
+ * @return Integer value index of the new inode, -1 if it cannot be created
  */
-void fs_create(char name[5], int size) {
+int create_inode(FsContext *ctx, char name[5], int size) {
+    FsMount *mnt = ctx->mnt;
+
     // Find first available inode
-    Inode *inode = NULL;
-    size_t idx = 0;
-    size_t i = 0;
-    while ((inode == NULL) && (i < 126)) {
-        uint8_t isused = sb->inode[i].isused_size & (1 << 7);
-        if (!isused) {
-            inode = &sb->inode[i];
-            idx = i;
-        }
-        i++;
-    }
-    // if idx = 126 then there are no free inodes, print an error
-    if (i == 126) {
-        fprintf(stderr, "Error: Superblock in disk %s is full, cannot create %s\n", disk_name, name);
-        return;
+    // (the last v1 inode is never handed out, matching the bound of the original inode scan)
+    int idx = alloc_peek_inode(&mnt->allocator);
+    if (idx == -1 || (mnt->meta.version == 1 && idx == 125)) {
+        fprintf(ctx->err, "Error: Superblock in disk %s is full, cannot create %s\n", mnt->disk_name, name);
+        return -1;
     }
+    FsInode *inode = &mnt->meta.inode[idx];
     
     // CHECK FOR NAMING DUPLICATES
-    if (file_exists(name) >= 0) {
-        fprintf(stderr, "Error: File or directory %s already exists\n", name);
-        return;
+    if (file_exists(ctx, name) >= 0) {
+        fprintf(ctx->err, "Error: File or directory %s already exists\n", name);
+        return -1;
     }
     if (memcmp(name, ".\0\0\0\0", 5) == 0 || memcmp(name, "..\0\0\0", 5) == 0) {
-        fprintf(stderr, "Error: File or directory %s already exists\n", name);
-        return;
+        fprintf(ctx->err, "Error: File or directory %s already exists\n", name);
+        return -1;
     }
 
     // CHECK FOR CONTIGUOUS BLOCK GROUP (only if not creating a directory)
-    int block_count = 0; // Track # of contiguous blocks found after found_block flag
     int start_block_idx = -1; // Stores index of start block for a valid contiguous group of memory
     if (size > 0) {
-    for (size_t i=0; i < 128; i++) {
-        if (i == 0) continue;   // skip super block bit
-        int byte = i / 8;
-        int bit  = 7 - (i % 8);
-        if (!(sb->free_block_list[byte] & (1 << bit))) {
-            // Block is marked as free
-            block_count += 1;
-            if (block_count == size) {
-                start_block_idx = (int)(i - size + 1);
-                break;
-            }
-        } else {
-            // Block is in use
-            block_count = 0; // Reset count of contiguous blocks
+        start_block_idx = alloc_find_blocks(&mnt->allocator, size, ctx->alloc_policy);
+        // Print error if not enough contiguous blocks in memory
+        if (start_block_idx == -1) {
+            fprintf(ctx->err, "Error: Cannot allocate %d blocks on %s\n", size, mnt->disk_name);
+            return -1;
         }
-    }    
-    // Print error if not enough contiguous blocks in memory
-    if (start_block_idx == -1) {
-        fprintf(stderr, "Error: Cannot allocate %d blocks on %s\n", size, disk_name);
-        return;
-    }
+        scrub_claim(&mnt->scrub, start_block_idx, size); // A new file reads as zeros, even on blocks freed just before
+        mnt->journal.ordered = 1; // So do its blocks after a crash, once the commit that creates it is replayed
     }
 
     // ALL TESTS PASSED, ASSIGN INODE TO FILE OR DIRECTORY
+    alloc_take_inode(&mnt->allocator);
     strncpy(inode->name, name, 5); // Set the name
-    inode->isused_size = (uint8_t)size; // Set the size
-    inode->isused_size |= (1 << 7); // Set the is used bit
+    inode->size = size; // Set the size
+    inode->flags = INODE_USED; // Set the is used bit
     if (size == 0) inode->start_block = 0; // Set the start block
     else inode->start_block = start_block_idx;
-    inode->isdir_parent = (uint8_t)cwd; // Set the parent inode
-    if (size == 0) inode->isdir_parent |= (1 << 7); // Set the is directory bit if size = 0
+    inode->parent = ctx->cwd; // Set the parent inode
+    if (size == 0) inode->flags |= INODE_DIR; // Set the is directory bit if size = 0
+    meta_mark_inode(&mnt->meta, idx);
 
-    if (size > 0) set_fbl_bits(start_block_idx, size, 1); // Update fbl bits
+    if (size > 0) set_fbl_bits(mnt, start_block_idx, size, 1); // Update fbl bits
+    index_insert(&mnt->name_index, idx); // Make the new name visible to file_exists
+    if (size > 0) start_index_insert(&mnt->start_index, idx); // Defrag finds the file by its start block
+    tree_add(&mnt->dir_tree, idx, ctx->cwd);
+    return idx;
+}
 
+/**
+ * @brief Creates a new file or directory in the current working directory 
+ * with the given name and the given number of blocks, 
+ * and stores the attributes in the first available inode. 
+ * 
+ * @param ctx - Context of the simulator instance
+ * @param name - Name of the file or directory to create
+ * @param size - # of contiguous block the file will require (0 if directory)
+ */
+void fs_create(FsContext *ctx, char name[5], int size) {
+    lock_mount(ctx, 1);
     // Update the superblock in the virtual disk
-    write_superblock();
+    if (create_inode(ctx, name, size) != -1) mark_superblock_dirty(ctx->mnt);
+    unlock_mount(ctx);
+}
 
-    return;
+/**
+ * @brief Copies the file with the given name to a new file in the current working directory.
+ * The new file gets its blocks by the same rules as fs_create(), the data is copied inside the
+ * kernel (see disk_copy()) and the superblock is committed once, after the data.
+ * 
+ * @param ctx - Context of the simulator instance
+ * @param name - Name of the file to copy
+ * @param new_name - Name of the file to create
+ */
+void fs_copy(FsContext *ctx, char name[5], char new_name[5]) {
+    FsMount *mnt = ctx->mnt;
+    lock_mount(ctx, 1);
+
+    // The source has to be a file in the cwd
+    int src_idx = file_exists(ctx, name);
+    if (src_idx == -1 || (mnt->meta.inode[src_idx].flags & INODE_DIR)) {
+        fprintf(ctx->err, "Error: File %s does not exist\n", name);
+        unlock_mount(ctx);
+        return;
+    }
+    int size = mnt->meta.inode[src_idx].size;
+    int src_block = mnt->meta.inode[src_idx].start_block;
+
+    int idx = create_inode(ctx, new_name, size);
+    if (idx == -1) {
+        unlock_mount(ctx);
+        return;
+    }
+
+    // Data goes out before the metadata that points to it
+    cache_copy(&mnt->block_cache, src_block, mnt->meta.inode[idx].start_block, size);
+    mark_superblock_dirty(mnt);
+    unlock_mount(ctx);
 }
 
 /**
  * @brief Deletes the file or directory with the given name in the current working directory. 
  * 
+ * @param ctx - Context of the simulator instance
  * @param name - name of the file or directory to be deleted
  */
-void fs_delete(char name[5]) {
+void fs_delete(FsContext *ctx, char name[5]) {
+    FsMount *mnt = ctx->mnt;
+    lock_mount(ctx, 1);
+
     // First, check if file or directory with the name exists in the cwd
-    int idx = file_exists(name); // Inode index of the file to delete
+    int idx = file_exists(ctx, name); // Inode index of the file to delete
     if (idx == -1) {
-        fprintf(stderr, "Error: File or directory %s does not exist\n", name);
+        fprintf(ctx->err, "Error: File or directory %s does not exist\n", name);
+        unlock_mount(ctx);
         return;
     }
 
-    delete_file(idx); // Delete the file
+    if (delete_file(mnt, idx) == -1) { // Delete the file
+        fprintf(ctx->err, "Error: Cannot allocate memory to delete %s\n", name);
+        unlock_mount(ctx);
+        return;
+    }
 
-    write_superblock(); // Write changes to the virtual disk
+    mark_superblock_dirty(mnt); // Write changes to the virtual disk
+    unlock_mount(ctx);
 
     return;
 }
@@ -389,260 +1013,454 @@ void fs_delete(char name[5]) {
  * @brief Opens the file with the given name 
  * and reads the block num-th block of the file into the buffer.
  * 
+ * @param ctx - Context of the simulator instance
  * @param name - name of the file to read
  * @param block_num - index of the block to read [0, size-1]
  */
-void fs_read(char name[5], int block_num) {
+void fs_read(FsContext *ctx, char name[5], int block_num) {
+    FsMount *mnt = ctx->mnt;
+    lock_mount(ctx, 0);
+
     // First, check if file or directory with the name exists in the cwd
-    int idx = file_exists(name); // Inode index of the file to delete
+    int idx = file_exists(ctx, name); // Inode index of the file to delete
     if (idx == -1) {
-        fprintf(stderr, "Error: File %s does not exist\n", name);
+        fprintf(ctx->err, "Error: File %s does not exist\n", name);
+        unlock_mount(ctx);
         return;
     }
 
-    Inode *inode = &sb->inode[idx]; // Inode of file to be read
-    uint8_t size = inode->isused_size & ~(1 << 7);
-    uint8_t start_block = inode->start_block;
-    uint8_t isdir = inode->isdir_parent & (1 << 7);
-    uint8_t parent = inode->isdir_parent & ~(1 << 7);
+    FsInode *inode = &mnt->meta.inode[idx]; // Inode of file to be read
+    long size = inode->size;
+    long start_block = inode->start_block;
+    int isdir = inode->flags & INODE_DIR;
 
     // Print error and return if the file trying to be read is a directory
     if (isdir) {
-        fprintf(stderr, "Error: File %s does not exist\n", name);
+        fprintf(ctx->err, "Error: File %s does not exist\n", name);
+        unlock_mount(ctx);
         return;
     }
     // If block_num is not in the range of the file, print an error
     if (block_num < 0 || block_num > size-1) {
-        fprintf(stderr, "Error: %s does not have block %d\n", name, block_num);
+        fprintf(ctx->err, "Error: %s does not have block %d\n", name, block_num);
+        unlock_mount(ctx);
         return;
     }
 
     // If no errors, read the block into the buffer
-    lseek(vd, (1024)*(start_block+block_num), SEEK_SET);
-    read(vd, fs_buffer, 1024);
+    lock_file(mnt, idx, 1);
+    cache_read(&mnt->block_cache, start_block+block_num, ctx->fs_buffer);
+    lock_file(mnt, idx, 0);
+    unlock_mount(ctx);
+    ctx->range_blocks = 0; // The buffer is newer than the range buffer
+    ctx->buffer_zero = -1;
 
     return;
 }
 
+/**
+ * @brief Checks if a buffer holds only zero bytes.
+ */
+static int is_zero(const uint8_t *buff, size_t len) {
+    return buff[0] == 0 && memcmp(buff, buff + 1, len - 1) == 0;
+}
+
+/**
+ * @brief Checks if the buffer holds only zero bytes, only looking at it again after it changed.
+ */
+static int buffer_is_zero(FsContext *ctx) {
+    if (ctx->buffer_zero == -1) {
+        disk_wait(&ctx->mnt->disk); // A queued fs_read() may still be filling in the buffer
+        ctx->buffer_zero = is_zero(ctx->fs_buffer, 1024);
+    }
+    return ctx->buffer_zero;
+}
+
 /**
  * @brief Opens the file with the given name 
  * and writes the content of the buffer to the block num-th block of the file.
  * 
+ * @param ctx - Context of the simulator instance
  * @param name - name of file to open
  * @param block_num - block number of file to write to
  */
-void fs_write(char name[5], int block_num) {    
+void fs_write(FsContext *ctx, char name[5], int block_num) {    
+    FsMount *mnt = ctx->mnt;
+    lock_mount(ctx, 0);
+
     // First, check if file or directory with the name exists in the cwd
-    int idx = file_exists(name); // Inode index of the file to write to
+    int idx = file_exists(ctx, name); // Inode index of the file to write to
     if (idx == -1) {
-        fprintf(stderr, "Error: File %s does not exist\n", name);
+        fprintf(ctx->err, "Error: File %s does not exist\n", name);
+        unlock_mount(ctx);
         return;
     }
 
-    Inode *inode = &sb->inode[idx]; // Inode of file to be written to
-    uint8_t size = inode->isused_size & ~(1 << 7);
-    uint8_t start_block = inode->start_block;
-    uint8_t isdir = inode->isdir_parent & (1 << 7);
-    uint8_t parent = inode->isdir_parent & ~(1 << 7);
+    FsInode *inode = &mnt->meta.inode[idx]; // Inode of file to be written to
+    long size = inode->size;
+    long start_block = inode->start_block;
+    int isdir = inode->flags & INODE_DIR;
 
     // Print error and return if the file trying to be written to is a directory
     if (isdir) {
-        fprintf(stderr, "Error: File %s does not exist\n", name);
+        fprintf(ctx->err, "Error: File %s does not exist\n", name);
+        unlock_mount(ctx);
         return;
     }
     // If block_num is not in the range of the file, print an error
     if (block_num < 0 || block_num > size-1) {
-        fprintf(stderr, "Error: %s does not have block %d\n", name, block_num);
+        fprintf(ctx->err, "Error: %s does not have block %d\n", name, block_num);
+        unlock_mount(ctx);
         return;
     }
 
-    // If no errors, write to the block from the buffer
-    lseek(vd, (1024)*(start_block+block_num), SEEK_SET);
-    write(vd, fs_buffer, 1024);
+    // If no errors, write to the block from the buffer. Zeros written over a hole change nothing
+    // (and would take up space on the host), so that write is skipped.
+    lock_file(mnt, idx, 1);
+    if (!buffer_is_zero(ctx) || !cache_is_hole(&mnt->block_cache, start_block+block_num)) {
+        cache_write(&mnt->block_cache, start_block+block_num, ctx->fs_buffer);
+    }
+    lock_file(mnt, idx, 0);
+    unlock_mount(ctx);
 
     return;
 }
 
+/**
+ * @brief Looks up a file in the cwd for a range read or write and checks that it has every block of
+ * the range, printing the same errors as fs_read()/fs_write(). The mount must be locked.
+ * 
+ * @param ctx - Context of the simulator instance
+ * @param name - name of the file
+ * @param block_num - index of the first block of the range
+ * @param count - # of blocks in the range
+ * @return Integer value index of the inode of the file, -1 if the range cannot be used
+ */
+int find_range(FsContext *ctx, char name[5], int block_num, int count) {
+    int idx = file_exists(ctx, name);
+    if (idx == -1 || (ctx->mnt->meta.inode[idx].flags & INODE_DIR)) {
+        fprintf(ctx->err, "Error: File %s does not exist\n", name);
+        return -1;
+    }
+    // If the range goes past the end of the file, print an error for the first block it does not have
+    long size = ctx->mnt->meta.inode[idx].size;
+    if (block_num + count > size) {
+        fprintf(ctx->err, "Error: %s does not have block %ld\n", name, block_num > size ? block_num : size);
+        return -1;
+    }
+    return idx;
+}
+
+/**
+ * @brief Opens the file with the given name and reads count blocks of the file,
+ * starting at the block num-th block, into the range buffer with one vectored read.
+ * 
+ * @param ctx - Context of the simulator instance
+ * @param name - name of the file to read
+ * @param block_num - index of the first block to read [0, size-1]
+ * @param count - # of blocks to read
+ */
+void fs_read_range(FsContext *ctx, char name[5], int block_num, int count) {
+    FsMount *mnt = ctx->mnt;
+    lock_mount(ctx, 0);
+    int idx = find_range(ctx, name, block_num, count);
+    if (idx == -1) {
+        unlock_mount(ctx);
+        return;
+    }
+    long start_block = mnt->meta.inode[idx].start_block;
+
+    // The old contents are replaced, so the range buffer does not need to be copied when it grows
+    if (count > ctx->range_capacity) {
+        free(ctx->range_buffer);
+        ctx->range_buffer = malloc((size_t)(1024)*count);
+        ctx->range_capacity = ctx->range_buffer != NULL ? count : 0;
+    }
+    if (ctx->range_buffer == NULL) {
+        fprintf(ctx->err, "Error: Cannot allocate memory to read %d blocks of %s\n", count, name);
+        ctx->range_blocks = 0;
+        unlock_mount(ctx);
+        return;
+    }
+
+    lock_file(mnt, idx, 1);
+    cache_read_range(&mnt->block_cache, start_block+block_num, count, ctx->range_buffer);
+    lock_file(mnt, idx, 0);
+    unlock_mount(ctx);
+    ctx->range_blocks = count;
+}
+
+/**
+ * @brief Opens the file with the given name and writes count blocks of the file, starting at the
+ * block num-th block, with vectored writes. The blocks come from the range buffer (repeated if it holds
+ * fewer blocks), or from the buffer if it was changed by a BUFFER or READ command since the last range read.
+ * 
+ * @param ctx - Context of the simulator instance
+ * @param name - name of file to open
+ * @param block_num - first block number of file to write to
+ * @param count - # of blocks to write
+ */
+void fs_write_range(FsContext *ctx, char name[5], int block_num, int count) {
+    FsMount *mnt = ctx->mnt;
+    lock_mount(ctx, 0);
+    int idx = find_range(ctx, name, block_num, count);
+    if (idx == -1) {
+        unlock_mount(ctx);
+        return;
+    }
+    long start_block = mnt->meta.inode[idx].start_block;
+
+    uint8_t *src = ctx->range_blocks > 0 ? ctx->range_buffer : ctx->fs_buffer;
+    int src_blocks = ctx->range_blocks > 0 ? ctx->range_blocks : 1;
+    if (ctx->range_blocks > 0 ? is_zero(src, (size_t)(1024)*src_blocks) : buffer_is_zero(ctx)) {
+        // Writing only zeros, punch a hole over the range instead of transferring any data
+        lock_file(mnt, idx, 1);
+        cache_invalidate(&mnt->block_cache, start_block+block_num, count);
+        disk_zero(&mnt->disk, start_block+block_num, count);
+        lock_file(mnt, idx, 0);
+        unlock_mount(ctx);
+        return;
+    }
+
+    // One buffer per repetition of the source, so the whole range goes out in one pwritev()
+    int iovcnt = (count + src_blocks - 1) / src_blocks;
+    struct iovec *iov = malloc(iovcnt * sizeof(struct iovec));
+    if (iov == NULL) {
+        fprintf(ctx->err, "Error: Cannot allocate memory to write %d blocks of %s\n", count, name);
+        unlock_mount(ctx);
+        return;
+    }
+    for (int v=0; v < iovcnt; v++) {
+        int left = count - v*src_blocks;
+        iov[v].iov_base = src;
+        iov[v].iov_len = (size_t)(1024)*(left < src_blocks ? left : src_blocks);
+    }
+
+    lock_file(mnt, idx, 1);
+    cache_write_range(&mnt->block_cache, start_block+block_num, iov, iovcnt);
+    lock_file(mnt, idx, 0);
+    unlock_mount(ctx);
+    free(iov);
+}
+
 /**
  * @brief Flushes the buffer by zeroing it and writes the new bytes into the buffer.
  * 
+ * @param ctx - Context of the simulator instance
  * @param buff - buffered values from input to send to file system buffer
  */
-void fs_buff(uint8_t buff[1024]) {
-    for (size_t i=0; i < 1024; i++) fs_buffer[i] = 0;
-    memcpy(fs_buffer, buff, 1024);
+void fs_buff(FsContext *ctx, uint8_t buff[1024]) {
+    // A queued fs_read() may still be filling in the buffer. The wait is done with the mount locked,
+    // a background thread (defrag step or group commit) may be using the io_uring of the disk at the same time.
+    lock_mount(ctx, 0);
+    disk_wait(&ctx->mnt->disk);
+    unlock_mount(ctx);
+    for (size_t i=0; i < 1024; i++) ctx->fs_buffer[i] = 0;
+    memcpy(ctx->fs_buffer, buff, 1024);
+    ctx->range_blocks = 0; // The buffer is newer than the range buffer
+    ctx->buffer_zero = -1;
 }
 
 /**
  * @brief Lists all files and directories that exist in the current directory.
+ * 
+ * @param ctx - Context of the simulator instance
  */
-void fs_ls(void) {
-    // Print number of children in cwd
-    int num_of_children_cwd = 2;
-    for (size_t i=0; i < 126; i++) {
-        if ((sb->inode[i].isdir_parent & ~(1 << 7)) == cwd && (sb->inode[i].isused_size & (1 << 7))) num_of_children_cwd++;
+void fs_ls(FsContext *ctx) {
+    FsMount *mnt = ctx->mnt;
+    lock_mount(ctx, 0);
+    int *children = malloc((mnt->dir_tree.child_count[ctx->cwd] + 1) * sizeof(int));
+    if (children == NULL) {
+        fprintf(ctx->err, "Error: Cannot allocate memory to list the current directory\n");
+        unlock_mount(ctx);
+        return;
     }
-    printf("%-5s %3d\n", ".", num_of_children_cwd);
+
+    // Print number of children in cwd
+    int num_of_children_cwd = 2 + mnt->dir_tree.child_count[ctx->cwd];
+    fprintf(ctx->out, "%-5s %3d\n", ".", num_of_children_cwd);
 
     // Print number of children in directory one level up from cwd if not root
-    int num_of_children_prevwd = 2;
-    if (cwd == 127) {
-        printf("%-5s %3d\n", "..", num_of_children_cwd); // cwd is root
+    if (ctx->cwd == mnt->meta.root) {
+        fprintf(ctx->out, "%-5s %3d\n", "..", num_of_children_cwd); // cwd is root
     } else {
-        for (size_t i=0; i < 126; i++) {
-            if ((sb->inode[i].isdir_parent & (1 << 7)) && i == cwd && (sb->inode[i].isused_size & (1 << 7))) {
-                int prevwd = sb->inode[i].isdir_parent & ~(1 << 7);
-                for (size_t k=0; k < 126; k++) {
-                    if ((sb->inode[k].isdir_parent & ~(1 << 7)) == prevwd && (sb->inode[k].isused_size & (1 << 7))) num_of_children_prevwd++;
-                }
-                break;
-            }
-        }
-        printf("%-5s %3d\n", "..", num_of_children_prevwd);
+        int prevwd = mnt->dir_tree.parent[ctx->cwd];
+        fprintf(ctx->out, "%-5s %3d\n", "..", 2 + mnt->dir_tree.child_count[prevwd]);
     }
     
     // Print files and directories in cwd
-    for (size_t i=0; i < 126; i++) {
-        Inode *inode = &sb->inode[i];
+    int num_of_children = tree_children(&mnt->dir_tree, ctx->cwd, children);
+    for (int c=0; c < num_of_children; c++) {
+        FsInode *inode = &mnt->meta.inode[children[c]];
         char name[5];
         for (size_t j=0; j < 5; j++) name[j] = inode->name[j];
-        uint8_t isused = inode->isused_size & (1 << 7);
-        uint8_t size = inode->isused_size & ~(1 << 7);
-        uint8_t isdir = inode->isdir_parent & (1 << 7);
-        uint8_t parent = inode->isdir_parent & ~(1 << 7);
+        unsigned size = inode->size;
+        int isdir = inode->flags & INODE_DIR;
 
-        if (isdir && isused) {
+        if (isdir) {
             // DIRECTORY
-            if (parent == cwd) {
-                // Get # of children
-                int num_of_children = 2;
-                for (size_t k=0; k < 126; k++) {
-                    if ((sb->inode[k].isdir_parent & ~(1 << 7)) == i && (sb->inode[k].isused_size & (1 << 7))) num_of_children++;
-                }
-                printf("%-5s %3d\n", name, num_of_children);
-            }
+            fprintf(ctx->out, "%-5s %3d\n", name, 2 + mnt->dir_tree.child_count[children[c]]);
         } else {
             // FILE
-            // Print files that are in the cwd
-            if ((parent == cwd) && (isused)) {
-                printf("%-5s %3d KB\n", name, size);
-            }
+            fprintf(ctx->out, "%-5s %3u KB\n", name, size);
         }
     }
+    free(children);
+    unlock_mount(ctx);
     return;
 }
 
 /**
  * @brief Re-organizes the data blocks such that there is no free block between the used blocks,
- * and between the superblock and the used blocks.
- */
-void fs_defrag(void) {
-    // Find index of lowest available block and first used block
-    size_t fbl_idx = 0;
-    int done = 0;
-    while(!done) {
-        int lowest_avail_idx = -1;
-        int next_used_idx = -1;
-        for (size_t i=fbl_idx; i < 128; i++, fbl_idx++) {
-            if (i == 0) continue;   // skip super block bit
-            int byte = i / 8;
-            int bit  = 7 - (i % 8);
-            if (!(sb->free_block_list[byte] & (1 << bit))) {
-                // Block is marked as free
-                // Store the index of the first free block found if one has not already been found
-                if (lowest_avail_idx == -1) lowest_avail_idx = i;
-            } else {
-                // Block is used
-                // Store the index of the first used block found after the first free block
-                if (lowest_avail_idx != -1 && next_used_idx == -1) {
-                    next_used_idx = i;
-                    break;
-                }
-            }
-        }
-        
-        // If next used_idx was not set in the loop, then there are no more blocks to move
-        if (next_used_idx == -1) {
-            done = 1;
-            continue;
-        }
-    
-        // Get Inode referring to first available block
-        Inode *inode;
-        int inode_idx = 0;
-        for(size_t i=0; i < 126; i++) {
-            uint8_t isused = sb->inode[i].isused_size & (1 << 7);
-            uint8_t isdir  = sb->inode[i].isdir_parent & (1 << 7);
-            uint8_t start_block = sb->inode[i].start_block;
-            if ((start_block == next_used_idx) && !(isdir) && (isused)) {
-                inode = &sb->inode[i];
-                inode_idx = i;
-                break;
-            }
-        }
-        //printf("Moving blocks of inode: %d\n", inode_idx); //TESTING PRINT STATEMENT
-        // Move the block(s)
-        uint8_t size = inode->isused_size & ~(1 << 7);
-        uint8_t start_block = inode->start_block;
-        uint8_t temp_buff[1024];
-        uint8_t zero_buff[1024] = {0};
-        for (size_t i=0; i < size; i++) {
-            lseek(vd, (1024)*(start_block+i), SEEK_SET);
-            read(vd, temp_buff, 1024); // Get data of block to move
-            lseek(vd, (1024)*(start_block+i), SEEK_SET);
-            write(vd, zero_buff, 1024); // Clear the block that is being moved
-            lseek(vd, (1024)*(lowest_avail_idx+i), SEEK_SET);
-            write(vd, temp_buff, 1024); // Write the data to the new block location
-        }
-
-        // "Un"set bits in free block array for old blocks
-        set_fbl_bits(start_block, size, 0);
-
-        // Set bits in free block array for new blocks
-        set_fbl_bits(lowest_avail_idx, size, 1);
-    
-        inode->start_block = lowest_avail_idx; // Set the new start block for the inode
-        // Updated inode in virtual disk
-        write_superblock();
-
-        // Set index for next loop to one block after the block that was moved
-        fbl_idx = lowest_avail_idx + size;
-    }
-    return;
+ * and between the superblock and the used blocks. With a budget only one step runs: starting at the
+ * first free block, the files past it are moved down in start block order until the next file would
+ * take the step past max_blocks blocks or the step has run for max_us microseconds (the first file is
+ * always moved). The superblock is consistent after every step, and the next step picks up at the
+ * first free block, so the free block list itself is the progress cursor (it survives a remount).
+ * 
+ * @param ctx - Context of the simulator instance
+ * @param max_blocks - Most # of blocks the step moves (0 = no limit)
+ * @param max_us - Most # of microseconds the step runs (0 = no limit)
+ * @return Long value # of blocks moved, 0 if the disk has no free block between used blocks
+ */
+long fs_defrag(FsContext *ctx, long max_blocks, long max_us) {
+    lock_mount(ctx, 1);
+    long moved = defrag_step(ctx->mnt, max_blocks, max_us);
+    unlock_mount(ctx);
+    return moved;
 }
 
 /**
  * @brief Changes the current working directory
  * to a directory with the specified name in the current working directory.
  * 
+ * @param ctx - Context of the simulator instance
  * @param name - name of the directory to change to, ".." for previous directory
  */
-void fs_cd(char name[5]) {
+void fs_cd(FsContext *ctx, char name[5]) {
+    FsMount *mnt = ctx->mnt;
     if (memcmp(name, ".\0\0\0\0", 5) == 0) {
         // cd to current directory
         return;
     } else if (memcmp(name, "..\0\0\0", 5) == 0) {
         // cd one directory up
-        if (cwd == 127) return; // Already in root directory
-        // find index of directory one directory up and change cwd
-        for (size_t i=0; i < 126; i++) {
-            if ((sb->inode[i].isdir_parent & (1 << 7)) && i == cwd) {
-                int prevwd = sb->inode[i].isdir_parent & ~(1 << 7);
-                cwd = prevwd;
-                return;
-            }
+        lock_mount(ctx, 0);
+        if (ctx->cwd != mnt->meta.root) {
+            ctx->cwd = mnt->dir_tree.parent[ctx->cwd]; // Change cwd to the parent of the current directory
+            if (ctx->cwd != mnt->meta.root) ctx->cwd_gen = alloc_inode_generation(&mnt->allocator, ctx->cwd);
         }
+        unlock_mount(ctx);
+        return;
     } else {
         // Check if directory exists in cwd
-        int idx = file_exists(name); // index of file or directory with name
-        if (idx == -1 || !(sb->inode[idx].isdir_parent & (1 << 7))) {
-            fprintf(stderr, "Error: Directory %s does not exist\n", name);
+        lock_mount(ctx, 0);
+        int idx = file_exists(ctx, name); // index of file or directory with name
+        if (idx == -1 || !(mnt->meta.inode[idx].flags & INODE_DIR)) {
+            fprintf(ctx->err, "Error: Directory %s does not exist\n", name);
+            unlock_mount(ctx);
             return;
         }
         // Change cwd to index of valid directory
-        cwd = idx;
+        ctx->cwd = idx;
+        ctx->cwd_gen = alloc_inode_generation(&mnt->allocator, idx);
+        unlock_mount(ctx);
         //printf("Current working directory changed to: %d \n", cwd);
         return;
     }
     return;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Writes every dirty cached block and the superblock to the mounted virtual disk
+ * if they have changes that are not on the disk yet (only possible in write-back modes).
+ * 
+ * @param ctx - Context of the simulator instance
+ */
+void fs_sync(FsContext *ctx) {
+    if (ctx->mnt == NULL) return;
+    lock_mount(ctx, 1);
+    sync_mount(ctx->mnt);
+    unlock_mount(ctx);
+}
+
+/**
+ * @brief Prints the statistics of the context: latency of each command type, parsing, lookups and
+ * superblock writes, and the block I/O of the disks unmounted so far plus the mounted one (only what the
+ * context recorded itself if the memory to add them up cannot be allocated).
+ * 
+ * @param ctx - Context of the simulator instance
+ */
+void fs_stats(FsContext *ctx) {
+    FsStats *stats = malloc(sizeof(FsStats));
+    if (stats == NULL) {
+        // No copy to add the mount's counters to, print what the context recorded itself
+        if (ctx->mnt != NULL) lock_mount(ctx, 0);
+        stats_print(ctx->out, &ctx->stats);
+        if (ctx->mnt != NULL) unlock_mount(ctx);
+        return;
+    }
+    memcpy(stats, &ctx->stats, sizeof(FsStats));
+    if (ctx->mnt != NULL) {
+        lock_mount(ctx, 0);
+        stats_merge_latency(&stats->sb_write, &ctx->mnt->sb_write);
+        disk_stats(&ctx->mnt->disk, &stats->io);
+        unlock_mount(ctx);
+    }
+    stats_print(ctx->out, stats);
+    free(stats);
+}
+
+/**
+ * @brief Sets the allocation policy the files created by the context get their blocks by
+ * (see alloc_find_blocks()). The policy stays in effect across mounts until the script ends.
+ * 
+ * @param ctx - Context of the simulator instance
+ * @param policy - Allocation policy (AllocPolicy)
+ */
+void fs_policy(FsContext *ctx, int policy) {
+    ctx->alloc_policy = policy;
+}
+
+/**
+ * @brief Prints the fragmentation of the free space of the mounted virtual disk: # of free blocks,
+ * # of free extents, the largest free extent and the external fragmentation ratio
+ * (1 - largest free extent / free blocks), then the allocation policy of the context, the # of
+ * allocations that found no free run large enough and the # of defrag steps that moved files since mount.
+ * Every number is kept up to date by the allocator, nothing is scanned.
+ * 
+ * @param ctx - Context of the simulator instance
+ */
+void fs_frag(FsContext *ctx) {
+    FsMount *mnt = ctx->mnt;
+    lock_mount(ctx, 0);
+    Allocator *alloc = &mnt->allocator;
+    int free_blocks = alloc->free_blocks;
+    int largest = alloc_largest_extent(alloc);
+    double ratio = free_blocks > 0 ? 1.0 - (double)largest / free_blocks : 0.0;
+    fprintf(ctx->out, "Free blocks: %d, free extents: %d, largest free extent: %d, fragmentation: %.3f\n",
+            free_blocks, alloc_free_extents(alloc), largest, ratio);
+    fprintf(ctx->out, "Allocation policy: %s, failed allocations: %ld, defrags: %ld\n",
+            alloc_policy_name(ctx->alloc_policy), alloc->failures, mnt->defrags);
+    unlock_mount(ctx);
+}
+
+/**
+ * @brief Writes all pending changes to the mounted virtual disk and unmounts it.
+ * 
+ * @param ctx - Context of the simulator instance
+ */
+void fs_unmount(FsContext *ctx) {
+    fs_sync(ctx);
+    release_disk(ctx);
+}
+
+/**
+ * @brief Gets the largest file size (in blocks) that the mounted virtual disk can store.
+ * 
+ * @param ctx - Context of the simulator instance
+ * @return Integer value # of blocks, 127 (the v1 limit) if no disk is mounted
+ */
+int fs_max_file_blocks(FsContext *ctx) {
+    if (ctx->mnt == NULL) return 127;
+    return ctx->mnt->meta.max_file_blocks;
+}
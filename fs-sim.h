@@ -1,102 +1,245 @@
 #ifndef FS_SIM_H
 #define FS_SIM_H
 
+#include "fs-stats.h"
 #include <stdint.h>
 #include <stddef.h>
+#include <stdio.h>
+
+typedef struct FsContext FsContext; // State of one simulator instance (defined in fs-context.h)
 
 typedef struct {
     char name[5];         // name of the file/directory
     uint8_t isused_size;  // state of inode and size of the file/directory
     uint8_t start_block;  // index of the first block of the file/directory
     uint8_t isdir_parent; // type of inode and index of the parent inode
-} Inode;
+} Inode;                  // On-disk inode of a v1 disk
 
 typedef struct {
     uint8_t free_block_list[16];
     Inode inode[126];
-} Superblock;
+} Superblock;               // On-disk superblock of a v1 disk
+
+typedef struct {
+    long rules_1_4_ns;  // Time spent in the single pass over the inodes (rules 1-4)
+    long rule_5_ns;     // Time spent checking for duplicate names (rule 5)
+    long rule_6_ns;     // Time spent comparing the free block list with the inodes (rule 6)
+    long total_ns;      // Time spent in the whole check
+} CheckTiming;
 
 typedef struct {
     char *input_file;   // Name of file the command originated from
     size_t line_num;    // Line number the command is on
     char *type;         // Command type ex. "M"
     char **argv;        // Command arg array
-    uint8_t buff[1024]; // buffer (ONLY USED IN BUFFER COMMAND)
+    uint8_t *buff;      // 1024 byte buffer (ONLY USED IN BUFFER COMMAND)
     size_t size;        // # of args (including the command)
+    char name[5];       // Name arg padded with 0s and lowercased (decoded by validation)
+    long num;           // Integer arg, file size, block number, allocation policy or defrag block budget (decoded by validation)
+    long count;         // Second integer arg, # of blocks of a range read/write or defrag time budget (decoded by validation)
+    char new_name[5];   // Second name arg, name of a copy (decoded by validation)
 } Command;
 
+/**
+ * @brief Sets up a context with no disk mounted and a zeroed buffer.
+ * 
+ * @param ctx - Context to initialize
+ * @param out - Stream that ls output is printed to
+ * @param err - Stream that error messages are printed to
+ */
+void fs_init(FsContext *ctx, FILE *out, FILE *err);
+
+/**
+ * @brief Releases the memory held by a context (its disk must be unmounted first).
+ * 
+ * @param ctx - Context to release
+ */
+void fs_destroy(FsContext *ctx);
+
+/**
+ * @brief Closes every shared mount that disk_keep_mounted left loaded with no users, adding
+ * their superblock writes and block I/O to a set of statistics.
+ * 
+ * @param stats - Statistics to add the counters of the closed mounts to
+ */
+void fs_release_kept_mounts(FsStats *stats);
+
 /**
  * @brief Mounts the file system residing on the specified virtual disk.
  * 
+ * @param ctx - Context of the simulator instance
  * @param new_disk_name - name of disk to be mounted
  */
-void fs_mount(char *new_disk_name);
+void fs_mount(FsContext *ctx, char *new_disk_name);
 
 /**
  * @brief Creates a new file or directory in the current working directory 
  * with the given name and the given number of blocks, 
  * and stores the attributes in the first available inode. 
  * 
+ * @param ctx - Context of the simulator instance
  * @param name - Name of the file or directory to create
  * @param size - # of contiguous block the file will require (0 if directory)
  */
-void fs_create(char name[5], int size);
+void fs_create(FsContext *ctx, char name[5], int size);
+
+/**
+ * @brief Copies the file with the given name to a new file in the current working directory.
+ * The new file gets its blocks by the same rules as fs_create(), the data is copied inside the
+ * kernel (see disk_copy()) and the superblock is committed once, after the data.
+ * 
+ * @param ctx - Context of the simulator instance
+ * @param name - Name of the file to copy
+ * @param new_name - Name of the file to create
+ */
+void fs_copy(FsContext *ctx, char name[5], char new_name[5]);
 
 /**
  * @brief Deletes the file or directory with the given name in the current working directory. 
  * 
+ * @param ctx - Context of the simulator instance
  * @param name - name of the file or directory to be deleted
  */
-void fs_delete(char name[5]);
+void fs_delete(FsContext *ctx, char name[5]);
 
 /**
  * @brief Opens the file with the given name 
  * and reads the block num-th block of the file into the buffer.
  * 
+ * @param ctx - Context of the simulator instance
  * @param name - name of the file to read
  * @param block_num - index of the block to read [0, size-1]
  */
-void fs_read(char name[5], int block_num);
+void fs_read(FsContext *ctx, char name[5], int block_num);
 
 /**
  * @brief Opens the file with the given name 
  * and writes the content of the buffer to the block num-th block of the file.
  * 
+ * @param ctx - Context of the simulator instance
  * @param name - name of file to open
  * @param block_num - block number of file to write to
  */
-void fs_write(char name[5], int block_num);
+void fs_write(FsContext *ctx, char name[5], int block_num);
+
+/**
+ * @brief Opens the file with the given name and reads count blocks of the file,
+ * starting at the block num-th block, into the range buffer with one vectored read.
+ * 
+ * @param ctx - Context of the simulator instance
+ * @param name - name of the file to read
+ * @param block_num - index of the first block to read [0, size-1]
+ * @param count - # of blocks to read
+ */
+void fs_read_range(FsContext *ctx, char name[5], int block_num, int count);
+
+/**
+ * @brief Opens the file with the given name and writes count blocks of the file, starting at the
+ * block num-th block, with vectored writes. The blocks come from the range buffer (repeated if it holds
+ * fewer blocks), or from the buffer if it was changed by a BUFFER or READ command since the last range read.
+ * 
+ * @param ctx - Context of the simulator instance
+ * @param name - name of file to open
+ * @param block_num - first block number of file to write to
+ * @param count - # of blocks to write
+ */
+void fs_write_range(FsContext *ctx, char name[5], int block_num, int count);
 
 /**
  * @brief Flushes the buffer by zeroing it and writes the new bytes into the buffer.
  * 
+ * @param ctx - Context of the simulator instance
  * @param buff - buffered values from input to send to file system buffer
  */
-void fs_buff(uint8_t buff[1024]);
+void fs_buff(FsContext *ctx, uint8_t buff[1024]);
 
 /**
  * @brief Lists all files and directories that exist in the current directory.
+ * 
+ * @param ctx - Context of the simulator instance
  */
-void fs_ls(void);
+void fs_ls(FsContext *ctx);
 
 /**
  * @brief Re-organizes the data blocks such that there is no free block between the used blocks,
- * and between the superblock and the used blocks.
+ * and between the superblock and the used blocks. With a budget only one step runs: starting at the
+ * first free block, the files past it are moved down in start block order until the next file would
+ * take the step past max_blocks blocks or the step has run for max_us microseconds (the first file is
+ * always moved). The superblock is consistent after every step, and the next step picks up at the
+ * first free block, so the free block list itself is the progress cursor (it survives a remount).
+ * 
+ * @param ctx - Context of the simulator instance
+ * @param max_blocks - Most # of blocks the step moves (0 = no limit)
+ * @param max_us - Most # of microseconds the step runs (0 = no limit)
+ * @return Long value # of blocks moved, 0 if the disk has no free block between used blocks
  */
-void fs_defrag(void);
+long fs_defrag(FsContext *ctx, long max_blocks, long max_us);
 
 /**
  * @brief Changes the current working directory
  * to a directory with the specified name in the current working directory.
  * 
+ * @param ctx - Context of the simulator instance
  * @param name - name of the directory to change to, ".." for previous directory
  */
-void fs_cd(char name[5]);
+void fs_cd(FsContext *ctx, char name[5]);
+
+/**
+ * @brief Writes every dirty cached block and the superblock to the mounted virtual disk
+ * if they have changes that are not on the disk yet (only possible in write-back modes).
+ * 
+ * @param ctx - Context of the simulator instance
+ */
+void fs_sync(FsContext *ctx);
+
+/**
+ * @brief Prints the statistics of the context: latency of each command type, parsing, lookups and
+ * superblock writes, and the block I/O of the disks unmounted so far plus the mounted one.
+ * 
+ * @param ctx - Context of the simulator instance
+ */
+void fs_stats(FsContext *ctx);
+
+/**
+ * @brief Sets the allocation policy the files created by the context get their blocks by
+ * (see alloc_find_blocks()). The policy stays in effect across mounts until the script ends.
+ * 
+ * @param ctx - Context of the simulator instance
+ * @param policy - Allocation policy (AllocPolicy)
+ */
+void fs_policy(FsContext *ctx, int policy);
+
+/**
+ * @brief Prints the fragmentation of the free space of the mounted virtual disk: # of free blocks,
+ * # of free extents, the largest free extent and the external fragmentation ratio
+ * (1 - largest free extent / free blocks), then the allocation policy of the context, the # of
+ * allocations that found no free run large enough and the # of defrag steps that moved files since mount.
+ * Every number is kept up to date by the allocator, nothing is scanned.
+ * 
+ * @param ctx - Context of the simulator instance
+ */
+void fs_frag(FsContext *ctx);
+
+/**
+ * @brief Writes all pending changes to the mounted virtual disk and unmounts it.
+ * 
+ * @param ctx - Context of the simulator instance
+ */
+void fs_unmount(FsContext *ctx);
+
+/**
+ * @brief Gets the largest file size (in blocks) that the mounted virtual disk can store.
+ * 
+ * @param ctx - Context of the simulator instance
+ * @return Integer value # of blocks, 127 (the v1 limit) if no disk is mounted
+ */
+int fs_max_file_blocks(FsContext *ctx);
 
-extern int vd; // Virtual Disk file descriptor
-extern int cwd; // Current working directory (root directory is 127)
-extern char *disk_name; // Name of current mounted disk
-extern uint8_t fs_buffer[1024]; // File system buffer
-extern Superblock *sb; // Superblock of current virtual disk
+extern int sb_writeback; // If 1, superblock changes are held in memory until a sync point
+extern int check_timing_report; // If 1, fs_mount prints the consistency check timing to stderr
+extern int sb_sync_every; // In write-back mode, sync after this many mutations (0 = only at sync points)
+extern int disk_shared; // If 1, every context that mounts the same disk image shares one thread-safe mount
+extern int defrag_blocks; // If > 0, a background thread defrags every mounted disk, moving at most this many blocks per step
+extern int disk_keep_mounted; // If 1 (daemon mode), shared mounts stay loaded after their last user leaves
 
 #endif
\ No newline at end of file
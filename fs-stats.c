@@ -0,0 +1,123 @@
+#include "fs-stats.h"
+#include <time.h>
+
+/**
+ * @brief Gets the histogram bucket of a sample (the # of bits needed to hold it).
+ */
+static int bucket_of(long ns) {
+    if (ns <= 0) return 0;
+    int b = 64 - __builtin_clzl((unsigned long)ns);
+    return b < STATS_BUCKETS ? b : STATS_BUCKETS - 1;
+}
+
+long stats_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+void stats_record(Latency *lat, long ns) {
+    lat->count++;
+    lat->total_ns += ns;
+    if (ns > lat->max_ns) lat->max_ns = ns;
+    lat->hist[bucket_of(ns)]++;
+}
+
+long stats_percentile(const Latency *lat, int pct) {
+    if (lat->count == 0) return 0;
+    unsigned long rank = (lat->count * pct + 99) / 100; // Smallest # of samples at or below the percentile
+    if (rank == 0) rank = 1;
+    unsigned long seen = 0;
+    for (int b=0; b < STATS_BUCKETS; b++) {
+        seen += lat->hist[b];
+        if (seen >= rank) {
+            long bound = b == 0 ? 0 : 1L << b;
+            return bound < lat->max_ns ? bound : lat->max_ns;
+        }
+    }
+    return lat->max_ns;
+}
+
+void stats_merge_latency(Latency *dst, const Latency *src) {
+    dst->count += src->count;
+    dst->total_ns += src->total_ns;
+    if (src->max_ns > dst->max_ns) dst->max_ns = src->max_ns;
+    for (int b=0; b < STATS_BUCKETS; b++) dst->hist[b] += src->hist[b];
+}
+
+void stats_merge_io(IoStats *dst, const IoStats *src) {
+    dst->syscalls += src->syscalls;
+    dst->reads += src->reads;
+    dst->writes += src->writes;
+    dst->bytes_read += src->bytes_read;
+    dst->bytes_written += src->bytes_written;
+    dst->ns += src->ns;
+}
+
+void stats_merge(FsStats *dst, const FsStats *src) {
+    for (int c=0; c < STATS_COMMANDS; c++) stats_merge_latency(&dst->command[c], &src->command[c]);
+    stats_merge_latency(&dst->invalid, &src->invalid);
+    stats_merge_latency(&dst->parse, &src->parse);
+    dst->lookups += src->lookups;
+    stats_merge_latency(&dst->sb_write, &src->sb_write);
+    stats_merge_io(&dst->io, &src->io);
+}
+
+/**
+ * @brief Prints one row of the statistics table.
+ */
+static void print_row(FILE *out, const char *label, const Latency *lat) {
+    if (lat->count == 0) return;
+    fprintf(out, "%-9s %10lu %12ld %9ld %9ld %9ld %9ld %9ld\n", label, lat->count, lat->total_ns / 1000,
+            (long)(lat->total_ns / lat->count), stats_percentile(lat, 50), stats_percentile(lat, 90),
+            stats_percentile(lat, 99), lat->max_ns);
+}
+
+void stats_print(FILE *out, const FsStats *stats) {
+    fprintf(out, "%-9s %10s %12s %9s %9s %9s %9s %9s\n", "Command", "Count", "Total(us)", "Avg(ns)",
+            "p50(ns)", "p90(ns)", "p99(ns)", "Max(ns)");
+    for (int c=0; c < STATS_COMMANDS; c++) {
+        char label[2] = { (char)c, '\0' };
+        print_row(out, label, &stats->command[c]);
+    }
+    print_row(out, "invalid", &stats->invalid);
+    print_row(out, "parse", &stats->parse);
+    print_row(out, "sb_write", &stats->sb_write);
+    fprintf(out, "Lookups: %lu\n", stats->lookups);
+
+    const IoStats *io = &stats->io;
+    fprintf(out, "I/O: %lu syscalls, %lu reads (%lu bytes), %lu writes (%lu bytes), %ld us\n", io->syscalls,
+            io->reads, io->bytes_read, io->writes, io->bytes_written, io->ns / 1000);
+}
+
+/**
+ * @brief Prints one histogram as a JSON object (percentiles only, the buckets are not printed).
+ */
+static void print_latency_json(FILE *out, const Latency *lat) {
+    fprintf(out, "{\"count\":%lu,\"total_ns\":%ld,\"p50_ns\":%ld,\"p90_ns\":%ld,\"p99_ns\":%ld,\"max_ns\":%ld}",
+            lat->count, lat->total_ns, stats_percentile(lat, 50), stats_percentile(lat, 90),
+            stats_percentile(lat, 99), lat->max_ns);
+}
+
+void stats_print_json(FILE *out, const FsStats *stats) {
+    fprintf(out, "{\"commands\":{");
+    int first = 1;
+    for (int c=0; c < STATS_COMMANDS; c++) {
+        if (stats->command[c].count == 0) continue;
+        fprintf(out, "%s\"%c\":", first ? "" : ",", c);
+        print_latency_json(out, &stats->command[c]);
+        first = 0;
+    }
+    fprintf(out, "},\"invalid\":");
+    print_latency_json(out, &stats->invalid);
+    fprintf(out, ",\"parse\":");
+    print_latency_json(out, &stats->parse);
+    fprintf(out, ",\"sb_write\":");
+    print_latency_json(out, &stats->sb_write);
+
+    fprintf(out, ",\"lookups\":%lu", stats->lookups);
+
+    const IoStats *io = &stats->io;
+    fprintf(out, ",\"io\":{\"syscalls\":%lu,\"reads\":%lu,\"writes\":%lu,\"bytes_read\":%lu,\"bytes_written\":%lu,\"ns\":%ld}}\n",
+            io->syscalls, io->reads, io->writes, io->bytes_read, io->bytes_written, io->ns);
+}
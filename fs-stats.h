@@ -0,0 +1,99 @@
+#ifndef FS_STATS_H
+#define FS_STATS_H
+
+#include <stdio.h>
+
+#define STATS_BUCKETS 40 // # of log2 latency buckets (the last one holds everything >= 2^38 ns)
+#define STATS_COMMANDS 128 // # of command bytes that get their own counters
+
+typedef struct {
+    unsigned long count;    // # of samples
+    long total_ns;          // Sum of all samples
+    long max_ns;            // Largest sample
+    unsigned long hist[STATS_BUCKETS]; // hist[b] = # of samples in [2^(b-1), 2^b) ns (hist[0] = 0 ns)
+} Latency;
+
+typedef struct {
+    unsigned long syscalls;     // # of system calls made for block I/O (pread, pwrite, fallocate, lseek, msync, io_uring_enter)
+    unsigned long reads;        // # of block reads (one per call, whatever the engine)
+    unsigned long writes;       // # of block writes (one per call, whatever the engine)
+    unsigned long bytes_read;   // # of bytes read from the disk
+    unsigned long bytes_written; // # of bytes written to the disk (zeroed ranges included, punched holes are not)
+    long ns;                    // Time spent in synchronous block I/O
+} IoStats;
+
+typedef struct {
+    Latency command[STATS_COMMANDS]; // Run time of the valid commands of each type (indexed by command byte)
+    Latency invalid;        // Commands that failed validation or needed a disk
+    Latency parse;          // Time to parse each line of the input file
+    Latency sb_write;       // Superblock writes
+    unsigned long lookups;  // # of file_exists() lookups (not timed, a lookup costs less than reading the clock)
+    IoStats io;             // Block I/O of the disks that were unmounted
+} FsStats;
+
+/**
+ * @brief Gets the current time in nanoseconds on the monotonic clock.
+ *
+ * @return Nanoseconds since an arbitrary starting point
+ */
+long stats_now(void);
+
+/**
+ * @brief Adds one sample to a latency histogram.
+ *
+ * @param lat - Histogram to update
+ * @param ns - Sample in nanoseconds
+ */
+void stats_record(Latency *lat, long ns);
+
+/**
+ * @brief Gets a percentile of a latency histogram. The result is the upper bound of the
+ * bucket the percentile falls in (capped at the largest sample), so it is exact to within 2x.
+ *
+ * @param lat - Histogram to query
+ * @param pct - Percentile between 0 and 100
+ * @return Latency in nanoseconds, 0 if there are no samples
+ */
+long stats_percentile(const Latency *lat, int pct);
+
+/**
+ * @brief Adds the samples of one histogram to another.
+ *
+ * @param dst - Histogram to update
+ * @param src - Histogram to add
+ */
+void stats_merge_latency(Latency *dst, const Latency *src);
+
+/**
+ * @brief Adds the counters of one I/O record to another.
+ *
+ * @param dst - Record to update
+ * @param src - Record to add
+ */
+void stats_merge_io(IoStats *dst, const IoStats *src);
+
+/**
+ * @brief Adds every counter and histogram of one set of statistics to another.
+ *
+ * @param dst - Statistics to update
+ * @param src - Statistics to add
+ */
+void stats_merge(FsStats *dst, const FsStats *src);
+
+/**
+ * @brief Prints statistics as a table with one row per command type (types that never ran are skipped).
+ *
+ * @param out - Stream to print to
+ * @param stats - Statistics to print
+ */
+void stats_print(FILE *out, const FsStats *stats);
+
+/**
+ * @brief Prints statistics as a single JSON object followed by a newline.
+ *
+ * @param out - Stream to print to
+ * @param stats - Statistics to print
+ */
+void stats_print_json(FILE *out, const FsStats *stats);
+
+#endif
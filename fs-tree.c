@@ -0,0 +1,88 @@
+#include "fs-tree.h"
+#include <stdlib.h>
+
+/**
+ * @brief Compares two inode indexes for qsort.
+ */
+static int compare_idx(const void *a, const void *b) {
+    return *(const int *)a - *(const int *)b;
+}
+
+int tree_init(DirTree *tree, FsMeta *m) {
+    tree->root = m->root;
+    tree->nnodes = (m->root + 1 > m->ninodes) ? m->root + 1 : m->ninodes;
+    tree->parent = malloc(tree->nnodes * sizeof(int));
+    tree->first_child = malloc(tree->nnodes * sizeof(int));
+    tree->last_child = malloc(tree->nnodes * sizeof(int));
+    tree->next_sibling = malloc(tree->nnodes * sizeof(int));
+    tree->prev_sibling = malloc(tree->nnodes * sizeof(int));
+    tree->child_count = calloc(tree->nnodes, sizeof(int));
+    if (tree->parent == NULL || tree->first_child == NULL || tree->last_child == NULL || tree->next_sibling == NULL ||
+        tree->prev_sibling == NULL || tree->child_count == NULL) {
+        tree_destroy(tree);
+        return -1;
+    }
+    for (int i=0; i < tree->nnodes; i++) {
+        tree->parent[i] = -1;
+        tree->first_child[i] = -1;
+        tree->last_child[i] = -1;
+        tree->next_sibling[i] = -1;
+        tree->prev_sibling[i] = -1;
+    }
+
+    // Add in ascending order so every child list starts out in ascending inode order
+    for (int i=0; i < m->ninodes; i++) {
+        FsInode *inode = &m->inode[i];
+        if (inode->flags & INODE_USED) tree_add(tree, i, inode->parent);
+    }
+    return 0;
+}
+
+void tree_destroy(DirTree *tree) {
+    free(tree->parent);
+    free(tree->first_child);
+    free(tree->last_child);
+    free(tree->next_sibling);
+    free(tree->prev_sibling);
+    free(tree->child_count);
+    tree->parent = tree->first_child = tree->last_child = tree->next_sibling = tree->prev_sibling = tree->child_count = NULL;
+}
+
+void tree_add(DirTree *tree, int inode_idx, int parent) {
+    // Append to the end of the parent's child list
+    int tail = tree->last_child[parent];
+    tree->parent[inode_idx] = parent;
+    tree->prev_sibling[inode_idx] = tail;
+    tree->next_sibling[inode_idx] = -1;
+    if (tail != -1) tree->next_sibling[tail] = inode_idx;
+    else tree->first_child[parent] = inode_idx;
+    tree->last_child[parent] = inode_idx;
+    tree->child_count[parent]++;
+}
+
+void tree_remove(DirTree *tree, int inode_idx) {
+    int parent = tree->parent[inode_idx];
+    if (parent == -1) return; // Inode is not in the tree
+    int prev = tree->prev_sibling[inode_idx];
+    int next = tree->next_sibling[inode_idx];
+    if (prev != -1) tree->next_sibling[prev] = next;
+    else tree->first_child[parent] = next;
+    if (next != -1) tree->prev_sibling[next] = prev;
+    else tree->last_child[parent] = prev;
+    tree->child_count[parent]--;
+    tree->parent[inode_idx] = -1;
+    tree->next_sibling[inode_idx] = -1;
+    tree->prev_sibling[inode_idx] = -1;
+}
+
+int tree_children(DirTree *tree, int dir, int *children) {
+    int count = 0;
+    int sorted = 1;
+    for (int c = tree->first_child[dir]; c != -1; c = tree->next_sibling[c]) {
+        if (count > 0 && children[count - 1] > c) sorted = 0;
+        children[count++] = c;
+    }
+    // Lists are only out of order after an inode was reused, so this sort is usually skipped
+    if (!sorted) qsort(children, count, sizeof(int), compare_idx);
+    return count;
+}
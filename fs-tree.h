@@ -0,0 +1,61 @@
+#ifndef FS_TREE_H
+#define FS_TREE_H
+
+#include "fs-meta.h"
+
+typedef struct {
+    int nnodes;         // # of nodes in the tree (every inode plus the root directory)
+    int root;           // node index of the root directory (127 for v1 disks)
+    int *parent;        // node index of the parent directory of each node, -1 if not in the tree
+    int *first_child;   // node index of the first child of each directory, -1 if empty
+    int *last_child;    // node index of the last child of each directory, -1 if empty
+    int *next_sibling;  // node index of the next child in the same directory, -1 if last
+    int *prev_sibling;  // node index of the previous child in the same directory, -1 if first
+    int *child_count;   // # of children of each directory
+} DirTree;
+
+/**
+ * @brief Builds the directory tree (child lists, child counts and parent links)
+ * for every used inode of a disk.
+ *
+ * @param tree - Tree to initialize
+ * @param m - Metadata of the disk to build the tree from
+ * @return Integer value 0 if built, -1 if its arrays cannot be allocated (nothing is left allocated)
+ */
+int tree_init(DirTree *tree, FsMeta *m);
+
+/**
+ * @brief Releases all memory held by the tree.
+ *
+ * @param tree - Tree to free
+ */
+void tree_destroy(DirTree *tree);
+
+/**
+ * @brief Appends an inode to the child list of its parent directory.
+ *
+ * @param tree - Tree to update
+ * @param inode_idx - Index of the inode to add
+ * @param parent - Index of the parent directory inode (the root index for root)
+ */
+void tree_add(DirTree *tree, int inode_idx, int parent);
+
+/**
+ * @brief Removes an inode from the child list of its parent directory.
+ *
+ * @param tree - Tree to update
+ * @param inode_idx - Index of the inode to remove
+ */
+void tree_remove(DirTree *tree, int inode_idx);
+
+/**
+ * @brief Copies the children of a directory into an array in ascending inode order.
+ *
+ * @param tree - Tree to read
+ * @param dir - Index of the directory inode (the root index for root)
+ * @param children - Array to fill, must hold at least child_count[dir] entries
+ * @return Integer value # of children copied
+ */
+int tree_children(DirTree *tree, int dir, int *children);
+
+#endif
@@ -0,0 +1,236 @@
+#include "fs-uring.h"
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+
+/**
+ * @brief Checks if the kernel supports the read and write opcodes the ring uses.
+ */
+static int ring_supported(int ring_fd) {
+    size_t len = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, len);
+    int ok = 0;
+    if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PROBE, probe, 256) == 0) {
+        ok = probe->last_op >= IORING_OP_WRITE &&
+             (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED) &&
+             (probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+    return ok;
+}
+
+/**
+ * @brief Passes the queued requests to the kernel and waits for min_complete completions.
+ */
+static void ring_enter(IoRing *ring, unsigned min_complete) {
+    for (;;) {
+        unsigned flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+        int n = syscall(__NR_io_uring_enter, ring->ring_fd, ring->unsubmitted, min_complete, flags, NULL, 0);
+        ring->enters++;
+        if (n == -1) {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY) continue;
+            return;
+        }
+        if (ring->unsubmitted > 0) {
+            ring->submits++;
+            ring->requests += n;
+        }
+        ring->unsubmitted -= n;
+        if (ring->unsubmitted == 0) return;
+    }
+}
+
+/**
+ * @brief Marks the slot of every completion in the completion queue as done.
+ */
+static void ring_reap(IoRing *ring) {
+    struct io_uring_cqe *cqes = ring->cqes;
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        struct io_uring_cqe *cqe = &cqes[head & *ring->cq_mask];
+        ring->result[cqe->user_data] = cqe->res;
+        ring->done[cqe->user_data] = 1;
+        head++;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Frees the completed slots at the head of the ring, in submission order.
+ * Read data is copied to its destination as its slot is freed.
+ */
+static void ring_retire(IoRing *ring) {
+    while (ring->count > 0 && ring->done[ring->head]) {
+        int slot = ring->head;
+        if (ring->dest[slot] != NULL) {
+            // Like read(), a short read only fills in the bytes that were read
+            if (ring->result[slot] > 0) memcpy(ring->dest[slot], ring->data + (1024)*slot, ring->result[slot]);
+            ring->dest[slot] = NULL;
+            ring->reads--;
+        }
+        ring->inflight[ring->block[slot]]--;
+        ring->done[slot] = 0;
+        ring->head = (ring->head + 1) % ring->depth;
+        ring->count--;
+    }
+}
+
+/**
+ * @brief Gets a free slot, waiting for the oldest request if every slot is in flight.
+ */
+static int ring_take_slot(IoRing *ring) {
+    while (ring->count == ring->depth) {
+        ring_enter(ring, 1);
+        ring_reap(ring);
+        ring_retire(ring);
+    }
+    int slot = (ring->head + ring->count) % ring->depth;
+    ring->count++;
+    return slot;
+}
+
+/**
+ * @brief Adds a read or write of a slot's block to the submission queue. A request for a block
+ * that already has a request in flight is only started once every earlier request completed.
+ */
+static void ring_queue(IoRing *ring, int slot, int opcode) {
+    struct io_uring_sqe *sqes = ring->sqes;
+    unsigned tail = *ring->sq_tail;
+    unsigned idx = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &sqes[idx];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode = opcode;
+    sqe->fd = ring->disk_fd;
+    sqe->addr = (uint64_t)(uintptr_t)(ring->data + (1024)*slot);
+    sqe->len = 1024;
+    sqe->off = (uint64_t)(1024)*ring->block[slot];
+    sqe->user_data = slot;
+    if (ring->inflight[ring->block[slot]] > 0) sqe->flags |= IOSQE_IO_DRAIN; // Same block, keep the order
+    ring->inflight[ring->block[slot]]++;
+    ring->sq_array[idx] = idx;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->unsubmitted++;
+}
+
+int ring_init(IoRing *ring, int fd, int nblocks, int depth) {
+    memset(ring, 0, sizeof(IoRing));
+    ring->ring_fd = -1;
+    if (depth <= 0) return -1;
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int ring_fd = syscall(__NR_io_uring_setup, depth, &params);
+    if (ring_fd < 0) return -1; // Kernel without io_uring (or blocked by a sandbox)
+    if (!ring_supported(ring_fd)) {
+        close(ring_fd);
+        return -1;
+    }
+
+    // Map the submission queue, completion queue and submission queue entries
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    int single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap) {
+        if (ring->cq_ring_size > ring->sq_ring_size) ring->sq_ring_size = ring->cq_ring_size;
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         ring_fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) {
+        close(ring_fd);
+        return -1;
+    }
+    ring->cq_ring = ring->sq_ring;
+    if (!single_mmap) {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                             ring_fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring == MAP_FAILED) {
+            munmap(ring->sq_ring, ring->sq_ring_size);
+            close(ring_fd);
+            return -1;
+        }
+    }
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring_fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        if (!single_mmap) munmap(ring->cq_ring, ring->cq_ring_size);
+        munmap(ring->sq_ring, ring->sq_ring_size);
+        close(ring_fd);
+        return -1;
+    }
+    ring->sq_tail  = (unsigned *)(ring->sq_ring + params.sq_off.tail);
+    ring->sq_mask  = (unsigned *)(ring->sq_ring + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(ring->sq_ring + params.sq_off.array);
+    ring->cq_head  = (unsigned *)(ring->cq_ring + params.cq_off.head);
+    ring->cq_tail  = (unsigned *)(ring->cq_ring + params.cq_off.tail);
+    ring->cq_mask  = (unsigned *)(ring->cq_ring + params.cq_off.ring_mask);
+    ring->cqes     = ring->cq_ring + params.cq_off.cqes;
+
+    ring->ring_fd = ring_fd;
+    ring->disk_fd = fd;
+    ring->nblocks = nblocks;
+    ring->depth = params.sq_entries < (unsigned)depth ? (int)params.sq_entries : depth;
+    ring->data = malloc((size_t)(1024)*ring->depth);
+    ring->dest = calloc(ring->depth, sizeof(uint8_t *));
+    ring->block = calloc(ring->depth, sizeof(int));
+    ring->result = calloc(ring->depth, sizeof(int));
+    ring->done = calloc(ring->depth, 1);
+    ring->inflight = calloc(nblocks, sizeof(int));
+    if (ring->data == NULL || ring->dest == NULL || ring->block == NULL || ring->result == NULL || ring->done == NULL ||
+        ring->inflight == NULL) {
+        ring_destroy(ring); // Nothing is in flight yet
+        ring->ring_fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+void ring_destroy(IoRing *ring) {
+    if (ring->ring_fd == -1) return;
+    ring_wait(ring);
+    munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring != ring->sq_ring) munmap(ring->cq_ring, ring->cq_ring_size);
+    munmap(ring->sq_ring, ring->sq_ring_size);
+    close(ring->ring_fd);
+    free(ring->data);
+    free(ring->dest);
+    free(ring->block);
+    free(ring->result);
+    free(ring->done);
+    free(ring->inflight);
+    memset(ring, 0, sizeof(IoRing));
+    ring->ring_fd = -1;
+}
+
+void ring_read(IoRing *ring, int block, uint8_t *buff) {
+    int slot = ring_take_slot(ring);
+    ring->block[slot] = block;
+    ring->dest[slot] = buff;
+    ring->reads++;
+    ring_queue(ring, slot, IORING_OP_READ);
+}
+
+void ring_write(IoRing *ring, int block, const uint8_t *buff) {
+    if (ring->reads > 0) ring_wait(ring); // buff may still be waiting for read data
+    int slot = ring_take_slot(ring);
+    ring->block[slot] = block;
+    memcpy(ring->data + (1024)*slot, buff, 1024);
+    ring_queue(ring, slot, IORING_OP_WRITE);
+}
+
+void ring_wait(IoRing *ring) {
+    while (ring->count > 0) {
+        // Wait for every request that has not completed yet with one call
+        unsigned waiting = 0;
+        for (int i=0; i < ring->count; i++) waiting += !ring->done[(ring->head + i) % ring->depth];
+        ring_enter(ring, waiting);
+        ring_reap(ring);
+        ring_retire(ring);
+    }
+}
@@ -0,0 +1,86 @@
+#ifndef FS_URING_H
+#define FS_URING_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct {
+    int ring_fd;            // io_uring file descriptor
+    int disk_fd;            // Virtual disk file descriptor the requests are for
+    int nblocks;            // # of blocks on the virtual disk
+    int depth;              // # of requests that can be in flight at once
+    uint8_t *sq_ring;       // Submission queue ring mapping
+    uint8_t *cq_ring;       // Completion queue ring mapping (same as sq_ring with a single mmap)
+    size_t sq_ring_size;    // # of bytes mapped for sq_ring
+    size_t cq_ring_size;    // # of bytes mapped for cq_ring
+    void *sqes;             // Submission queue entries mapping
+    size_t sqes_size;       // # of bytes mapped for sqes
+    unsigned *sq_tail;      // Submission queue tail (written by us)
+    unsigned *sq_mask;      // Submission queue index mask
+    unsigned *sq_array;     // Submission queue index array
+    unsigned *cq_head;      // Completion queue head (written by us)
+    unsigned *cq_tail;      // Completion queue tail (written by the kernel)
+    unsigned *cq_mask;      // Completion queue index mask
+    void *cqes;             // Completion queue entries
+    uint8_t *data;          // 1024 byte staging buffer for each slot
+    uint8_t **dest;         // Where each read slot copies its block to, NULL for writes
+    int *block;             // Block of each slot
+    int *result;            // Result of each completed slot
+    uint8_t *done;          // 1 if the slot has completed
+    int head;               // Oldest slot in flight
+    int count;              // # of slots in flight
+    int unsubmitted;        // # of queued requests not yet passed to the kernel
+    int reads;              // # of read slots in flight
+    int *inflight;          // # of slots in flight for each block
+    unsigned long submits;  // # of io_uring_enter() calls that submitted requests
+    unsigned long requests; // # of requests submitted
+    unsigned long enters;   // # of io_uring_enter() calls (submitting or waiting)
+} IoRing;                   // Not thread-safe: a ring belongs to one thread, which is the only one that may call the functions below
+
+/**
+ * @brief Sets up an io_uring instance for single block reads and writes of a virtual disk.
+ *
+ * @param ring - Ring to initialize
+ * @param fd - File descriptor of the virtual disk
+ * @param nblocks - # of blocks on the virtual disk
+ * @param depth - # of requests that can be in flight at once
+ * @return Integer value 0 if the ring is ready, -1 if io_uring is not available or its buffers cannot be allocated
+ */
+int ring_init(IoRing *ring, int fd, int nblocks, int depth);
+
+/**
+ * @brief Waits for every request in flight and releases the ring.
+ *
+ * @param ring - Ring to release
+ */
+void ring_destroy(IoRing *ring);
+
+/**
+ * @brief Queues a read of one block. buff is filled in by the time ring_wait() returns.
+ * A read of a block with a request in flight is only started after that request completed.
+ *
+ * @param ring - Ring to queue on
+ * @param block - Index of the block to read
+ * @param buff - Buffer to read 1024 bytes into
+ */
+void ring_read(IoRing *ring, int block, uint8_t *buff);
+
+/**
+ * @brief Queues a write of one block. buff is copied, so it can be reused right away.
+ * Reads in flight are completed first since buff may be the destination of one of them.
+ *
+ * @param ring - Ring to queue on
+ * @param block - Index of the block to write
+ * @param buff - Buffer holding 1024 bytes
+ */
+void ring_write(IoRing *ring, int block, const uint8_t *buff);
+
+/**
+ * @brief Submits every queued request and waits until all of them completed,
+ * copying read data to its destination in submission order.
+ *
+ * @param ring - Ring to wait on
+ */
+void ring_wait(IoRing *ring);
+
+#endif
@@ -1,59 +1,67 @@
 #include "fs-validate.h"
+#include "fs-alloc.h"
 #include <string.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <ctype.h>
 
 /**
- * @brief Validate the given command based on the command it will execute.
+ * @brief Pad a string to a given length (determined by the size of padded_str arg)
  * 
- * @param cmd - Instance of the command struct that contains information about command to run.
- * @return Integer value 0 if invalid, 1 if valid.
+ * @param str - The string to pad
+ * @param len - length of the original string 
+ * @param padded_str - The padded string to fill with characters of the orginal string (up to len)
  */
-int validateCommand(Command *cmd) {
-    // Return invalid for empty commands
-    if (cmd->type == NULL || cmd->size == 0) return 0;
-    
-    // Run the commands respective validate function
-    if (!strcmp(cmd->type, "M")) {
-        // MOUNT virtual disk
-        return fs_mount_valid(cmd);
-    } else if (!strcmp(cmd->type, "C")) {
-        // CREATE a file
-        return fs_create_valid(cmd);
-    } else if (!strcmp(cmd->type, "D")) {
-        // DELETE a file
-        return fs_delete_valid(cmd);
-    } else if (!strcmp(cmd->type, "R")) {
-        // READ a file
-        return fs_read_valid(cmd);
-    } else if (!strcmp(cmd->type, "W")) {
-        // WRITE to a file
-        return fs_write_valid(cmd);
-    } else if (!strcmp(cmd->type, "B")) {
-        // update the BUFFER
-        return fs_buff_valid(cmd);
-    } else if (!strcmp(cmd->type, "L")) {
-        // LISTS files and directories in cwd
-        return fs_ls_valid(cmd);
-    } else if (!strcmp(cmd->type, "O")) {
-        // DEFRAGMENT the disk
-        return fs_defrag_valid(cmd);
-    } else if (!strcmp(cmd->type, "Y")) {
-        // CHANGE the cwd
-        return fs_cd_valid(cmd);
-    } else {
-        // If the command type doesn't match any of the expected value, it is invalid
-        return 0;
+void pad_string(char *str, int len, char *padded_str) {
+    for (size_t i = 0; i < (size_t)len; i++) {
+        char c = str[i];
+        if (isupper((unsigned char)c)) {
+            c = tolower((unsigned char)c);
+        }
+        padded_str[i] = c;
     }
 }
 
 /**
- * @brief Validate a MOUNT command.
+ * @brief Decode a name argument into a padded, lowercased name field of the command.
+ * 
+ * @param arg - The name argument
+ * @param name - Field of the command struct to store the name in.
+ * @return Integer value 0 if the name is longer than 5 characters, 1 otherwise.
+ */
+static int decode_name(char *arg, char name[5]) {
+    size_t len = strlen(arg);
+    if (len > 5) return 0;
+    memset(name, 0, 5);
+    pad_string(arg, len, name);
+    return 1;
+}
+
+/**
+ * @brief Decode an integer argument into a number field of the command.
+ * 
+ * @param arg - The integer argument
+ * @param num - Field of the command struct to store the number in.
+ * @return Integer value 0 if the argument is not a whole number, 1 otherwise.
+ */
+static int decode_num(char *arg, long *num) {
+    char *endptr;
+    errno = 0;
+    *num = strtol(arg, &endptr, 10);
+    if (errno == ERANGE) return 0; // Resulting value out of range
+    if (endptr == arg) return 0; // No digits found
+    if (*endptr != '\0') return 0; // Further characters after number
+    return 1;
+}
+
+/**
+ * @brief Validate (and decode the arguments of) a MOUNT command.
  * 
+ * @param ctx - Context of the simulator instance
  * @param cmd - Instance of the command struct that contains information about command to run.
  * @return Integer value 0 if invalid, 1 if valid.
  */
-int fs_mount_valid(Command *cmd) {
+int fs_mount_valid(FsContext *ctx, Command *cmd) {
     // args: char *name
     // First check # of args
     if (cmd->size != 2) return 0;
@@ -62,117 +70,170 @@ int fs_mount_valid(Command *cmd) {
 }
 
 /**
- * @brief Validate a CREATE command.
+ * @brief Validate (and decode the arguments of) a CREATE command.
  * 
+ * @param ctx - Context of the simulator instance
  * @param cmd - Instance of the command struct that contains information about command to run.
  * @return Integer value 0 if invalid, 1 if valid.
  */
-int fs_create_valid(Command *cmd) {
+int fs_create_valid(FsContext *ctx, Command *cmd) {
     // args: char name[5], int size
     // First check # of args
     if (cmd->size != 3) return 0;
 
     // Check if length of name is > 5
-    if (strlen(cmd->argv[1]) > 5) return 0;
+    if (!decode_name(cmd->argv[1], cmd->name)) return 0;
 
     // Check if second arg can be converted to an int
-    char *endptr;
-    long val;
-    errno = 0;
-    val = strtol(cmd->argv[2], &endptr, 10);
-    if (errno == ERANGE) return 0; // Resulting value out of range
-    if (endptr == cmd->argv[2]) return 0; // No digits found
-    if (*endptr != '\0') return 0; // Further characters after number
+    if (!decode_num(cmd->argv[2], &cmd->num)) return 0;
 
-    // Check if file size is < 0 or > 127
-    if (val < 0 || val > 127) return 0;
+    // Check if file size is < 0 or larger than the disk format allows (127 on v1)
+    if (cmd->num < 0 || cmd->num > fs_max_file_blocks(ctx)) return 0;
 
     // Valid command
     return 1;
 }
 
 /**
- * @brief Validate a DELETE command
+ * @brief Validate (and decode the arguments of) a DELETE command
  * 
+ * @param ctx - Context of the simulator instance
  * @param cmd - Instance of the command struct that contains information about command to run.
  * @return Integer value 0 if invalid, 1 if valid.
  */
-int fs_delete_valid(Command *cmd) {
+int fs_delete_valid(FsContext *ctx, Command *cmd) {
     // args: char name[5]
     // First check # of args
     if (cmd->size != 2) return 0;
 
     // Check if length of name is > 5
-    if (strlen(cmd->argv[1]) > 5) return 0;
+    if (!decode_name(cmd->argv[1], cmd->name)) return 0;
 
     return 1;
 }
 
 /**
- * @brief Validate a READ command
+ * @brief Validate (and decode the arguments of) a READ command
  * 
+ * @param ctx - Context of the simulator instance
  * @param cmd - Instance of the command struct that contains information about command to run.
  * @return Integer value 0 if invalid, 1 if valid.
  */
-int fs_read_valid(Command *cmd) {
+int fs_read_valid(FsContext *ctx, Command *cmd) {
     // args: char name[5], int block_num
     // First check # of args
     if (cmd->size != 3) return 0;
 
     // Check if length of name is > 5
-    if (strlen(cmd->argv[1]) > 5) return 0;
+    if (!decode_name(cmd->argv[1], cmd->name)) return 0;
 
     // Check if second arg can be converted to an int
-    char *endptr;
-    long val;
-    errno = 0;
-    val = strtol(cmd->argv[2], &endptr, 10);
-    if (errno == ERANGE) return 0; // Resulting value out of range
-    if (endptr == cmd->argv[2]) return 0; // No digits found
-    if (*endptr != '\0') return 0; // Further characters after number
+    if (!decode_num(cmd->argv[2], &cmd->num)) return 0;
 
-    // Check if block index is < 0 or > 126
-    if (val < 0 || val > 126) return 0;
+    // Check if block index is < 0 or past the largest file the disk format allows (126 on v1)
+    if (cmd->num < 0 || cmd->num > fs_max_file_blocks(ctx) - 1) return 0;
 
     return 1;
 }
 
 /**
- * @brief Validate a WRITE command
+ * @brief Validate (and decode the arguments of) a WRITE command
  * 
+ * @param ctx - Context of the simulator instance
  * @param cmd - Instance of the command struct that contains information about command to run.
  * @return Integer value 0 if invalid, 1 if valid.
  */
-int fs_write_valid(Command *cmd) {
+int fs_write_valid(FsContext *ctx, Command *cmd) {
     // args: char name[5], int block_num
     // First check # of args
     if (cmd->size != 3) return 0;
 
     // Check if length of name is > 5
-    if (strlen(cmd->argv[1]) > 5) return 0;
+    if (!decode_name(cmd->argv[1], cmd->name)) return 0;
     
     // Check if second arg can be converted to an int
-    char *endptr;
-    long val;
-    errno = 0;
-    val = strtol(cmd->argv[2], &endptr, 10);
-    if (errno == ERANGE) return 0; // Resulting value out of range
-    if (endptr == cmd->argv[2]) return 0; // No digits found
-    if (*endptr != '\0') return 0; // Further characters after number
+    if (!decode_num(cmd->argv[2], &cmd->num)) return 0;
+
+    // Check if block index is < 0 or past the largest file the disk format allows (126 on v1)
+    if (cmd->num < 0 || cmd->num > fs_max_file_blocks(ctx) - 1) return 0;
+
+    return 1;
+}
+
+/**
+ * @brief Validate (and decode the arguments of) a COPY command
+ * 
+ * @param ctx - Context of the simulator instance
+ * @param cmd - Instance of the command struct that contains information about command to run.
+ * @return Integer value 0 if invalid, 1 if valid.
+ */
+int fs_copy_valid(FsContext *ctx, Command *cmd) {
+    // args: char name[5], char new_name[5]
+    // First check # of args
+    if (cmd->size != 3) return 0;
+
+    // Check if length of either name is > 5
+    if (!decode_name(cmd->argv[1], cmd->name)) return 0;
+    if (!decode_name(cmd->argv[2], cmd->new_name)) return 0;
+
+    return 1;
+}
 
-    // Check if block index is < 0 or > 126
-    if (val < 0 || val > 126) return 0;
+/**
+ * @brief Decode and check the arguments of a range READ or WRITE command.
+ * 
+ * @param ctx - Context of the simulator instance
+ * @param cmd - Instance of the command struct that contains information about command to run.
+ * @return Integer value 0 if invalid, 1 if valid.
+ */
+static int decode_range(FsContext *ctx, Command *cmd) {
+    // args: char name[5], int block_num, int count
+    // First check # of args
+    if (cmd->size != 4) return 0;
+
+    // Check if length of name is > 5
+    if (!decode_name(cmd->argv[1], cmd->name)) return 0;
+
+    // Check if the second and third args can be converted to ints
+    if (!decode_num(cmd->argv[2], &cmd->num)) return 0;
+    if (!decode_num(cmd->argv[3], &cmd->count)) return 0;
+
+    // Check if the range is empty or does not fit in the largest file the disk format allows (127 on v1)
+    if (cmd->num < 0 || cmd->count < 1 || cmd->count > fs_max_file_blocks(ctx) - cmd->num) return 0;
 
     return 1;
 }
 
 /**
- * @brief Validate a BUFFER update command
+ * @brief Validate (and decode the arguments of) a range READ command
+ * 
+ * @param ctx - Context of the simulator instance
+ * @param cmd - Instance of the command struct that contains information about command to run.
+ * @return Integer value 0 if invalid, 1 if valid.
+ */
+int fs_read_range_valid(FsContext *ctx, Command *cmd) {
+    return decode_range(ctx, cmd);
+}
+
+/**
+ * @brief Validate (and decode the arguments of) a range WRITE command
  * 
+ * @param ctx - Context of the simulator instance
  * @param cmd - Instance of the command struct that contains information about command to run.
  * @return Integer value 0 if invalid, 1 if valid.
  */
-int fs_buff_valid(Command *cmd) {
+int fs_write_range_valid(FsContext *ctx, Command *cmd) {
+    return decode_range(ctx, cmd);
+}
+
+/**
+ * @brief Validate (and decode the arguments of) a BUFFER update command
+ * 
+ * @param ctx - Context of the simulator instance
+ * @param cmd - Instance of the command struct that contains information about command to run.
+ * @return Integer value 0 if invalid, 1 if valid.
+ */
+int fs_buff_valid(FsContext *ctx, Command *cmd) {
     // args: uint8_t buff[1024]
     // First check # of args, return if no characters are being passed to buffer
     if (cmd->size == 1) return 0;
@@ -181,12 +242,13 @@ int fs_buff_valid(Command *cmd) {
 }
 
 /**
- * @brief Validate a LIST files command
+ * @brief Validate (and decode the arguments of) a LIST files command
  * 
+ * @param ctx - Context of the simulator instance
  * @param cmd - Instance of the command struct that contains information about command to run.
  * @return Integer value 0 if invalid, 1 if valid.
  */
-int fs_ls_valid(Command *cmd) {
+int fs_ls_valid(FsContext *ctx, Command *cmd) {
     // First check # of args
     if (cmd->size != 1) return 0;
 
@@ -194,31 +256,104 @@ int fs_ls_valid(Command *cmd) {
 }
 
 /**
- * @brief Validate a DEFRAGMENT command
+ * @brief Validate (and decode the arguments of) a DEFRAGMENT command
  * 
+ * @param ctx - Context of the simulator instance
  * @param cmd - Instance of the command struct that contains information about command to run.
  * @return Integer value 0 if invalid, 1 if valid.
  */
-int fs_defrag_valid(Command *cmd) {
+int fs_defrag_valid(FsContext *ctx, Command *cmd) {
+    // args: [int max_blocks [int max_us]]
     // First check # of args
-    if (cmd->size != 1) return 0;
+    if (cmd->size > 3) return 0;
+
+    // No budget runs the whole defrag
+    cmd->num = 0;
+    cmd->count = 0;
+    if (cmd->size > 1 && !decode_num(cmd->argv[1], &cmd->num)) return 0;
+    if (cmd->size > 2 && !decode_num(cmd->argv[2], &cmd->count)) return 0;
+
+    // Check if the budget is < 0 or too large to time
+    if (cmd->num < 0 || cmd->count < 0 || cmd->count > 1000000000) return 0;
 
     return 1;
 }
 
 /**
- * @brief Validate a CHANGE DIRECTORY command
+ * @brief Validate (and decode the arguments of) a CHANGE DIRECTORY command
  * 
+ * @param ctx - Context of the simulator instance
  * @param cmd - Instance of the command struct that contains information about command to run.
  * @return Integer value 0 if invalid, 1 if valid.
  */
-int fs_cd_valid(Command *cmd) {
+int fs_cd_valid(FsContext *ctx, Command *cmd) {
     // args: char name[5]
     // First check # of args
     if (cmd->size != 2) return 0;
 
     // Check if length of name is > 5
-    if (strlen(cmd->argv[1]) > 5) return 0;
+    if (!decode_name(cmd->argv[1], cmd->name)) return 0;
+
+    return 1;
+}
+
+/**
+ * @brief Validate (and decode the arguments of) a SYNC command
+ * 
+ * @param ctx - Context of the simulator instance
+ * @param cmd - Instance of the command struct that contains information about command to run.
+ * @return Integer value 0 if invalid, 1 if valid.
+ */
+int fs_sync_valid(FsContext *ctx, Command *cmd) {
+    // First check # of args
+    if (cmd->size != 1) return 0;
+
+    return 1;
+}
+
+/**
+ * @brief Validate (and decode the arguments of) a STATS command
+ * 
+ * @param ctx - Context of the simulator instance
+ * @param cmd - Instance of the command struct that contains information about command to run.
+ * @return Integer value 0 if invalid, 1 if valid.
+ */
+int fs_stats_valid(FsContext *ctx, Command *cmd) {
+    // First check # of args
+    if (cmd->size != 1) return 0;
+
+    return 1;
+}
+
+/**
+ * @brief Validate (and decode the arguments of) an ALLOCATION POLICY command.
+ * 
+ * @param ctx - Context of the simulator instance
+ * @param cmd - Instance of the command struct that contains information about command to run.
+ * @return Integer value 0 if invalid, 1 if valid.
+ */
+int fs_policy_valid(FsContext *ctx, Command *cmd) {
+    // args: char *policy
+    // First check # of args
+    if (cmd->size != 2) return 0;
+
+    // Check if the policy name is known
+    cmd->num = alloc_policy_parse(cmd->argv[1]);
+    if (cmd->num == -1) return 0;
 
     return 1;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Validate (and decode the arguments of) a free EXTENTS (fragmentation) command.
+ * 
+ * @param ctx - Context of the simulator instance
+ * @param cmd - Instance of the command struct that contains information about command to run.
+ * @return Integer value 0 if invalid, 1 if valid.
+ */
+int fs_frag_valid(FsContext *ctx, Command *cmd) {
+    // First check # of args
+    if (cmd->size != 1) return 0;
+
+    return 1;
+}
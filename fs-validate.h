@@ -4,83 +4,156 @@
 #include "fs-sim.h"
 
 /**
- * @brief Validate the given command based on the command it will execute.
+ * @brief Pad a string to a given length (determined by the size of padded_str arg)
  * 
+ * @param str - The string to pad
+ * @param len - length of the original string 
+ * @param padded_str - The padded string to fill with characters of the orginal string (up to len)
+ */
+void pad_string(char *str, int len, char *padded_str);
+
+/**
+ * @brief Validate (and decode the arguments of) a MOUNT command.
+ * 
+ * @param ctx - Context of the simulator instance
+ * @param cmd - Instance of the command struct that contains information about command to run.
+ * @return Integer value 0 if invalid, 1 if valid.
+ */
+int fs_mount_valid(FsContext *ctx, Command *cmd);
+
+/**
+ * @brief Validate (and decode the arguments of) a CREATE command.
+ * 
+ * @param ctx - Context of the simulator instance
+ * @param cmd - Instance of the command struct that contains information about command to run.
+ * @return Integer value 0 if invalid, 1 if valid.
+ */
+int fs_create_valid(FsContext *ctx, Command *cmd);
+
+/**
+ * @brief Validate (and decode the arguments of) a DELETE command
+ * 
+ * @param ctx - Context of the simulator instance
+ * @param cmd - Instance of the command struct that contains information about command to run.
+ * @return Integer value 0 if invalid, 1 if valid.
+ */
+int fs_delete_valid(FsContext *ctx, Command *cmd);
+
+/**
+ * @brief Validate (and decode the arguments of) a READ command
+ * 
+ * @param ctx - Context of the simulator instance
+ * @param cmd - Instance of the command struct that contains information about command to run.
+ * @return Integer value 0 if invalid, 1 if valid.
+ */
+int fs_read_valid(FsContext *ctx, Command *cmd);
+
+/**
+ * @brief Validate (and decode the arguments of) a WRITE command
+ * 
+ * @param ctx - Context of the simulator instance
+ * @param cmd - Instance of the command struct that contains information about command to run.
+ * @return Integer value 0 if invalid, 1 if valid.
+ */
+int fs_write_valid(FsContext *ctx, Command *cmd);
+
+/**
+ * @brief Validate (and decode the arguments of) a COPY command
+ * 
+ * @param ctx - Context of the simulator instance
+ * @param cmd - Instance of the command struct that contains information about command to run.
+ * @return Integer value 0 if invalid, 1 if valid.
+ */
+int fs_copy_valid(FsContext *ctx, Command *cmd);
+
+/**
+ * @brief Validate (and decode the arguments of) a range READ command
+ * 
+ * @param ctx - Context of the simulator instance
  * @param cmd - Instance of the command struct that contains information about command to run.
  * @return Integer value 0 if invalid, 1 if valid.
  */
-int validateCommand(Command *cmd);
+int fs_read_range_valid(FsContext *ctx, Command *cmd);
 
 /**
- * @brief Validate a MOUNT command.
+ * @brief Validate (and decode the arguments of) a range WRITE command
  * 
+ * @param ctx - Context of the simulator instance
  * @param cmd - Instance of the command struct that contains information about command to run.
  * @return Integer value 0 if invalid, 1 if valid.
  */
-int fs_mount_valid(Command *cmd);
+int fs_write_range_valid(FsContext *ctx, Command *cmd);
 
 /**
- * @brief Validate a CREATE command.
+ * @brief Validate (and decode the arguments of) a BUFFER update command
  * 
+ * @param ctx - Context of the simulator instance
  * @param cmd - Instance of the command struct that contains information about command to run.
  * @return Integer value 0 if invalid, 1 if valid.
  */
-int fs_create_valid(Command *cmd);
+int fs_buff_valid(FsContext *ctx, Command *cmd);
 
 /**
- * @brief Validate a DELETE command
+ * @brief Validate (and decode the arguments of) a LIST files command
  * 
+ * @param ctx - Context of the simulator instance
  * @param cmd - Instance of the command struct that contains information about command to run.
  * @return Integer value 0 if invalid, 1 if valid.
  */
-int fs_delete_valid(Command *cmd);
+int fs_ls_valid(FsContext *ctx, Command *cmd);
 
 /**
- * @brief Validate a READ command
+ * @brief Validate (and decode the arguments of) a DEFRAGMENT command
  * 
+ * @param ctx - Context of the simulator instance
  * @param cmd - Instance of the command struct that contains information about command to run.
  * @return Integer value 0 if invalid, 1 if valid.
  */
-int fs_read_valid(Command *cmd);
+int fs_defrag_valid(FsContext *ctx, Command *cmd);
 
 /**
- * @brief Validate a WRITE command
+ * @brief Validate (and decode the arguments of) a CHANGE DIRECTORY command
  * 
+ * @param ctx - Context of the simulator instance
  * @param cmd - Instance of the command struct that contains information about command to run.
  * @return Integer value 0 if invalid, 1 if valid.
  */
-int fs_write_valid(Command *cmd);
+int fs_cd_valid(FsContext *ctx, Command *cmd);
 
 /**
- * @brief Validate a BUFFER update command
+ * @brief Validate (and decode the arguments of) a SYNC command
  * 
+ * @param ctx - Context of the simulator instance
  * @param cmd - Instance of the command struct that contains information about command to run.
  * @return Integer value 0 if invalid, 1 if valid.
  */
-int fs_buff_valid(Command *cmd);
+int fs_sync_valid(FsContext *ctx, Command *cmd);
 
 /**
- * @brief Validate a LIST files command
+ * @brief Validate (and decode the arguments of) a STATS command
  * 
+ * @param ctx - Context of the simulator instance
  * @param cmd - Instance of the command struct that contains information about command to run.
  * @return Integer value 0 if invalid, 1 if valid.
  */
-int fs_ls_valid(Command *cmd);
+int fs_stats_valid(FsContext *ctx, Command *cmd);
 
 /**
- * @brief Validate a DEFRAGMENT command
+ * @brief Validate (and decode the arguments of) an ALLOCATION POLICY command
  * 
+ * @param ctx - Context of the simulator instance
  * @param cmd - Instance of the command struct that contains information about command to run.
  * @return Integer value 0 if invalid, 1 if valid.
  */
-int fs_defrag_valid(Command *cmd);
+int fs_policy_valid(FsContext *ctx, Command *cmd);
 
 /**
- * @brief Validate a CHANGE DIRECTORY command
+ * @brief Validate (and decode the arguments of) a free EXTENTS (fragmentation) command
  * 
+ * @param ctx - Context of the simulator instance
  * @param cmd - Instance of the command struct that contains information about command to run.
  * @return Integer value 0 if invalid, 1 if valid.
  */
-int fs_cd_valid(Command *cmd);
+int fs_frag_valid(FsContext *ctx, Command *cmd);
 
 #endif
\ No newline at end of file
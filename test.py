@@ -3,8 +3,12 @@ import difflib
 import os
 import re
 import shutil
+import signal
+import socket
 import subprocess
+import sys
 import tempfile
+import time
 from contextlib import contextmanager
 from pathlib import Path
 
@@ -23,17 +27,110 @@ def clean_lines(lines):
     return [x.strip() for x in lines if len(x.strip()) > 0]
 
 
+def match_numbers(expected, actual):
+    # "{n}" in an expected line stands for any number (timings), so an actual line that only differs there
+    # (and in spacing) is replaced by the expected one
+    matched = []
+    for i, line in enumerate(actual):
+        if i < len(expected) and '{n}' in expected[i]:
+            pattern = r'\s+'.join(re.escape(word).replace(r'\{n\}', r'\d+') for word in expected[i].split())
+            if re.fullmatch(pattern, line):
+                line = expected[i]
+        matched.append(line)
+    return matched
+
+
+@contextmanager
+def daemon_running(options):
+    # The daemon of a case serves fs.sock in the case directory until the case is done, which also
+    # writes back what it keeps of the disks
+    daemon = subprocess.Popen([str(executable)] + options + ['-D', 'fs.sock'])
+    try:
+        for _ in range(500):
+            if Path('fs.sock').exists():
+                break
+            time.sleep(0.01)
+        yield
+    finally:
+        daemon.send_signal(signal.SIGTERM)
+        daemon.wait(timeout=30)
+
+
+def run_sessions(lines):
+    # Every line is "<session> <command>": a session is a connection to the daemon, opened the first
+    # time it is used. Each command is followed by a T command, and the T table is read back before the
+    # next line is sent, so the lines of different sessions run in exactly this order. The T tables are
+    # left out of the output.
+    sessions = {}
+    stdout, stderr = [], []
+
+    def read_reply(conn, until_table_end):
+        in_table = False
+        while True:
+            while b'\n' not in conn['data']:
+                chunk = conn['sock'].recv(4096)
+                if not chunk:
+                    return
+                conn['data'] += chunk
+            line, conn['data'] = conn['data'].split(b'\n', 1)
+            channel, text = line[:1], line[1:].decode()
+            if channel == b'1' and text.startswith('Command '):
+                in_table = True
+            if not in_table:
+                (stdout if channel == b'1' else stderr).append(text)
+            if in_table and text.startswith('I/O:'):
+                in_table = False
+                if until_table_end:
+                    return
+
+    for line in clean_lines(lines):
+        name, command = line.split(' ', 1)
+        if name not in sessions:
+            sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+            sock.connect('fs.sock')
+            sessions[name] = {'sock': sock, 'data': b''}
+        sessions[name]['sock'].sendall(f"{command}\nT\n".encode())
+        read_reply(sessions[name], True)
+    for conn in sessions.values():
+        conn['sock'].shutdown(socket.SHUT_WR)
+        read_reply(conn, False)
+        conn['sock'].close()
+    return subprocess.CompletedProcess([], 0, '\n'.join(stdout), '\n'.join(stderr))
+
+
 def run_test(test_dir):
+    failures = 0
     print(f">>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>> {test_dir.name} <<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<")
     pwd = subprocess.run('pwd', capture_output=True, text=True)
     stdout_expected = (Path.cwd() / 'stdout_expected').resolve()
     stderr_expected = (Path.cwd() / 'stderr_expected').resolve()
 
-    fs = subprocess.run(
-        [str(executable), 'input'],
-        capture_output=True,
-        text=True,
-    )
+    # Command line options of the case, if any, go before the input file
+    args = Path.cwd() / 'args'
+    options = args.read_text().split() if args.exists() else []
+    # A case with several scripts (input, input2, input3, ...) runs them all in one process, in this order
+    inputs = sorted(x.name for x in Path.cwd().glob('input*'))
+
+    # A case with a daemon file runs its input files through a daemon started with the options in it
+    # ("./fs -C"), or the lines of its sessions file (see run_sessions())
+    daemon = Path.cwd() / 'daemon'
+    sessions = Path.cwd() / 'sessions'
+    if daemon.exists():
+        with daemon_running(daemon.read_text().split()):
+            if sessions.exists():
+                fs = run_sessions(sessions.read_text().split('\n'))
+            else:
+                fs = subprocess.run(
+                    [str(executable), '-C', 'fs.sock'] + inputs,
+                    capture_output=True,
+                    text=True,
+                )
+    else:
+        fs = subprocess.run(
+            [str(executable)] + options + inputs,
+            capture_output=True,
+            text=True,
+        )
 
     disks = [x for x in Path.cwd().glob('*') if re.match(r'^disk\d?$', x.name)]
     for disk in disks:
@@ -48,6 +145,19 @@ def run_test(test_dir):
             print(f"✅ {disk.name}: Matches expected disk")
         else:
             print(f"❌ {disk.name}: DOES NOT MATCH expected disk")
+            failures += 1
+
+    # Disk images are sparse: allocated_expected lists the most KB each disk may take on the host
+    allocated_expected = Path.cwd() / 'allocated_expected'
+    if allocated_expected.exists():
+        for line in clean_lines(allocated_expected.read_text().split('\n')):
+            name, most_kb = line.split()
+            allocated_kb = os.stat(name).st_blocks * 512 // 1024
+            if allocated_kb <= int(most_kb):
+                print(f"✅ {name}: Takes {allocated_kb} KB on the host (at most {most_kb} KB)")
+            else:
+                print(f"❌ {name}: Takes {allocated_kb} KB on the host, MORE than {most_kb} KB")
+                failures += 1
 
     with open(stdout_expected, 'r') as f:
         stdout_expected = f.readlines()
@@ -57,7 +167,7 @@ def run_test(test_dir):
     differ = difflib.Differ()
 
     stdout_expected = clean_lines(stdout_expected)
-    stdout_acc = clean_lines(fs.stdout.split('\n'))
+    stdout_acc = match_numbers(stdout_expected, clean_lines(fs.stdout.split('\n')))
     diff = list(differ.compare(stdout_expected, stdout_acc))
     nb_wrong = sum([int(x.startswith('+') or x.startswith('-')) for x in diff])
     if nb_wrong == 0:
@@ -66,9 +176,10 @@ def run_test(test_dir):
         print("❌ ===== STDOUT DIFF, (+) extra line, (-) missing line, ( ) is correct =======")
         print('\n'.join(diff))
         print("==============================================================================")
+        failures += 1
 
     stderr_expected = clean_lines(stderr_expected)
-    stderr_acc = clean_lines(fs.stderr.split('\n'))
+    stderr_acc = match_numbers(stderr_expected, clean_lines(fs.stderr.split('\n')))
     diff = list(differ.compare(stderr_expected, stderr_acc))
     nb_wrong = sum([int(x.startswith('+') or x.startswith('-')) for x in diff])
     if nb_wrong == 0:
@@ -77,14 +188,18 @@ def run_test(test_dir):
         print("❌ ===== STDERR DIFF, (+) extra line, (-) missing line, ( ) is correct =======")
         print('\n'.join(diff))
         print("==============================================================================")
+        failures += 1
+    return failures
 
 
 if __name__ == '__main__':
     tests = list(Path('./tests').glob('test*'))
     executable = Path('./fs').resolve()
 
+    failures = 0
     for t in sorted(tests):
         with tempfile.TemporaryDirectory() as tmpdir:
             shutil.copytree(t, tmpdir, dirs_exist_ok=True)
             with change_dir(tmpdir):
-                run_test(t)
+                failures += run_test(t)
+    sys.exit(1 if failures > 0 else 0)